@@ -2,10 +2,25 @@
 #include "window.h"
 #include "device.h"
 #include "resource.h"
+#include "pack.h"
+#include "benchmark.h"
+#include "streaming.h"
+#include "residency.h"
+#include "frame.h"
+#include "record.h"
+#include "drawsort.h"
+#include "instance.h"
+#include "sprite.h"
+#include "gpucull.h"
+#include "hiz.h"
 
 #include <vulkan/vulkan.hpp>
 #include <iostream>
-#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -32,6 +47,13 @@ struct uniform_vertex_t
     glm::mat4 model;
 };
 
+// push constants of color-push-vert.glsl
+struct push_vertex_t
+{
+    glm::mat4 model;
+    uint32_t index;
+};
+
 struct uniform_fragment_t
 {
     glm::vec4 tint;
@@ -39,12 +61,13 @@ struct uniform_fragment_t
 
 size_t aligned_size(size_t sz, size_t alignment)
 {
-    return ((sz - 1) & alignment) + alignment;
+    // alignment is a power of 2
+    return (sz + alignment - 1) & ~(alignment - 1);
 }
 template <typename T>
 size_t aligned_size(const std::vector<T>& v, size_t alignment)
 {
-    return aligned_size(sizeof(T) * T.size(), alignment);
+    return aligned_size(sizeof(T) * v.size(), alignment);
 }
 template <typename T, size_t N>
 size_t aligned_size(const std::array<T, N>& v, size_t alignment)
@@ -52,22 +75,96 @@ size_t aligned_size(const std::array<T, N>& v, size_t alignment)
     return aligned_size(sizeof(T) * N, alignment);
 }
 
-vk::UniqueShaderModule load_shader(const vk::UniqueDevice& device, const std::string& path)
+int main(int argc, char** argv)
 {
-    std::ifstream file(path, std::ios::binary | std::ios::ate);
-    size_t size = file.tellg();
-    file.seekg(std::ios::beg);
-    auto buffer = std::make_unique<char[]>(size);
-    file.read(buffer.get(), size);
-
-    vk::ShaderModuleCreateInfo module_info;
-    module_info.codeSize = size;
-    module_info.pCode = reinterpret_cast<uint32_t*>(buffer.get());
-    return device->createShaderModuleUnique(module_info);
-}
+    std::vector<std::string> args(argv + 1, argv + argc);
+    // options anywhere on the command line, removed from args
+    auto take_option = [&](const char* name, uint32_t value) {
+        if (auto it = std::find(args.begin(), args.end(), name); it != args.end() && it + 1 != args.end())
+        {
+            value = std::stoi(*(it + 1));
+            args.erase(it, it + 2);
+        }
+        return value;
+    };
+    // --frames N sets the frames in flight, 1 to 3
+    uint32_t frames_in_flight = take_option("--frames", 2);
+    // --draws N draws the quad N times, --threads N records them on N threads
+    uint32_t draw_count = take_option("--draws", 1);
+    uint32_t record_threads = std::max<uint32_t>(take_option("--threads", 1), 1);
+    // --sprites N draws N sprites through the sprite batcher instead of the quads
+    uint32_t sprite_count = take_option("--sprites", 0);
+    // --indirect N draws N objects culled on the GPU with one indirect draw, the camera pans over them
+    uint32_t indirect_count = take_option("--indirect", 0);
+    // --city N is the same with N buildings seen from the street, hidden ones culled against a depth pyramid
+    uint32_t city_count = take_option("--city", 0);
+    if (city_count > 0)
+        indirect_count = city_count;
+    // --push sends the model matrix of every draw as push constants, the draws are laid out on a grid
+    bool push_draws = false;
+    if (auto it = std::find(args.begin(), args.end(), "--push"); it != args.end())
+    {
+        push_draws = true;
+        args.erase(it);
+    }
+    // --instances draws all the quads with one instanced draw per recorded range
+    bool instanced_draws = false;
+    if (auto it = std::find(args.begin(), args.end(), "--instances"); it != args.end())
+    {
+        instanced_draws = true;
+        args.erase(it);
+    }
+    // VulkanLezione --bench instancing [max] needs the instanced pipeline
+    bool bench_instances = args.size() >= 2 && args[0] == "--bench" && args[1] == "instancing";
+    uint32_t instance_capacity = draw_count;
+    if (bench_instances)
+    {
+        instanced_draws = true;
+        instance_capacity = args.size() >= 3 ? std::stoi(args[2]) : 1000000;
+    }
+    // the instance transforms replace the push constants, sprites use the plain quad pipeline
+    push_draws = push_draws && !instanced_draws && sprite_count == 0 && indirect_count == 0;
+    instanced_draws = instanced_draws && sprite_count == 0 && indirect_count == 0;
+    if (indirect_count > 0)
+        sprite_count = 0;
+    // --static records the draws once per frame slot and re-records them only when their inputs change
+    bool static_draws = false;
+    if (auto it = std::find(args.begin(), args.end(), "--static"); it != args.end())
+    {
+        static_draws = true;
+        args.erase(it);
+    }
+
+    // Offline cooking: VulkanLezione --cook assets.pack image0.png image1.png ...
+    if (args.size() >= 2 && args[0] == "--cook")
+        return cook_pack(args[1], { args.begin() + 2, args.end() }) ? EXIT_SUCCESS : EXIT_FAILURE;
+    // CPU only benchmarks, no window or device needed
+    if (args.size() == 2 && args[0] == "--bench" && args[1] == "pixel")
+    {
+        bench_pixel_kernels();
+        return EXIT_SUCCESS;
+    }
+    if (args.size() == 2 && args[0] == "--bench" && args[1] == "sort")
+    {
+        bench_draw_sort();
+        return EXIT_SUCCESS;
+    }
+    if (args.size() == 2 && args[0] == "--bench" && args[1] == "jobs")
+    {
+        bench_jobs();
+        return EXIT_SUCCESS;
+    }
+    if (args.size() == 2 && args[0] == "--bench" && args[1] == "occlusion")
+    {
+        bench_occlusion();
+        return EXIT_SUCCESS;
+    }
+    if (args.size() == 2 && args[0] == "--bench" && args[1] == "frustum")
+    {
+        bench_frustum_cull();
+        return EXIT_SUCCESS;
+    }
 
-int main()
-{
     Device device;
     device.init_instance();
     HWND hWnd = create_window(800, 600);
@@ -77,13 +174,57 @@ int main()
     MemoryAllocator ma(device, 64 << 20);
     ResourceManager rm(device, ma);
 
-    // Load texture
-    auto tex = rm.load_texture2D("vulkan-logo.png");
+    // VulkanLezione --bench cold-start assets.pack image0.png image1.png ...
+    if (args.size() >= 3 && args[0] == "--bench" && args[1] == "cold-start")
+    {
+        bench_cold_start(rm, args[2], { args.begin() + 3, args.end() });
+        return EXIT_SUCCESS;
+    }
+    // VulkanLezione --bench rgb-upload image0.jpg image1.jpg ...
+    if (args.size() >= 2 && args[0] == "--bench" && args[1] == "rgb-upload")
+    {
+        bench_rgb_upload(rm, { args.begin() + 2, args.end() });
+        return EXIT_SUCCESS;
+    }
+    // VulkanLezione --bench host-copy image0.png image1.png ...
+    if (args.size() >= 2 && args[0] == "--bench" && args[1] == "host-copy")
+    {
+        bench_host_copy(rm, { args.begin() + 2, args.end() });
+        return EXIT_SUCCESS;
+    }
+    // VulkanLezione --bench io blocking|batched file0 file1 ...
+    if (args.size() >= 3 && args[0] == "--bench" && args[1] == "io")
+    {
+        bench_file_io(rm, args[2] == "batched", { args.begin() + 3, args.end() });
+        return EXIT_SUCCESS;
+    }
+    // VulkanLezione --bench cmd-reset [draws]
+    if (args.size() >= 2 && args[0] == "--bench" && args[1] == "cmd-reset")
+    {
+        bench_command_reset(device, args.size() >= 3 ? std::stoi(args[2]) : 1000);
+        return EXIT_SUCCESS;
+    }
+    // VulkanLezione --bench async image0.png image1.hdr ...
+    if (args.size() >= 2 && args[0] == "--bench" && args[1] == "async")
+    {
+        bench_async_load(rm, { args.begin() + 2, args.end() });
+        return EXIT_SUCCESS;
+    }
+    // VulkanLezione --bench progressive image0.png image1.png ...
+    if (args.size() >= 2 && args[0] == "--bench" && args[1] == "progressive")
+    {
+        bench_progressive(rm, { args.begin() + 2, args.end() });
+        return EXIT_SUCCESS;
+    }
+
+    if (std::filesystem::exists("assets.pack"))
+        rm.mount_pack("assets.pack");
 
-    vk::SamplerCreateInfo sampler_info;
-    sampler_info.minFilter = vk::Filter::eLinear;
-    sampler_info.magFilter = vk::Filter::eLinear;
-    vk::UniqueSampler sampler = device.device->createSamplerUnique(sampler_info);
+    // Load texture, the mip tail is usable right away and the bigger mips stream in later
+    TextureStreamer streamer(rm);
+    auto tex = streamer.load_texture2D("vulkan-logo.png");
+    ResidencyManager residency(rm);
+    residency.track(tex);
 
     // Create Vertex and Index buffer
     std::vector<uint32_t> quad_indices{ 0, 1, 2, 0, 2, 3 };
@@ -93,19 +234,40 @@ int main()
         vertex_t{glm::vec3( 1, 1, 0), glm::vec3(0, 1, 1), glm::vec2(1, 1)},
         vertex_t{glm::vec3( 1,-1, 0), glm::vec3(1, 0, 1), glm::vec2(1, 0)},
     };
+    // the city is made of boxes, 4 vertices per face so every face gets the whole texture
+    if (city_count > 0)
+    {
+        quad_indices.clear();
+        quad_vertices.clear();
+        for (uint32_t face = 0; face < 6; face++)
+        {
+            uint32_t axis = face / 2;
+            float side = face % 2 ? 1.f : -1.f;
+            uint32_t base = static_cast<uint32_t>(quad_vertices.size());
+            for (glm::vec2 corner : { glm::vec2(0, 0), glm::vec2(0, 1), glm::vec2(1, 1), glm::vec2(1, 0) })
+            {
+                glm::vec3 pos;
+                pos[axis] = side;
+                pos[(axis + 1) % 3] = corner.x * 2.f - 1.f;
+                pos[(axis + 2) % 3] = corner.y * 2.f - 1.f;
+                quad_vertices.push_back({ pos, glm::vec3(1.f), corner });
+            }
+            quad_indices.insert(quad_indices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+        }
+    }
     size_t quad_indices_off = 0;
     size_t quad_indices_size = aligned_size(quad_indices.size() * sizeof(uint32_t), 0x100);
     size_t quad_vertices_off = quad_indices_off + quad_indices_size;
     size_t quad_vertices_size = aligned_size(quad_vertices.size() * sizeof(vertex_t), 0x100);
-    size_t quad_uniform_vertex_off = quad_vertices_off + quad_vertices_size;
+    // every frame in flight gets its own copy of the uniforms
+    size_t quad_uniform_off = quad_vertices_off + quad_vertices_size;
     size_t quad_uniform_vertex_size = aligned_size(sizeof(uniform_vertex_t), 0x100);
-    size_t quad_uniform_fragment_off = quad_uniform_vertex_off + quad_uniform_vertex_size;
     size_t quad_uniform_fragment_size = aligned_size(sizeof(uniform_fragment_t), 0x100);
+    size_t quad_uniform_frame_size = quad_uniform_vertex_size + quad_uniform_fragment_size;
     vk::BufferCreateInfo quad_buffer_info;
     quad_buffer_info.size = quad_indices_size
         + quad_vertices_size
-        + quad_uniform_vertex_size
-        + quad_uniform_fragment_size;
+        + quad_uniform_frame_size * frames_in_flight;
     quad_buffer_info.usage = vk::BufferUsageFlagBits::eIndexBuffer
         | vk::BufferUsageFlagBits::eVertexBuffer
         | vk::BufferUsageFlagBits::eUniformBuffer;
@@ -132,12 +294,26 @@ int main()
     vk::DescriptorSetLayoutCreateInfo descrset_layout_info;
     descrset_layout_info.setBindings(descrset_layout_bindings);
     vk::UniqueDescriptorSetLayout descrset_layout = device.device->createDescriptorSetLayoutUnique(descrset_layout_info);
+    // per draw data goes through push constants, shared data stays in the uniform buffers
+    vk::PushConstantRange push_range(vk::ShaderStageFlagBits::eVertex, 0,
+        offsetof(push_vertex_t, index) + sizeof(uint32_t));
+    // GPU culled objects are read by the vertex shader through set 1 of the culling pass
+    std::unique_ptr<GpuCuller> culler;
+    std::vector<vk::DescriptorSetLayout> pipeline_set_layouts{ *descrset_layout };
+    if (indirect_count > 0)
+    {
+        culler = std::make_unique<GpuCuller>(rm, indirect_count, frames_in_flight);
+        pipeline_set_layouts.push_back(*culler->descrset_layout);
+    }
     vk::PipelineLayoutCreateInfo pipeline_layout_info;
-    pipeline_layout_info.setSetLayouts(*descrset_layout);
+    pipeline_layout_info.setSetLayouts(pipeline_set_layouts);
+    pipeline_layout_info.setPushConstantRanges(push_range);
     vk::UniquePipelineLayout pipeline_layout = device.device->createPipelineLayoutUnique(pipeline_layout_info);
 
     // Create RenderPass
-    std::vector<vk::AttachmentDescription> renderpass_attachments(1);
+    // with --city a second pass draws what the rebuilt depth pyramid uncovered: the first one keeps
+    // the color attachment for it and leaves the depth readable by the pyramid build
+    std::vector<vk::AttachmentDescription> renderpass_attachments(2);
     renderpass_attachments[0].format = device.swapchain_info.imageFormat;
     renderpass_attachments[0].samples = vk::SampleCountFlagBits::e1;
     renderpass_attachments[0].loadOp = vk::AttachmentLoadOp::eClear;
@@ -145,21 +321,73 @@ int main()
     renderpass_attachments[0].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
     renderpass_attachments[0].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
     renderpass_attachments[0].initialLayout = vk::ImageLayout::eColorAttachmentOptimal;
-    renderpass_attachments[0].finalLayout = vk::ImageLayout::ePresentSrcKHR;
+    renderpass_attachments[0].finalLayout = city_count > 0 ? vk::ImageLayout::eColorAttachmentOptimal : vk::ImageLayout::ePresentSrcKHR;
+    vk::Format depth_format = vk::Format::eD32Sfloat;
+    renderpass_attachments[1].format = depth_format;
+    renderpass_attachments[1].samples = vk::SampleCountFlagBits::e1;
+    renderpass_attachments[1].loadOp = vk::AttachmentLoadOp::eClear;
+    renderpass_attachments[1].storeOp = city_count > 0 ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+    renderpass_attachments[1].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    renderpass_attachments[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    renderpass_attachments[1].initialLayout = vk::ImageLayout::eUndefined;
+    renderpass_attachments[1].finalLayout = city_count > 0 ? vk::ImageLayout::eDepthStencilReadOnlyOptimal
+        : vk::ImageLayout::eDepthStencilAttachmentOptimal;
     std::vector<vk::SubpassDescription> renderpass_subpasses(1);
     vk::AttachmentReference renderpass_ref_coolor;
     renderpass_ref_coolor.attachment = 0;
     renderpass_ref_coolor.layout = vk::ImageLayout::eColorAttachmentOptimal;
     renderpass_subpasses[0].pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
     renderpass_subpasses[0].setColorAttachments(renderpass_ref_coolor);
+    vk::AttachmentReference renderpass_ref_depth(1, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+    renderpass_subpasses[0].pDepthStencilAttachment = &renderpass_ref_depth;
+    // the depth is shared by the frames in flight and read by the pyramid build between the passes
+    vk::PipelineStageFlags depth_stages = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+    std::vector<vk::SubpassDependency> renderpass_dependencies{
+        vk::SubpassDependency(VK_SUBPASS_EXTERNAL, 0,
+            depth_stages | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            depth_stages | vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eColorAttachmentWrite,
+            vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite
+            | vk::AccessFlagBits::eColorAttachmentWrite),
+        vk::SubpassDependency(0, VK_SUBPASS_EXTERNAL,
+            depth_stages | vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            depth_stages | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eColorAttachmentWrite,
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eDepthStencilAttachmentRead
+            | vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eColorAttachmentWrite),
+    };
     vk::RenderPassCreateInfo renderpass_info;
     renderpass_info.setAttachments(renderpass_attachments);
     renderpass_info.setSubpasses(renderpass_subpasses);
+    renderpass_info.setDependencies(renderpass_dependencies);
     vk::UniqueRenderPass renderpass = device.device->createRenderPassUnique(renderpass_info);
+    // late pass of --city: keeps what the first one drew and presents
+    vk::UniqueRenderPass renderpass_late;
+    if (city_count > 0)
+    {
+        renderpass_attachments[0].loadOp = vk::AttachmentLoadOp::eLoad;
+        renderpass_attachments[0].finalLayout = vk::ImageLayout::ePresentSrcKHR;
+        renderpass_attachments[1].loadOp = vk::AttachmentLoadOp::eLoad;
+        renderpass_attachments[1].storeOp = vk::AttachmentStoreOp::eDontCare;
+        renderpass_attachments[1].initialLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+        renderpass_attachments[1].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+        renderpass_late = device.device->createRenderPassUnique(renderpass_info);
+    }
 
     // Load Shader modules
-    auto VertexModule = load_shader(device.device, "shaders/color-vert.glsl.spv");
-    auto FragmentModule = load_shader(device.device, "shaders/color-frag.glsl.spv");
+    // one batch for every shader, read on the I/O thread
+    const char* vertex_shader = "shaders/color-vert.glsl.spv";
+    if (indirect_count > 0)
+        vertex_shader = "shaders/color-indirect-vert.glsl.spv";
+    else if (instanced_draws)
+        vertex_shader = "shaders/color-instanced-vert.glsl.spv";
+    else if (push_draws)
+        vertex_shader = "shaders/color-push-vert.glsl.spv";
+    auto shader_files = rm.files->read_all({
+        vertex_shader,
+        "shaders/color-frag.glsl.spv" });
+    auto VertexModule = load_shader(device.device, shader_files[0]);
+    auto FragmentModule = load_shader(device.device, shader_files[1]);
     
     // Create Pipeline
     std::vector<vk::PipelineShaderStageCreateInfo> pipeline_stages{
@@ -174,6 +402,13 @@ int main()
         vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32B32Sfloat, offsetof(vertex_t, col)),
         vk::VertexInputAttributeDescription(2, 0, vk::Format::eR32G32Sfloat, offsetof(vertex_t, uvs)),
     };
+    // instance data comes from a second buffer, stepped once per instance
+    if (instanced_draws)
+    {
+        pipeline_input_bindings.push_back(instance_input_binding(1));
+        auto attributes = instance_input_attributes(1, 3);
+        pipeline_input_attributes.insert(pipeline_input_attributes.end(), attributes.begin(), attributes.end());
+    }
     vk::PipelineVertexInputStateCreateInfo pipeline_input;
     pipeline_input.setVertexBindingDescriptions(pipeline_input_bindings);
     pipeline_input.setVertexAttributeDescriptions(pipeline_input_attributes);
@@ -204,7 +439,9 @@ int main()
     pipeline_multisample.sampleShadingEnable = false;
 
     vk::PipelineDepthStencilStateCreateInfo pipeline_depth;
-    pipeline_depth.depthTestEnable = false;
+    pipeline_depth.depthTestEnable = city_count > 0;
+    pipeline_depth.depthWriteEnable = city_count > 0;
+    pipeline_depth.depthCompareOp = vk::CompareOp::eLess;
     pipeline_depth.stencilTestEnable = false;
 
     vk::ColorComponentFlags color_mask =
@@ -239,49 +476,131 @@ int main()
     vk::UniquePipeline pipeline = device.device->createGraphicsPipelineUnique(nullptr, pipeline_info).value;
 
     std::vector<vk::DescriptorPoolSize> descrpool_sizes{
-        vk::DescriptorPoolSize{vk::DescriptorType::eUniformBuffer, 2},
-        vk::DescriptorPoolSize{vk::DescriptorType::eCombinedImageSampler, 1},
+        vk::DescriptorPoolSize{vk::DescriptorType::eUniformBuffer, 2 * frames_in_flight},
+        vk::DescriptorPoolSize{vk::DescriptorType::eCombinedImageSampler, frames_in_flight},
     };
     vk::DescriptorPoolCreateInfo descrpool_info;
-    descrpool_info.maxSets = 1;
+    descrpool_info.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+    descrpool_info.maxSets = frames_in_flight;
     descrpool_info.setPoolSizes(descrpool_sizes);
     vk::UniqueDescriptorPool descrpool = device.device->createDescriptorPoolUnique(descrpool_info);
 
+    // Per frame command pools, semaphores, uniforms and descriptor set
+    FrameRing ring(device, frames_in_flight, record_threads);
+    ParallelRecorder recorder(ring.pools, *rm.jobs);
+    CachedCommands static_commands(*device.device, device.device_family_index, frames_in_flight);
+    // written every frame into the range of the frame slot
+    std::unique_ptr<InstanceBuffer> instances;
+    vk::DeviceSize instance_offset = 0;
+    if (instanced_draws)
+        instances = std::make_unique<InstanceBuffer>(rm, instance_capacity, frames_in_flight);
+    // blocks of one building each, in a square with streets every 4 units. z is up
+    uint32_t city_columns = static_cast<uint32_t>(std::ceil(std::sqrt((float)city_count)));
+    if (city_count > 0)
+    {
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> footprint(0.8f, 1.6f);
+        std::uniform_real_distribution<float> height(1.f, 6.f);
+        std::vector<gpu_object_t> objects(city_count);
+        for (uint32_t i = 0; i < city_count; i++)
+        {
+            glm::vec3 scale(footprint(random), footprint(random), height(random));
+            glm::vec3 center(4.f * (i % city_columns), 4.f * (i / city_columns), scale.z);
+            objects[i].sphere = glm::vec4(center, glm::length(scale));
+            objects[i].position = glm::vec4(center, 0.f);
+            objects[i].scale = glm::vec4(scale, 0.f);
+            objects[i].tint = glm::vec4(1.f);
+        }
+        culler->upload(objects);
+    }
+    // objects on a grid four times wider than the view, each one covered by its bounding sphere
+    else if (culler)
+    {
+        std::vector<gpu_object_t> objects(indirect_count);
+        uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt((float)indirect_count)));
+        float cell = 8.f / columns;
+        for (uint32_t i = 0; i < indirect_count; i++)
+        {
+            glm::vec2 center(-4.f + cell * (i % columns + 0.5f), -4.f + cell * (i / columns + 0.5f));
+            float scale = cell * 0.4f;
+            objects[i].sphere = glm::vec4(center, 0.f, scale * std::sqrt(2.f));
+            objects[i].position = glm::vec4(center, 0.f, i * 0.1f);
+            objects[i].scale = glm::vec4(scale, scale, 1.f, 0.f);
+            objects[i].tint = glm::vec4(1.f, (i % 7) / 7.f, (i % 5) / 5.f, 1.f);
+        }
+        culler->upload(objects);
+    }
+    std::unique_ptr<SpriteBatcher> sprites;
+    if (sprite_count > 0)
+        sprites = std::make_unique<SpriteBatcher>(rm, sprite_count, frames_in_flight);
+    std::vector<vk::DescriptorSetLayout> descrset_layouts(frames_in_flight, *descrset_layout);
     vk::DescriptorSetAllocateInfo descrset_info;
     descrset_info.descriptorPool = *descrpool;
-    descrset_info.descriptorSetCount = 1;
-    descrset_info.setSetLayouts(*descrset_layout);
-    vk::UniqueDescriptorSet descrset = std::move(device.device->allocateDescriptorSetsUnique(descrset_info).front());
-
-    vk::DescriptorBufferInfo descr_sets_write_uniform_vertex;
-    descr_sets_write_uniform_vertex.buffer = *quad_buffer;
-    descr_sets_write_uniform_vertex.offset = quad_uniform_vertex_off;
-    descr_sets_write_uniform_vertex.range = quad_uniform_vertex_size;
-    vk::DescriptorBufferInfo descr_sets_write_uniform_fragment;
-    descr_sets_write_uniform_fragment.buffer = *quad_buffer;
-    descr_sets_write_uniform_fragment.offset = quad_uniform_fragment_off;
-    descr_sets_write_uniform_fragment.range = quad_uniform_fragment_size;
+    descrset_info.setSetLayouts(descrset_layouts);
+    auto descrsets = device.device->allocateDescriptorSetsUnique(descrset_info);
+
+    uint64_t tex_version = 1;
     vk::DescriptorImageInfo descr_sets_write_tex;
-    descr_sets_write_tex.sampler = *sampler;
+    descr_sets_write_tex.sampler = rm.sampler(tex->resident_lod);
     descr_sets_write_tex.imageView = *tex->view;
     descr_sets_write_tex.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    std::vector<vk::WriteDescriptorSet> descr_sets_write{
-        vk::WriteDescriptorSet(*descrset, 0, 0, 1, vk::DescriptorType::eUniformBuffer, 
-            nullptr, &descr_sets_write_uniform_vertex, nullptr),
-        vk::WriteDescriptorSet(*descrset, 1, 0, 1, vk::DescriptorType::eUniformBuffer,
-            nullptr, &descr_sets_write_uniform_fragment, nullptr),
-        vk::WriteDescriptorSet(*descrset, 2, 0, 1, vk::DescriptorType::eCombinedImageSampler,
-            &descr_sets_write_tex, nullptr, nullptr),
-    };
-    device.device->updateDescriptorSets(descr_sets_write, nullptr);
+    for (uint32_t i = 0; i < frames_in_flight; i++)
+    {
+        Frame& frame = ring.frames[i];
+        frame.descrset = std::move(descrsets[i]);
+        frame.uniform_offset = quad_uniform_off + quad_uniform_frame_size * i;
+        frame.texture_version = tex_version;
+
+        vk::DescriptorBufferInfo descr_sets_write_uniform_vertex;
+        descr_sets_write_uniform_vertex.buffer = *quad_buffer;
+        descr_sets_write_uniform_vertex.offset = frame.uniform_offset;
+        descr_sets_write_uniform_vertex.range = quad_uniform_vertex_size;
+        vk::DescriptorBufferInfo descr_sets_write_uniform_fragment;
+        descr_sets_write_uniform_fragment.buffer = *quad_buffer;
+        descr_sets_write_uniform_fragment.offset = frame.uniform_offset + quad_uniform_vertex_size;
+        descr_sets_write_uniform_fragment.range = quad_uniform_fragment_size;
+        std::vector<vk::WriteDescriptorSet> descr_sets_write{
+            vk::WriteDescriptorSet(*frame.descrset, 0, 0, 1, vk::DescriptorType::eUniformBuffer,
+                nullptr, &descr_sets_write_uniform_vertex, nullptr),
+            vk::WriteDescriptorSet(*frame.descrset, 1, 0, 1, vk::DescriptorType::eUniformBuffer,
+                nullptr, &descr_sets_write_uniform_fragment, nullptr),
+            vk::WriteDescriptorSet(*frame.descrset, 2, 0, 1, vk::DescriptorType::eCombinedImageSampler,
+                &descr_sets_write_tex, nullptr, nullptr),
+        };
+        device.device->updateDescriptorSets(descr_sets_write, nullptr);
+    }
+
+    // one depth buffer for every frame, the render pass dependencies order its uses
+    vk::Extent2D extent = device.surface_caps.currentExtent;
+    vk::ImageCreateInfo depth_info;
+    depth_info.imageType = vk::ImageType::e2D;
+    depth_info.format = depth_format;
+    depth_info.extent = vk::Extent3D(extent.width, extent.height, 1);
+    depth_info.mipLevels = 1;
+    depth_info.arrayLayers = 1;
+    depth_info.samples = vk::SampleCountFlagBits::e1;
+    depth_info.tiling = vk::ImageTiling::eOptimal;
+    depth_info.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled;
+    vk::UniqueImage depth_image = device.device->createImageUnique(depth_info);
+    auto depth_mem = ma.allocate(device.device->getImageMemoryRequirements(*depth_image), vk::MemoryPropertyFlagBits::eDeviceLocal);
+    device.device->bindImageMemory(*depth_image, depth_mem->chunk->device_memory, depth_mem->chunk->offset);
+    vk::ImageViewCreateInfo depth_view_info;
+    depth_view_info.image = *depth_image;
+    depth_view_info.viewType = vk::ImageViewType::e2D;
+    depth_view_info.format = depth_format;
+    depth_view_info.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1);
+    vk::UniqueImageView depth_view = device.device->createImageViewUnique(depth_view_info);
+    std::unique_ptr<DepthPyramid> pyramid;
+    if (city_count > 0)
+    {
+        pyramid = std::make_unique<DepthPyramid>(rm, *depth_view, extent.width, extent.height);
+        culler->set_pyramid(*pyramid);
+    }
 
-    vk::UniqueFence fence = device.device->createFenceUnique(vk::FenceCreateInfo());
     std::vector<vk::Image> swapchain_images = device.device->getSwapchainImagesKHR(*device.swapchain);
-    vk::UniqueCommandBuffer cmd = std::move(
-        device.device->allocateCommandBuffersUnique({ *device.cmd_pool, vk::CommandBufferLevel::ePrimary, 1 }).front());
-    std::vector<vk::UniqueImageView> swapchain_views(2);
-    std::vector<vk::UniqueFramebuffer> framebuffers(2);
-    for (int i = 0; i < 2; i++)
+    std::vector<vk::UniqueImageView> swapchain_views(swapchain_images.size());
+    std::vector<vk::UniqueFramebuffer> framebuffers(swapchain_images.size());
+    for (size_t i = 0; i < swapchain_images.size(); i++)
     {
         vk::ImageViewCreateInfo fb_view_info;
         fb_view_info.image = swapchain_images[i];
@@ -292,13 +611,129 @@ int main()
         
         vk::FramebufferCreateInfo fb_info;
         fb_info.renderPass = *renderpass;
-        fb_info.setAttachments(*swapchain_views[i]);
+        std::array<vk::ImageView, 2> fb_attachments{ *swapchain_views[i], *depth_view };
+        fb_info.setAttachments(fb_attachments);
         fb_info.width = device.surface_caps.currentExtent.width;
         fb_info.height = device.surface_caps.currentExtent.height;
         fb_info.layers = 1;
         framebuffers[i] = device.device->createFramebufferUnique(fb_info);
     }
 
+    // draws [begin, end) of the quad, every draw states all it needs and the recorder drops the
+    // binds that change nothing
+    std::atomic<uint64_t> state_emitted = 0;
+    std::atomic<uint64_t> state_filtered = 0;
+    // with --push the quad model of the frame is scaled into the grid cell of every draw
+    glm::mat4 quad_model(1.f);
+    uint32_t grid_columns = static_cast<uint32_t>(std::ceil(std::sqrt((float)draw_count)));
+    auto draw_model = [&](uint32_t draw) {
+        if (!push_draws)
+            return quad_model;
+        float cell = 2.f / grid_columns;
+        glm::vec3 center(-1.f + cell * (draw % grid_columns + 0.5f), -1.f + cell * (draw / grid_columns + 0.5f), 0.f);
+        return glm::translate(center) * glm::scale(glm::vec3(cell)) * quad_model;
+    };
+    // the quads go through a draw queue like scene draws would: keyed, sorted, then recorded in key
+    // order. They share the pipeline, material and mesh, only their depth could tell them apart.
+    DrawQueue draw_queue;
+    auto queue_quads = [&](uint32_t count) {
+        draw_queue.clear();
+        for (uint32_t i = 0; i < count; i++)
+            draw_queue.push(opaque_draw_key(0, 0, 0, depth_bucket(draw_model(i)[3].z, 0.f, 1.f), 0), i);
+        draw_queue.sort();
+    };
+    auto record_quads = [&](vk::CommandBuffer cmd, vk::DescriptorSet descrset, uint32_t begin, uint32_t end) {
+        CommandRecorder rec(cmd);
+        if (instanced_draws)
+        {
+            // one draw for the range, instance i reads instance_t i
+            rec.bind_pipeline(*pipeline);
+            rec.bind_vertex_buffer(0, *quad_buffer, quad_vertices_off);
+            rec.bind_vertex_buffer(1, *instances->buffer, instance_offset);
+            rec.bind_index_buffer(*quad_buffer, 0, vk::IndexType::eUint32);
+            rec.bind_descriptor_set(*pipeline_layout, 0, descrset);
+            rec.draw_indexed(static_cast<uint32_t>(quad_indices.size()), end - begin, 0, 0, begin);
+            state_emitted += rec.emitted;
+            state_filtered += rec.filtered;
+            return;
+        }
+        // [begin, end) are positions in the sorted queue
+        for (uint32_t i = begin; i < end; i++)
+        {
+            uint32_t draw = draw_queue.packets[i].draw;
+            rec.bind_pipeline(*pipeline);
+            rec.bind_vertex_buffer(0, *quad_buffer, quad_vertices_off);
+            rec.bind_index_buffer(*quad_buffer, 0, vk::IndexType::eUint32);
+            rec.bind_descriptor_set(*pipeline_layout, 0, descrset);
+            if (push_draws)
+            {
+                push_vertex_t push;
+                push.model = draw_model(draw);
+                push.index = draw;
+                rec.push_constants(*pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, push_range.size, &push);
+            }
+            rec.draw_indexed(static_cast<uint32_t>(quad_indices.size()));
+        }
+        state_emitted += rec.emitted;
+        state_filtered += rec.filtered;
+    };
+
+    // VulkanLezione --bench record [draws], recording only, nothing is submitted
+    if (args.size() >= 2 && args[0] == "--bench" && args[1] == "record")
+    {
+        vk::DescriptorSet descrset = *ring.frames[0].descrset;
+        uint32_t draws = args.size() >= 3 ? std::stoi(args[2]) : 10000;
+        if (!instanced_draws)
+        {
+            grid_columns = static_cast<uint32_t>(std::ceil(std::sqrt((float)draws)));
+            queue_quads(draws);
+        }
+        bench_parallel_record(device, *rm.jobs, *renderpass, *framebuffers[0], scissor, draws,
+            [&](vk::CommandBuffer cmd, uint32_t begin, uint32_t end) { record_quads(cmd, descrset, begin, end); });
+        return EXIT_SUCCESS;
+    }
+
+    if (bench_instances)
+    {
+        vk::DescriptorSet descrset = *ring.frames[0].descrset;
+        if (auto map = quad_buffer_mem->map(ring.frames[0].uniform_offset, quad_uniform_frame_size))
+        {
+            reinterpret_cast<uniform_vertex_t*>(map.ptr)->model = glm::scale(glm::vec3(0.5f));
+            reinterpret_cast<uniform_fragment_t*>(map.ptr + quad_uniform_vertex_size)->tint = glm::vec4(1);
+        }
+        // the swapchain images belong to the presentation engine until acquired, the bench draws into
+        // its own target that stays in eColorAttachmentOptimal, which keeps the pipeline's pass compatible
+        renderpass_attachments[0].finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+        vk::UniqueRenderPass bench_renderpass = device.device->createRenderPassUnique(renderpass_info);
+        auto target = rm.create_image2D(device.swapchain_info.imageFormat, extent.width, extent.height, 1, 1,
+            vk::ImageViewType::e2D, vk::ImageUsageFlagBits::eColorAttachment);
+        rm.submit_once([&](vk::CommandBuffer cmd) {
+            vk::ImageMemoryBarrier barrier;
+            barrier.image = *target->texture;
+            barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+            barrier.srcAccessMask = {};
+            barrier.dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+            barrier.oldLayout = vk::ImageLayout::eUndefined;
+            barrier.newLayout = vk::ImageLayout::eColorAttachmentOptimal;
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                {}, nullptr, nullptr, barrier);
+        });
+        vk::FramebufferCreateInfo target_info;
+        target_info.renderPass = *bench_renderpass;
+        std::array<vk::ImageView, 2> target_attachments{ *target->view, *depth_view };
+        target_info.setAttachments(target_attachments);
+        target_info.width = extent.width;
+        target_info.height = extent.height;
+        target_info.layers = 1;
+        vk::UniqueFramebuffer target_framebuffer = device.device->createFramebufferUnique(target_info);
+        bench_instancing(device, *instances, *bench_renderpass, *target_framebuffer, scissor,
+            [&](vk::CommandBuffer cmd, vk::DeviceSize offset, uint32_t count) {
+                instance_offset = offset;
+                record_quads(cmd, descrset, 0, count);
+            });
+        return EXIT_SUCCESS;
+    }
+
     MSG msg;
     float alpha = 0;
     while (true)
@@ -311,72 +746,193 @@ int main()
         }
         alpha += 0.1f;
 
-        // update uniform
-        if (auto map = quad_buffer_mem->map(quad_uniform_vertex_off, 
-            quad_uniform_vertex_size + quad_uniform_fragment_size))
+        // wait for the GPU to release this slot, everything it used can be touched again
+        Frame& frame = ring.begin();
+        rm.frame = ring.frame_index;
+        rm.collect(ring.completed_frames());
+        if (culler)
+            culler->collect(frame.slot);
+
+        // continue the async loads waiting on the main thread
+        rm.main_executor.run_pending();
+        bool tex_changed = streamer.update();
+        tex_changed |= residency.use(tex);
+        if (tex_changed)
+        {
+            descr_sets_write_tex.sampler = rm.sampler(tex->resident_lod);
+            descr_sets_write_tex.imageView = *tex->view;
+            tex_version++;
+        }
+        // the other slots pick the change up when their turn comes, their sets may still be in use
+        if (frame.texture_version != tex_version)
+        {
+            vk::WriteDescriptorSet write(*frame.descrset, 2, 0, 1, vk::DescriptorType::eCombinedImageSampler,
+                &descr_sets_write_tex, nullptr, nullptr);
+            device.device->updateDescriptorSets(write, nullptr);
+            frame.texture_version = tex_version;
+        }
+
+        // update uniform, with --push the model only reaches the draws through push constants
+        float aspect_ratio = (float)tex->info.extent.height / (float)tex->info.extent.width;
+        quad_model = glm::eulerAngleZ(alpha * 0.1f) * glm::scale(glm::vec3(0.5f, aspect_ratio * 0.5f, 1.f));
+        // sprite vertices are already in clip space, culled objects carry their own transform
+        if (sprites || culler)
+            quad_model = glm::mat4(1.f);
+        glm::mat4 view_proj = glm::scale(glm::vec3(0.5f))
+            * glm::translate(glm::vec3(-3.f * std::sin(alpha * 0.01f), -3.f * std::cos(alpha * 0.013f), 0.f));
+        // walking down a street at eye height, looking a bit left and right
+        if (city_count > 0)
         {
-            float aspect_ratio = (float)tex->info.extent.height / (float)tex->info.extent.width;
-            reinterpret_cast<uniform_vertex_t*>(map.ptr)->model = 
-                glm::eulerAngleZ(alpha * 0.1f)
-                * glm::scale(glm::vec3(0.5f, aspect_ratio * 0.5f, 1.f));
+            float street_length = 4.f * city_columns;
+            glm::vec3 eye(4.f * (city_columns / 2) - 2.f, std::fmod(alpha * 0.5f, street_length), 1.7f);
+            glm::vec3 forward(0.3f * std::sin(alpha * 0.02f), 1.f, 0.f);
+            glm::mat4 proj = glm::perspectiveRH_ZO(glm::radians(60.f), (float)extent.width / extent.height, 0.1f, 1000.f);
+            proj[1][1] *= -1.f;
+            view_proj = proj * glm::lookAt(eye, eye + forward, glm::vec3(0.f, 0.f, 1.f));
+        }
+        if (auto map = quad_buffer_mem->map(frame.uniform_offset, quad_uniform_frame_size))
+        {
+            reinterpret_cast<uniform_vertex_t*>(map.ptr)->model = quad_model;
             reinterpret_cast<uniform_fragment_t*>(map.ptr + quad_uniform_vertex_size)->tint = 
                 glm::vec4(1, glm::abs(glm::sin(alpha)), 1, 1);
         }
 
-        auto next_image = device.device->acquireNextImageKHR(*device.swapchain, UINT64_MAX, nullptr, *fence);
-        if (next_image.result == vk::Result::eSuccess)
+        if (instanced_draws)
         {
-            cmd->reset();
+            instances->grid(draw_count, alpha * 0.05f);
+            instance_offset = instances->upload(frame.slot);
+        }
+        // --static builds its queue only when the cached commands are recorded again
+        else if (!sprites && !culler && !static_draws)
+            queue_quads(draw_count);
+
+        uint32_t image_index;
+        if (ring.acquire(frame, image_index))
+        {
+            vk::CommandBuffer cmd = frame.cmd;
+            // a compute pass outside the render pass writes this frame's draws
+            if (culler)
+                culler->cull(cmd, frame.slot, view_proj, static_cast<uint32_t>(quad_indices.size()));
             std::array color{ 1.f, 0.f, 0.f, 1.f };
-            cmd->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
             vk::ImageMemoryBarrier barrier;
-            barrier.image = swapchain_images[next_image.value];
+            barrier.image = swapchain_images[image_index];
             barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
             barrier.srcAccessMask = {};
             barrier.dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
             barrier.oldLayout = vk::ImageLayout::eUndefined;
             barrier.newLayout = vk::ImageLayout::eColorAttachmentOptimal;
-            cmd->pipelineBarrier(
-                vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            cmd.pipelineBarrier(
+                vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput,
                 vk::DependencyFlagBits::eByRegion, nullptr, nullptr, barrier);
             std::vector<vk::ClearValue> clear_values{
                 vk::ClearColorValue(color),
+                vk::ClearDepthStencilValue(1.f, 0),
             };
             vk::RenderPassBeginInfo renderpass_begin_info;
             renderpass_begin_info.renderPass = *renderpass;
-            renderpass_begin_info.framebuffer = *framebuffers[next_image.value];
+            renderpass_begin_info.framebuffer = *framebuffers[image_index];
             renderpass_begin_info.renderArea = scissor;
             renderpass_begin_info.setClearValues(clear_values);
-            cmd->beginRenderPass(renderpass_begin_info, vk::SubpassContents::eInline);
+            if (culler)
+            {
+                cmd.beginRenderPass(renderpass_begin_info, vk::SubpassContents::eInline);
+                CommandRecorder rec(cmd);
+                rec.bind_pipeline(*pipeline);
+                rec.bind_vertex_buffer(0, *quad_buffer, quad_vertices_off);
+                rec.bind_index_buffer(*quad_buffer, 0, vk::IndexType::eUint32);
+                rec.bind_descriptor_set(*pipeline_layout, 0, *frame.descrset);
+                rec.bind_descriptor_set(*pipeline_layout, 1, *culler->descrsets[frame.slot]);
+                rec.push_constants(*pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &view_proj);
+                culler->draw(cmd, frame.slot);
+                if (pyramid)
+                {
+                    // the early cull used last frame's pyramid, rebuilt from this depth it finds the objects that came out since
+                    cmd.endRenderPass();
+                    pyramid->build(cmd);
+                    culler->cull_late(cmd, frame.slot);
+                    renderpass_begin_info.renderPass = *renderpass_late;
+                    cmd.beginRenderPass(renderpass_begin_info, vk::SubpassContents::eInline);
+                    // a new render pass, nothing stays bound
+                    CommandRecorder late(cmd);
+                    late.bind_pipeline(*pipeline);
+                    late.bind_vertex_buffer(0, *quad_buffer, quad_vertices_off);
+                    late.bind_index_buffer(*quad_buffer, 0, vk::IndexType::eUint32);
+                    late.bind_descriptor_set(*pipeline_layout, 0, *frame.descrset);
+                    late.bind_descriptor_set(*pipeline_layout, 1, *culler->descrsets[frame.slot]);
+                    late.push_constants(*pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &view_proj);
+                    culler->draw_late(cmd, frame.slot);
+                }
+            }
+            else if (sprites)
             {
-                cmd->bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
-                cmd->bindVertexBuffers(0, *quad_buffer, { quad_vertices_off });
-                cmd->bindIndexBuffer(*quad_buffer, 0, vk::IndexType::eUint32);
-                cmd->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipeline_layout, 0, *descrset, nullptr);
-                cmd->drawIndexed(quad_indices.size(), 1, 0, 0, 0);
+                cmd.beginRenderPass(renderpass_begin_info, vk::SubpassContents::eInline);
+                CommandRecorder rec(cmd);
+                sprites->begin(rec, frame.slot, *pipeline, *pipeline_layout);
+                // a spiral of logos turning around the center
+                for (uint32_t i = 0; i < sprite_count; i++)
+                {
+                    float t = (float)i / sprite_count;
+                    float angle = t * 40.f + alpha * 0.05f;
+                    Sprite sprite;
+                    sprite.center = glm::vec2(std::cos(angle), std::sin(angle)) * (0.05f + 0.9f * t);
+                    sprite.size = glm::vec2(0.04f, 0.04f * aspect_ratio);
+                    sprite.rotation = angle;
+                    sprites->draw(*frame.descrset, sprite);
+                }
+                sprites->end();
+                state_emitted += rec.emitted;
+                state_filtered += rec.filtered;
             }
-            cmd->endRenderPass();
-            cmd->end();
-
-            vk::SubmitInfo submit_info;
-            vk::CommandBuffer vkcmd = *cmd;
-            submit_info.commandBufferCount = 1;
-            submit_info.pCommandBuffers = &vkcmd;
-            device.q.submit(submit_info);
-            device.q.waitIdle();
-
-            vk::Result present_result;
-            vk::PresentInfoKHR present_info;
-            present_info.setSwapchains(*device.swapchain);
-            present_info.pImageIndices = &next_image.value;
-            present_info.pResults = &present_result;
-            device.q.presentKHR(present_info);
-            device.q.waitIdle();
+            else if (static_draws)
+            {
+                // the framebuffer is only a hint, leaving it out lets one recording serve every swapchain image
+                cmd.beginRenderPass(renderpass_begin_info, vk::SubpassContents::eSecondaryCommandBuffers);
+                vk::CommandBufferInheritanceInfo inheritance(*renderpass, 0);
+                // the draw list, its queue order and the pipeline are fixed for the run, only the texture
+                // binding and, with --push, the per draw transforms of this frame can make a recording stale
+                uint64_t transform_version = push_draws ? ring.frame_index : 0;
+                cmd.executeCommands(static_commands.get(frame.slot, { frame.texture_version, transform_version }, inheritance,
+                    [&](vk::CommandBuffer secondary) {
+                        queue_quads(draw_count);
+                        record_quads(secondary, *frame.descrset, 0, draw_count);
+                    }));
+            }
+            else if (record_threads > 1)
+            {
+                cmd.beginRenderPass(renderpass_begin_info, vk::SubpassContents::eSecondaryCommandBuffers);
+                vk::CommandBufferInheritanceInfo inheritance(*renderpass, 0, *framebuffers[image_index]);
+                recorder.record(cmd, frame.slot, inheritance, draw_count,
+                    [&](vk::CommandBuffer secondary, uint32_t begin, uint32_t end) {
+                        record_quads(secondary, *frame.descrset, begin, end);
+                    });
+            }
+            else
+            {
+                cmd.beginRenderPass(renderpass_begin_info, vk::SubpassContents::eInline);
+                record_quads(cmd, *frame.descrset, 0, draw_count);
+            }
+            cmd.endRenderPass();
+            // present waits on the render semaphore, nothing here waits for the queue.
+            // texture writes are waited on by the GPU, the CPU never blocks on them
+            ring.submit(frame, image_index, {
+                { rm.last_submit, vk::PipelineStageFlagBits::eFragmentShader },
+                { streamer.done, vk::PipelineStageFlagBits::eFragmentShader } });
         }
-        device.device->waitForFences(*fence, true, UINT64_MAX);
-        device.device->resetFences(*fence);
-
+        else
+            ring.skip(frame);
+        residency.next_frame();
     }
-    descrset.reset();
+    device.device->waitIdle();
+    residency.report(std::cout);
+    ring.stats.report(std::cout, frames_in_flight);
+    std::cout << "CommandRecorder: " << state_emitted << " state calls emitted, " << state_filtered << " filtered\n";
+    if (sprites)
+        sprites->report(std::cout);
+    if (culler)
+        culler->report(std::cout);
+    if (static_draws)
+        std::cout << "CachedCommands: " << static_commands.recorded << " recorded, " << static_commands.reused << " reused\n";
+    std::cout << "GpuScheduler: " << device.scheduler->submits << " submits, " << device.scheduler->cpu_waits << " CPU waits\n";
+    rm.collect(UINT64_MAX);
     return EXIT_SUCCESS;
 }
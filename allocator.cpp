@@ -1,62 +1,112 @@
 #include "allocator.h"
 #include "device.h"
 #include <iostream>
+#include <algorithm>
 
-std::shared_ptr<MemoryChunk> MemoryAllocation::allocate(vk::DeviceSize required_size)
+std::shared_ptr<MemoryChunk> MemoryAllocation::allocate(vk::DeviceSize required_size, vk::DeviceSize alignment)
 {
     for (auto chunk = chunks.begin(); chunk != chunks.end(); ++chunk)
     {
-        if (!(*chunk)->used)
+        if ((*chunk)->used)
+            continue;
+        auto cur_chunk = (*chunk);
+        vk::DeviceSize aligned_offset = (cur_chunk->offset + alignment - 1) / alignment * alignment;
+        vk::DeviceSize padding = aligned_offset - cur_chunk->offset;
+        if (cur_chunk->size < padding + required_size)
+            continue;
+        if (padding > 0)
         {
-            if ((*chunk)->size == required_size)
-            {
-                (*chunk)->used = true;
-                return *chunk;
-            }
-            else
-            {
-                auto cur_chunk = (*chunk);
-                auto new_chunk = std::make_shared<MemoryChunk>(
-                    family_index, *device_memory, cur_chunk->size - required_size,
-                    cur_chunk->offset + required_size);
-                cur_chunk->size = required_size;
-                cur_chunk->used = true;
-                chunks.insert(std::next(chunk), std::move(new_chunk));
-                return cur_chunk;
-            }
+            // leave the padding as a free chunk in front of the aligned one
+            chunks.insert(chunk, std::make_shared<MemoryChunk>(
+                family_index, *device_memory, padding, cur_chunk->offset));
+            cur_chunk->offset = aligned_offset;
+            cur_chunk->size -= padding;
         }
+        if (cur_chunk->size > required_size)
+        {
+            auto new_chunk = std::make_shared<MemoryChunk>(
+                family_index, *device_memory, cur_chunk->size - required_size,
+                cur_chunk->offset + required_size);
+            cur_chunk->size = required_size;
+            chunks.insert(std::next(chunk), std::move(new_chunk));
+        }
+        cur_chunk->used = true;
+        return cur_chunk;
     }
     return nullptr;
 }
 
-std::shared_ptr<MemoryChunk> MemoryFamily::allocate(vk::Device& device, uint32_t family_index, vk::DeviceSize required_size)
+void MemoryAllocation::free(const std::shared_ptr<MemoryChunk>& chunk)
+{
+    auto it = std::find(chunks.begin(), chunks.end(), chunk);
+    if (it == chunks.end())
+        return;
+    (*it)->used = false;
+    // merge with the free neighbours so big requests can reuse the space
+    if (auto next = std::next(it); next != chunks.end() && !(*next)->used)
+    {
+        (*it)->size += (*next)->size;
+        chunks.erase(next);
+    }
+    if (it != chunks.begin())
+    {
+        if (auto prev = std::prev(it); !(*prev)->used)
+        {
+            (*prev)->size += (*it)->size;
+            chunks.erase(it);
+        }
+    }
+}
+
+std::shared_ptr<MemoryChunk> MemoryFamily::allocate(vk::Device& device, uint32_t family_index,
+    vk::DeviceSize required_size, vk::DeviceSize alignment)
 {
     for (auto& allocation : allocations)
-        if (auto ptr = allocation.allocate(required_size))
+        if (auto ptr = allocation.allocate(required_size, alignment))
             return ptr;
-    return allocations.emplace_back(device, family_index, allocation_size).allocate(required_size);
+    // resources bigger than the block size get a dedicated allocation
+    return allocations.emplace_back(device, family_index, std::max<vk::DeviceSize>(allocation_size, required_size))
+        .allocate(required_size, alignment);
 }
 
 std::shared_ptr<MemoryRef> MemoryAllocator::allocate(const vk::MemoryRequirements& req, vk::MemoryPropertyFlags flags)
 {
-    // @todo implement memory alignment
     uint32_t family_index = find_memory(req, flags);
+    used_bytes += req.size;
     std::cout << "MemoryAllocator::allocate family_index = " << family_index << "\n";
     // check if family already exists
     if (auto it = families.find(family_index); it != families.end())
     {
         std::cout << "MemoryAllocator::allocate family already exists\n";
-        return std::make_shared<MemoryRef>(it->second.allocate(*device.device, family_index, req.size), this);
+        return std::make_shared<MemoryRef>(it->second.allocate(*device.device, family_index, req.size, req.alignment), this);
     }
     // create family and allocate
     if (auto alloc = families.emplace(family_index, allocation_size); alloc.second)
     {
         std::cout << "MemoryAllocator::allocate new family allocated\n";
-        return std::make_shared<MemoryRef>(alloc.first->second.allocate(*device.device, family_index, req.size), this);
+        return std::make_shared<MemoryRef>(alloc.first->second.allocate(*device.device, family_index, req.size, req.alignment), this);
     }
     throw std::runtime_error("MemoryAllocator::allocate failed");
 }
 
+void MemoryAllocator::free(const std::shared_ptr<MemoryChunk>& chunk)
+{
+    used_bytes -= chunk->size;
+    if (auto it = families.find(chunk->family_index); it != families.end())
+        for (auto& allocation : it->second.allocations)
+            if (*allocation.device_memory == chunk->device_memory)
+                return allocation.free(chunk);
+}
+
+vk::DeviceSize MemoryAllocator::heap_size(vk::MemoryPropertyFlags flags)
+{
+    vk::PhysicalDeviceMemoryProperties mp = device.physical_device.getMemoryProperties();
+    for (uint32_t mem_i = 0; mem_i < mp.memoryTypeCount; mem_i++)
+        if ((mp.memoryTypes[mem_i].propertyFlags & flags) == flags)
+            return mp.memoryHeaps[mp.memoryTypes[mem_i].heapIndex].size;
+    return 0;
+}
+
 uint32_t MemoryAllocator::find_memory(const vk::MemoryRequirements& req, vk::MemoryPropertyFlags flags)
 {
     static vk::PhysicalDeviceMemoryProperties mp = device.physical_device.getMemoryProperties();
@@ -71,3 +121,9 @@ void* MemoryRef::map_internal(vk::DeviceAddress offset, vk::DeviceSize size)
     return allocator->device.device->mapMemory(chunk->device_memory,
         chunk->offset + offset, size == VK_WHOLE_SIZE ? chunk->size : size);
 }
+
+MemoryRef::~MemoryRef()
+{
+    if (chunk)
+        allocator->free(chunk);
+}
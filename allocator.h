@@ -29,6 +29,7 @@ struct MemoryRef : public std::enable_shared_from_this<MemoryRef>
     std::shared_ptr<MemoryChunk> chunk;
     MemoryRef(std::shared_ptr<MemoryChunk> chunk, MemoryAllocator* allocator)
         : chunk(chunk), allocator(allocator) {}
+    ~MemoryRef();
     
     MemoryRef(const MemoryRef&) = delete;
     MemoryRef& operator=(const MemoryRef&) = delete;
@@ -74,7 +75,8 @@ struct MemoryAllocation
     MemoryAllocation(const MemoryAllocation&) = delete;
     MemoryAllocation& operator=(const MemoryAllocation&) = delete;
     
-    std::shared_ptr<MemoryChunk> allocate(vk::DeviceSize required_size);
+    std::shared_ptr<MemoryChunk> allocate(vk::DeviceSize required_size, vk::DeviceSize alignment);
+    void free(const std::shared_ptr<MemoryChunk>& chunk);
 };
 
 struct MemoryFamily
@@ -89,7 +91,8 @@ struct MemoryFamily
     MemoryFamily(const MemoryFamily&) = delete;
     MemoryFamily& operator=(const MemoryFamily&) = delete;
 
-    std::shared_ptr<MemoryChunk> allocate(vk::Device& device, uint32_t family_index, vk::DeviceSize required_size);
+    std::shared_ptr<MemoryChunk> allocate(vk::Device& device, uint32_t family_index,
+        vk::DeviceSize required_size, vk::DeviceSize alignment);
 };
 
 struct MemoryAllocator
@@ -97,6 +100,7 @@ struct MemoryAllocator
     Device& device;
     vk::DeviceSize allocation_size;
     std::map<uint32_t/*family_index*/, MemoryFamily> families;
+    vk::DeviceSize used_bytes = 0;
     MemoryAllocator(Device& device, vk::DeviceSize allocation_size)
         : allocation_size(allocation_size)
         , device(device) {}
@@ -105,6 +109,8 @@ struct MemoryAllocator
     MemoryAllocator& operator=(const MemoryAllocator&) = delete;
     
     std::shared_ptr<MemoryRef> allocate(const vk::MemoryRequirements& req, vk::MemoryPropertyFlags flags);
+    void free(const std::shared_ptr<MemoryChunk>& chunk);
+    vk::DeviceSize heap_size(vk::MemoryPropertyFlags flags);
     uint32_t find_memory(const vk::MemoryRequirements& req, vk::MemoryPropertyFlags flags);
 };
 
@@ -0,0 +1,164 @@
+#include "atlas.h"
+#include "resource.h"
+#include <iostream>
+#include <algorithm>
+
+bool Skyline::insert(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y)
+{
+    uint32_t best_y = UINT32_MAX;
+    uint32_t best_width = UINT32_MAX;
+    size_t best = nodes.size();
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i].x + width > size)
+            break;
+        // lowest y the rectangle can sit at when its left edge is on node i
+        uint32_t top = 0;
+        uint32_t width_left = width;
+        for (size_t j = i; width_left > 0; j++)
+        {
+            top = std::max<uint32_t>(top, nodes[j].y);
+            width_left -= std::min<uint32_t>(width_left, nodes[j].width);
+        }
+        if (top + height > size)
+            continue;
+        if (top < best_y || (top == best_y && nodes[i].width < best_width))
+        {
+            best = i;
+            best_y = top;
+            best_width = nodes[i].width;
+        }
+    }
+    if (best == nodes.size())
+        return false;
+
+    x = nodes[best].x;
+    y = best_y;
+    nodes.insert(nodes.begin() + best, Node{ x, y + height, width });
+    // shrink or remove the nodes now covered by the new one
+    for (size_t i = best + 1; i < nodes.size(); i++)
+    {
+        uint32_t right = nodes[i - 1].x + nodes[i - 1].width;
+        if (nodes[i].x >= right)
+            break;
+        uint32_t shrink = right - nodes[i].x;
+        if (nodes[i].width <= shrink)
+        {
+            nodes.erase(nodes.begin() + i--);
+            continue;
+        }
+        nodes[i].x += shrink;
+        nodes[i].width -= shrink;
+        break;
+    }
+    for (size_t i = 0; i + 1 < nodes.size();)
+    {
+        if (nodes[i].y == nodes[i + 1].y)
+        {
+            nodes[i].width += nodes[i + 1].width;
+            nodes.erase(nodes.begin() + i + 1);
+        }
+        else
+            i++;
+    }
+    return true;
+}
+
+TextureAtlas::TextureAtlas(ResourceManager& rm, uint32_t size, uint32_t padding)
+    : rm(rm), size(size), padding(padding) {}
+
+void TextureAtlas::place(AtlasEntry& entry)
+{
+    uint32_t x, y;
+    uint32_t layer = 0;
+    for (; layer < layers.size(); layer++)
+        if (layers[layer].insert(entry.width + padding, entry.height + padding, x, y))
+            break;
+    if (layer == layers.size())
+    {
+        layers.emplace_back(size);
+        if (!layers.back().insert(entry.width + padding, entry.height + padding, x, y))
+            throw std::runtime_error("TextureAtlas::place entry bigger than the atlas");
+    }
+    entry.region.layer = layer;
+    entry.region.x = x;
+    entry.region.y = y;
+    entry.region.u0 = (float)x / size;
+    entry.region.v0 = (float)y / size;
+    entry.region.u1 = (float)(x + entry.width) / size;
+    entry.region.v1 = (float)(y + entry.height) / size;
+    entry.uploaded = false;
+}
+
+std::shared_ptr<AtlasEntry> TextureAtlas::insert(uint32_t width, uint32_t height, const uint8_t* pixels)
+{
+    auto entry = std::make_shared<AtlasEntry>();
+    entry->width = width;
+    entry->height = height;
+    entry->pixels.assign(pixels, pixels + width * height * 4);
+    place(*entry);
+    entries.push_back(entry);
+    return entry;
+}
+
+void TextureAtlas::repack()
+{
+    std::vector<std::shared_ptr<AtlasEntry>> live;
+    for (auto& weak : entries)
+        if (auto entry = weak.lock())
+            live.push_back(entry);
+    std::sort(live.begin(), live.end(), [](const auto& a, const auto& b) {
+        return a->height != b->height ? a->height > b->height : a->width > b->width;
+    });
+
+    layers.clear();
+    entries.clear();
+    for (auto& entry : live)
+    {
+        place(*entry);
+        entries.push_back(entry);
+    }
+    // layers may have shrunk, force a new image with the right count; draws in flight may still sample the old one
+    if (image)
+        rm.retire(*image);
+    image.reset();
+    std::cout << "TextureAtlas::repack " << live.size() << " entries in " << layers.size() << " layers\n";
+}
+
+bool TextureAtlas::flush()
+{
+    if (layers.empty())
+        return false;
+    bool recreated = false;
+    vk::ImageLayout old_layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    if (!image || image->info.arrayLayers != layers.size())
+    {
+        // a new image starts empty, everything needs to go up again
+        if (image)
+            rm.retire(*image);
+        image = rm.create_image2D(vk::Format::eR8G8B8A8Unorm, size, size, 1,
+            static_cast<uint32_t>(layers.size()), vk::ImageViewType::e2DArray);
+        old_layout = vk::ImageLayout::eUndefined;
+        recreated = true;
+    }
+
+    std::vector<uint8_t> data;
+    std::vector<vk::BufferImageCopy> regions;
+    for (auto& weak : entries)
+    {
+        auto entry = weak.lock();
+        if (!entry || (entry->uploaded && !recreated))
+            continue;
+        vk::BufferImageCopy region;
+        region.bufferOffset = data.size();
+        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, entry->region.layer, 1);
+        region.imageOffset = vk::Offset3D(entry->region.x, entry->region.y, 0);
+        region.imageExtent = vk::Extent3D(entry->width, entry->height, 1);
+        regions.push_back(region);
+        data.insert(data.end(), entry->pixels.begin(), entry->pixels.end());
+        entry->uploaded = true;
+    }
+    if (!regions.empty())
+        rm.upload_image2D(*image, data.data(), data.size(), regions, old_layout);
+    return recreated;
+}
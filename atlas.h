@@ -0,0 +1,68 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <memory>
+#include <vector>
+
+struct ResourceManager;
+struct ImageResource;
+
+struct AtlasRegion
+{
+    uint32_t layer = 0;
+    uint32_t x = 0;
+    uint32_t y = 0;
+    // normalized rectangle to sample from layer
+    float u0 = 0, v0 = 0, u1 = 0, v1 = 0;
+};
+
+// Handle returned to the caller, the region moves when the atlas is repacked.
+// Dropping the last reference frees the space at the next repack.
+struct AtlasEntry
+{
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> pixels; // RGBA8, kept for repacking
+    AtlasRegion region;
+    bool uploaded = false;
+};
+
+// Bottom-left skyline packer for one layer.
+struct Skyline
+{
+    struct Node
+    {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+    };
+    uint32_t size;
+    std::vector<Node> nodes;
+
+    Skyline(uint32_t size) : size(size), nodes({ { 0, 0, size } }) {}
+    bool insert(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y);
+};
+
+// Packs small RGBA8 images into the layers of one 2D array image so draws using them
+// share a single binding.
+struct TextureAtlas
+{
+    ResourceManager& rm;
+    uint32_t size;
+    uint32_t padding;
+    std::shared_ptr<ImageResource> image;
+    std::vector<Skyline> layers;
+    std::vector<std::weak_ptr<AtlasEntry>> entries;
+
+    TextureAtlas(ResourceManager& rm, uint32_t size = 2048, uint32_t padding = 1);
+
+    TextureAtlas(const TextureAtlas&) = delete;
+    TextureAtlas& operator=(const TextureAtlas&) = delete;
+
+    std::shared_ptr<AtlasEntry> insert(uint32_t width, uint32_t height, const uint8_t* pixels);
+    // Uploads the entries inserted since the last flush, recreating the image if layers were added.
+    // Returns true when the image changed and descriptors must be rewritten.
+    bool flush();
+    // Drops released entries and packs the live ones again from scratch, tallest first.
+    void repack();
+    void place(AtlasEntry& entry);
+};
@@ -0,0 +1,631 @@
+#include "benchmark.h"
+#include "resource.h"
+#include "device.h"
+#include "pack.h"
+#include "streaming.h"
+#include "pixel.h"
+#include "cmdpool.h"
+#include "record.h"
+#include "jobs.h"
+#include "drawsort.h"
+#include "instance.h"
+#include "occlusion.h"
+#include "frustum.h"
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <latch>
+#include <iostream>
+#include <chrono>
+#include <glm/gtc/matrix_transform.hpp>
+
+using bench_clock = std::chrono::high_resolution_clock;
+
+static double elapsed_ms(bench_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+void bench_cold_start(ResourceManager& rm, const std::string& pack_path, const std::vector<std::string>& images)
+{
+    // stb path first, so the pack is not mounted yet and every lookup falls through to the decoder
+    rm.packs.clear();
+    auto start = bench_clock::now();
+    for (const auto& path : images)
+        rm.load_texture2D(path);
+    rm.device.scheduler->wait(rm.last_submit);
+    double stb_ms = elapsed_ms(start);
+
+    start = bench_clock::now();
+    rm.mount_pack(pack_path);
+    for (const auto& path : images)
+        rm.load_texture2D(path);
+    rm.device.scheduler->wait(rm.last_submit);
+    double pack_ms = elapsed_ms(start);
+
+    std::cout << "bench_cold_start: " << images.size() << " textures\n"
+        << "  stbi_load + upload (1 mip): " << stb_ms << " ms\n"
+        << "  pack mmap + upload (all mips): " << pack_ms << " ms\n";
+}
+
+void bench_async_load(ResourceManager& rm, const std::vector<std::string>& images)
+{
+    auto start = bench_clock::now();
+    for (const auto& path : images)
+        rm.load_texture2D(path);
+    rm.device.scheduler->wait(rm.last_submit);
+    double sync_ms = elapsed_ms(start);
+
+    // every load in flight at once, this thread only pumps the main executor like the render loop
+    start = bench_clock::now();
+    std::vector<task<std::shared_ptr<ImageResource>>> loads;
+    for (const auto& path : images)
+        loads.push_back(rm.load_texture2D_async(path));
+    for (auto& load : loads)
+        load.start();
+    uint32_t pumps = 0;
+    while (!std::all_of(loads.begin(), loads.end(), [](auto& load) { return load.done(); }))
+    {
+        if (rm.main_executor.run_pending() == 0)
+            std::this_thread::yield();
+        pumps++;
+    }
+    for (auto& load : loads)
+        load.get();
+    double async_ms = elapsed_ms(start);
+
+    std::cout << "bench_async_load: " << images.size() << " textures\n"
+        << "  load_texture2D: " << sync_ms << " ms\n"
+        << "  load_texture2D_async: " << async_ms << " ms, " << pumps << " main executor pumps\n";
+}
+
+void bench_progressive(ResourceManager& rm, const std::vector<std::string>& images)
+{
+    std::vector<std::shared_ptr<TextureSource>> sources;
+    for (const auto& path : images)
+        sources.push_back(rm.load_source(path));
+
+    // full chain, blocking until every mip is on the GPU
+    auto start = bench_clock::now();
+    for (auto& source : sources)
+    {
+        auto res = rm.create_image2D(source->format, source->mips[0].width, source->mips[0].height,
+            static_cast<uint32_t>(source->mips.size()));
+        std::vector<vk::BufferImageCopy> regions;
+        std::vector<uint8_t> data;
+        for (uint32_t level = 0; level < source->mips.size(); level++)
+        {
+            vk::BufferImageCopy region;
+            region.bufferOffset = data.size();
+            region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+            region.imageExtent = vk::Extent3D(source->mips[level].width, source->mips[level].height, 1);
+            regions.push_back(region);
+            data.insert(data.end(), source->mips[level].data, source->mips[level].data + source->mips[level].size);
+        }
+        rm.upload_image2D(*res, data.data(), data.size(), regions);
+    }
+    rm.device.scheduler->wait(rm.last_submit);
+    double full_ms = elapsed_ms(start);
+
+    // mip tail only, the streamer finishes the rest in the background
+    TextureStreamer streamer(rm);
+    std::vector<std::shared_ptr<ImageResource>> textures;
+    start = bench_clock::now();
+    for (const auto& path : images)
+        textures.push_back(streamer.load_texture2D(path));
+    double tail_ms = elapsed_ms(start);
+    uint32_t frames = 0;
+    while (!streamer.entries.empty() || streamer.pending)
+    {
+        if (streamer.pending)
+            rm.device.scheduler->wait(streamer.done);
+        streamer.update();
+        frames++;
+    }
+    double stream_ms = elapsed_ms(start);
+
+    std::cout << "bench_progressive: " << images.size() << " textures\n"
+        << "  full upload: " << full_ms << " ms to first use\n"
+        << "  mip tail: " << tail_ms << " ms to first use, " << stream_ms << " ms and "
+        << frames << " frames to full residency (" << streamer.streamed_bytes << " bytes)\n";
+}
+
+void bench_pixel_kernels()
+{
+    const size_t count = 4096 * 4096;
+    std::vector<uint8_t> rgb(count * 3, 0x80), rgba(count * 4, 0x80), out8(count * 4);
+    std::vector<float> linear(count * 4, 0.5f);
+    std::vector<uint16_t> half(count * 4);
+    std::vector<uint32_t> packed(count);
+
+    auto run = [&](const char* name, size_t bytes, const std::function<void()>& kernel) {
+        kernel(); // warm up caches and page in the buffers
+        auto start = bench_clock::now();
+        const int reps = 5;
+        for (int i = 0; i < reps; i++)
+            kernel();
+        double ms = elapsed_ms(start) / reps;
+        std::cout << "  " << name << ": " << ms << " ms, "
+            << count / ms / 1000.0 << " Mpix/s, " << bytes / ms / 1e6 << " GB/s\n";
+    };
+
+    SimdLevel detected = simd_detect();
+    for (int level = 0; level <= (int)detected; level++)
+    {
+        simd_set_level((SimdLevel)level);
+        std::cout << "bench_pixel_kernels " << simd_name(simd_level()) << " (" << count << " pixels)\n";
+        run("rgb_to_rgba", count * 7, [&] { rgb_to_rgba(rgb.data(), out8.data(), count); });
+        run("swizzle_bgra", count * 8, [&] { swizzle_bgra(rgba.data(), out8.data(), count); });
+        run("premultiply_alpha", count * 8, [&] { premultiply_alpha(rgba.data(), out8.data(), count); });
+        run("srgb_to_linear", count * 20, [&] { srgb_to_linear(rgba.data(), linear.data(), count); });
+        run("linear_to_srgb", count * 20, [&] { linear_to_srgb(linear.data(), out8.data(), count); });
+        run("float_to_half", count * 24, [&] { float_to_half(linear.data(), half.data(), count * 4); });
+        run("float_to_b10g11r11", count * 20, [&] { float_to_b10g11r11(linear.data(), packed.data(), count); });
+    }
+    simd_set_level(detected);
+}
+
+// pipeline and material switches when recording the draws in packet order
+static void count_switches(const std::vector<DrawPacket>& packets, const std::vector<uint32_t>& pipelines,
+    const std::vector<uint32_t>& materials, uint32_t& pipeline_switches, uint32_t& material_switches)
+{
+    pipeline_switches = 0;
+    material_switches = 0;
+    uint32_t pipeline = UINT32_MAX;
+    uint32_t material = UINT32_MAX;
+    for (const DrawPacket& packet : packets)
+    {
+        if (pipelines[packet.draw] != pipeline)
+            pipeline_switches++;
+        if (materials[packet.draw] != material)
+            material_switches++;
+        pipeline = pipelines[packet.draw];
+        material = materials[packet.draw];
+    }
+}
+
+void bench_draw_sort()
+{
+    const uint32_t draws = 100000;
+    const uint32_t reps = 20;
+    // a scene with 16 pipelines, 256 materials and 512 meshes, one draw in 8 transparent
+    std::mt19937 rng(1);
+    std::vector<uint32_t> pipelines(draws), materials(draws);
+    DrawQueue queue;
+    for (uint32_t i = 0; i < draws; i++)
+    {
+        pipelines[i] = rng() % 16;
+        materials[i] = rng() % 256;
+        uint16_t depth = depth_bucket(std::uniform_real_distribution<float>(0.1f, 1000.f)(rng), 0.1f, 1000.f);
+        bool transparent = rng() % 8 == 0;
+        queue.push(transparent
+            ? transparent_draw_key(1, pipelines[i], materials[i], depth, rng() % 512)
+            : opaque_draw_key(0, pipelines[i], materials[i], depth, rng() % 512), i);
+    }
+    std::vector<DrawPacket> unsorted = queue.packets;
+    uint32_t pipeline_before, material_before;
+    count_switches(unsorted, pipelines, materials, pipeline_before, material_before);
+
+    auto start = bench_clock::now();
+    for (uint32_t rep = 0; rep < reps; rep++)
+    {
+        queue.packets = unsorted;
+        queue.sort();
+    }
+    double radix_ms = elapsed_ms(start) / reps;
+
+    std::vector<DrawPacket> reference;
+    start = bench_clock::now();
+    for (uint32_t rep = 0; rep < reps; rep++)
+    {
+        reference = unsorted;
+        std::sort(reference.begin(), reference.end(), [](const DrawPacket& a, const DrawPacket& b) { return a.key < b.key; });
+    }
+    double std_ms = elapsed_ms(start) / reps;
+    // copying the input is in both timings
+    uint32_t pipeline_after, material_after;
+    count_switches(queue.packets, pipelines, materials, pipeline_after, material_after);
+
+    std::cout << "bench_draw_sort: " << draws << " draws\n"
+        << "  radix sort " << radix_ms << " ms (" << draws / radix_ms / 1000.0 << " M keys/s), std::sort " << std_ms << " ms\n"
+        << "  pipeline switches " << pipeline_before << " -> " << pipeline_after
+        << ", material switches " << material_before << " -> " << material_after << "\n";
+}
+
+void bench_jobs()
+{
+    const uint32_t job_count = 1 << 20;
+    const uint32_t fork_joins = 10000;
+    JobSystem jobs;
+    ThreadPool pool(jobs.thread_count());
+    std::cout << "bench_jobs: " << jobs.thread_count() << " threads\n";
+
+    // throughput: many tiny jobs from one thread, the workers steal them from its deque
+    std::atomic<uint32_t> sum = 0;
+    auto start = bench_clock::now();
+    JobCounter counter;
+    for (uint32_t i = 0; i < job_count; i++)
+        jobs.run([&sum] { sum.fetch_add(1, std::memory_order_relaxed); }, &counter);
+    jobs.wait(counter);
+    double jobs_ms = elapsed_ms(start);
+
+    sum = 0;
+    start = bench_clock::now();
+    {
+        std::latch done(job_count);
+        for (uint32_t i = 0; i < job_count; i++)
+            pool.post([&] { sum.fetch_add(1, std::memory_order_relaxed); done.count_down(); });
+        done.wait();
+    }
+    double pool_ms = elapsed_ms(start);
+    std::cout << "  throughput: job system " << job_count / jobs_ms / 1000.0 << " M jobs/s, thread pool "
+        << job_count / pool_ms / 1000.0 << " M jobs/s, " << jobs.steals.load() << " steals\n";
+
+    // fork-join: one tiny chunk per thread, the cost is almost all scheduling
+    start = bench_clock::now();
+    for (uint32_t i = 0; i < fork_joins; i++)
+        parallel_for(jobs, 0, jobs.thread_count(), 1, [&sum](uint32_t, uint32_t) { sum.fetch_add(1, std::memory_order_relaxed); });
+    double fork_us = elapsed_ms(start) * 1000.0 / fork_joins;
+
+    start = bench_clock::now();
+    for (uint32_t i = 0; i < fork_joins; i++)
+    {
+        std::latch done(jobs.thread_count());
+        for (uint32_t t = 0; t < jobs.thread_count(); t++)
+            pool.post([&] { sum.fetch_add(1, std::memory_order_relaxed); done.count_down(); });
+        done.wait();
+    }
+    double pool_fork_us = elapsed_ms(start) * 1000.0 / fork_joins;
+    std::cout << "  fork-join: parallel_for " << fork_us << " us, thread pool + latch " << pool_fork_us << " us\n";
+}
+
+// 12 triangles of the box center +- half
+static void append_box(std::vector<glm::vec3>& vertices, std::vector<uint32_t>& indices, glm::vec3 center, glm::vec3 half)
+{
+    uint32_t base = static_cast<uint32_t>(vertices.size());
+    for (uint32_t i = 0; i < 8; i++)
+        vertices.push_back(center + glm::vec3(i & 1 ? half.x : -half.x, i & 2 ? half.y : -half.y, i & 4 ? half.z : -half.z));
+    const uint32_t faces[36] = { 0, 1, 3, 0, 3, 2, 4, 5, 7, 4, 7, 6, 0, 1, 5, 0, 5, 4,
+        2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 3, 7, 1, 7, 5 };
+    for (uint32_t corner : faces)
+        indices.push_back(base + corner);
+}
+
+void bench_occlusion()
+{
+    const uint32_t blocks = 32;
+    const uint32_t object_count = 1 << 17;
+    const int reps = 20;
+    JobSystem jobs;
+    // the buildings of --city are the occluders, the objects are small boxes on the ground all over it
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> footprint(0.8f, 1.6f), height(1.f, 6.f), unit(0.f, 1.f);
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
+    for (uint32_t i = 0; i < blocks * blocks; i++)
+    {
+        glm::vec3 half(footprint(rng), footprint(rng), height(rng));
+        append_box(vertices, indices, glm::vec3(4.f * (i % blocks), 4.f * (i / blocks), half.z), half);
+    }
+    std::vector<Aabb> objects(object_count);
+    for (Aabb& object : objects)
+    {
+        glm::vec3 center(unit(rng) * 4.f * blocks - 2.f, unit(rng) * 4.f * blocks - 2.f, 0.25f);
+        object = { center - glm::vec3(0.25f), center + glm::vec3(0.25f) };
+    }
+    // standing in a street, looking down it
+    glm::vec3 eye(4.f * (blocks / 2) - 2.f, 4.f, 1.7f);
+    glm::mat4 proj = glm::perspectiveRH_ZO(glm::radians(60.f), 2.f, 0.1f, 1000.f);
+    proj[1][1] *= -1.f;
+    glm::mat4 view_proj = proj * glm::lookAt(eye, eye + glm::vec3(0.2f, 1.f, 0.f), glm::vec3(0.f, 0.f, 1.f));
+
+    OcclusionBuffer buffer(256, 128);
+    std::vector<uint8_t> visible(object_count);
+    std::cout << "bench_occlusion: " << buffer.width << "x" << buffer.height << ", " << indices.size() / 3
+        << " occluder triangles, " << object_count << " boxes, " << jobs.thread_count() << " threads\n";
+    SimdLevel detected = simd_detect();
+    for (int level = 0; level <= (int)detected; level++)
+    {
+        // SSSE3 runs the scalar path
+        if ((SimdLevel)level == SimdLevel::SSSE3)
+            continue;
+        simd_set_level((SimdLevel)level);
+        buffer.clear(view_proj);
+        buffer.render(jobs, vertices, indices);
+        auto start = bench_clock::now();
+        for (int i = 0; i < reps; i++)
+        {
+            buffer.clear(view_proj);
+            buffer.render(jobs, vertices, indices);
+        }
+        double render_ms = elapsed_ms(start) / reps;
+        start = bench_clock::now();
+        for (int i = 0; i < reps; i++)
+            buffer.test(jobs, objects.data(), object_count, visible.data());
+        double test_ms = elapsed_ms(start) / reps;
+        uint32_t drawn = 0;
+        for (uint8_t v : visible)
+            drawn += v;
+        std::cout << "  " << simd_name(simd_level()) << ": render " << render_ms << " ms (" << indices.size() / 3 / render_ms / 1000.0
+            << " M triangles/s), test " << test_ms << " ms (" << object_count / test_ms / 1000.0 << " M boxes/s), "
+            << drawn << " visible\n";
+    }
+    simd_set_level(detected);
+}
+
+void bench_rgb_upload(ResourceManager& rm, const std::vector<std::string>& images)
+{
+    bool gpu_expand = rm.gpu_expand;
+    for (bool gpu : { false, true })
+    {
+        rm.gpu_expand = gpu;
+        vk::DeviceSize staging_before = rm.staging_bytes;
+        auto start = bench_clock::now();
+        for (const auto& path : images)
+            rm.load_texture2D(path);
+        rm.device.scheduler->wait(rm.last_submit);
+        double ms = elapsed_ms(start);
+        std::cout << "bench_rgb_upload " << (gpu ? "compute expansion" : "CPU expansion") << ": "
+            << images.size() << " textures, " << ms << " ms, "
+            << ((rm.staging_bytes - staging_before) >> 10) << " KiB staged\n";
+    }
+    rm.gpu_expand = gpu_expand;
+}
+
+void bench_host_copy(ResourceManager& rm, const std::vector<std::string>& images)
+{
+    if (!rm.device.host_image_copy)
+        std::cout << "bench_host_copy VK_EXT_host_image_copy not available, both runs use staging\n";
+    bool host_copy = rm.host_copy;
+    bool gpu_expand = rm.gpu_expand;
+    // RGB images must take the upload path too
+    rm.gpu_expand = false;
+    for (bool host : { false, true })
+    {
+        rm.host_copy = host;
+        vk::DeviceSize staging_before = rm.staging_bytes;
+        vk::DeviceSize host_before = rm.host_copy_bytes;
+        auto start = bench_clock::now();
+        for (const auto& path : images)
+            rm.load_texture2D(path);
+        rm.device.scheduler->wait(rm.last_submit);
+        double ms = elapsed_ms(start);
+        std::cout << "bench_host_copy " << (host ? "host image copy" : "staging buffer") << ": "
+            << images.size() << " textures, " << ms << " ms, "
+            << ((rm.staging_bytes - staging_before) >> 10) << " KiB staged, "
+            << ((rm.host_copy_bytes - host_before) >> 10) << " KiB host copied\n";
+    }
+    rm.host_copy = host_copy;
+    rm.gpu_expand = gpu_expand;
+}
+
+void bench_file_io(ResourceManager& rm, bool batched, const std::vector<std::string>& files)
+{
+    uint64_t bytes = 0;
+    auto start = bench_clock::now();
+    if (batched)
+    {
+        for (const auto& data : rm.files->read_all(files))
+            bytes += data.size;
+    }
+    else
+    {
+        for (const auto& path : files)
+        {
+            FileRequest request;
+            request.name = path;
+            bytes += rm.files->read_blocking(request).size;
+        }
+    }
+    double ms = elapsed_ms(start);
+    std::cout << "bench_file_io " << (batched ? (rm.files->port ? "batched completion port" : "batched thread pool") : "blocking")
+        << ": " << files.size() << " files, " << (bytes >> 10) << " KiB, " << ms << " ms\n";
+}
+
+// draws stand in for real ones, dynamic state is valid to record outside a render pass
+static void record_dummy_draws(vk::CommandBuffer cmd, uint32_t draws)
+{
+    cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    for (uint32_t i = 0; i < draws; i++)
+    {
+        cmd.setViewport(0, vk::Viewport(0.f, 0.f, 800.f, 600.f, 0.f, 1.f));
+        cmd.setScissor(0, vk::Rect2D({ 0, 0 }, { 800, 600 }));
+    }
+    cmd.end();
+}
+
+void bench_command_reset(Device& device, uint32_t draws)
+{
+    const uint32_t frames_in_flight = 3;
+    const uint32_t buffers_per_frame = 4;
+    const uint32_t frames = 1000;
+
+    // one long lived pool, every buffer reset on its own before recording
+    vk::CommandPoolCreateInfo pool_info;
+    pool_info.queueFamilyIndex = device.device_family_index;
+    pool_info.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    auto pool = device.device->createCommandPoolUnique(pool_info);
+    auto cmds = device.device->allocateCommandBuffersUnique(
+        { *pool, vk::CommandBufferLevel::ePrimary, frames_in_flight * buffers_per_frame });
+    auto start = bench_clock::now();
+    for (uint32_t frame = 0; frame < frames; frame++)
+    {
+        for (uint32_t i = 0; i < buffers_per_frame; i++)
+        {
+            vk::CommandBuffer cmd = *cmds[(frame % frames_in_flight) * buffers_per_frame + i];
+            cmd.reset();
+            record_dummy_draws(cmd, draws);
+        }
+    }
+    double buffer_ms = elapsed_ms(start) / frames;
+
+    // pool per frame slot, reset in one call and buffers handed out again in order
+    CommandPoolRing ring(*device.device, device.device_family_index, frames_in_flight);
+    start = bench_clock::now();
+    for (uint32_t frame = 0; frame < frames; frame++)
+    {
+        uint32_t slot = frame % frames_in_flight;
+        ring.reset(slot);
+        for (uint32_t i = 0; i < buffers_per_frame; i++)
+            record_dummy_draws(ring.get(slot).allocate(), draws);
+    }
+    double pool_ms = elapsed_ms(start) / frames;
+
+    std::cout << "bench_command_reset: " << buffers_per_frame << " buffers x " << draws << " draws per frame\n"
+        << "  per buffer reset: " << buffer_ms * 1000.0 << " us per frame\n"
+        << "  per frame pool reset: " << pool_ms * 1000.0 << " us per frame\n";
+}
+
+void bench_parallel_record(Device& device, JobSystem& jobs, vk::RenderPass renderpass, vk::Framebuffer framebuffer, vk::Rect2D area,
+    uint32_t draws, const std::function<void(vk::CommandBuffer, uint32_t, uint32_t)>& record)
+{
+    const uint32_t frames = 100;
+    vk::RenderPassBeginInfo begin_info(renderpass, framebuffer, area);
+    std::array<vk::ClearValue, 2> clear{ vk::ClearColorValue(std::array{ 0.f, 0.f, 0.f, 1.f }),
+        vk::ClearDepthStencilValue(1.f, 0) };
+    begin_info.setClearValues(clear);
+    vk::CommandBufferInheritanceInfo inheritance(renderpass, 0, framebuffer);
+
+    std::cout << "bench_parallel_record: " << draws << " draws per frame\n";
+    double inline_ms = 0;
+    for (uint32_t threads = 0; threads <= jobs.thread_count(); threads++)
+    {
+        // threads 0 is the inline baseline
+        CommandPoolRing pools(*device.device, device.device_family_index, 1, std::max<uint32_t>(threads, 1));
+        ParallelRecorder recorder(pools, jobs);
+        auto start = bench_clock::now();
+        for (uint32_t frame = 0; frame < frames; frame++)
+        {
+            pools.reset(0);
+            vk::CommandBuffer cmd = pools.get(0).allocate();
+            cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            if (threads == 0)
+            {
+                cmd.beginRenderPass(begin_info, vk::SubpassContents::eInline);
+                record(cmd, 0, draws);
+            }
+            else
+            {
+                cmd.beginRenderPass(begin_info, vk::SubpassContents::eSecondaryCommandBuffers);
+                recorder.record(cmd, 0, inheritance, draws, record);
+            }
+            cmd.endRenderPass();
+            cmd.end();
+        }
+        double ms = elapsed_ms(start) / frames;
+        if (threads == 0)
+        {
+            inline_ms = ms;
+            std::cout << "  inline: " << ms << " ms per frame\n";
+        }
+        else
+            std::cout << "  " << threads << " threads: " << ms << " ms per frame, " << inline_ms / ms << "x inline\n";
+    }
+}
+
+void bench_instancing(Device& device, InstanceBuffer& instances, vk::RenderPass renderpass, vk::Framebuffer framebuffer,
+    vk::Rect2D area, const std::function<void(vk::CommandBuffer, vk::DeviceSize, uint32_t)>& record)
+{
+    const uint32_t frames = 20;
+    vk::RenderPassBeginInfo begin_info(renderpass, framebuffer, area);
+    std::array<vk::ClearValue, 2> clear{ vk::ClearColorValue(std::array{ 0.f, 0.f, 0.f, 1.f }),
+        vk::ClearDepthStencilValue(1.f, 0) };
+    begin_info.setClearValues(clear);
+
+    // no GPU time when the queue has no timestamps, only the low valid bits of a tick count
+    uint32_t valid_bits = device.physical_device.getQueueFamilyProperties()[device.device_family_index].timestampValidBits;
+    uint64_t tick_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+    vk::UniqueQueryPool timestamps;
+    if (valid_bits > 0)
+    {
+        vk::QueryPoolCreateInfo query_info;
+        query_info.queryType = vk::QueryType::eTimestamp;
+        query_info.queryCount = 2;
+        timestamps = device.device->createQueryPoolUnique(query_info);
+    }
+    double timestamp_period = device.physical_device.getProperties().limits.timestampPeriod;
+    CommandAllocator cmds(*device.device, device.device_family_index);
+
+    std::cout << "bench_instancing: up to " << instances.capacity << " instances, one draw\n";
+    for (uint64_t count = 1; count <= instances.capacity; count *= 10)
+    {
+        double build_ms = 0, upload_ms = 0, gpu_ms = 0;
+        for (uint32_t frame = 0; frame < frames; frame++)
+        {
+            auto start = bench_clock::now();
+            instances.grid(static_cast<uint32_t>(count), frame * 0.1f);
+            build_ms += elapsed_ms(start);
+            start = bench_clock::now();
+            vk::DeviceSize offset = instances.upload(0);
+            upload_ms += elapsed_ms(start);
+
+            cmds.reset();
+            vk::CommandBuffer cmd = cmds.allocate();
+            cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            if (timestamps)
+            {
+                cmd.resetQueryPool(*timestamps, 0, 2);
+                cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, *timestamps, 0);
+            }
+            cmd.beginRenderPass(begin_info, vk::SubpassContents::eInline);
+            record(cmd, offset, static_cast<uint32_t>(count));
+            cmd.endRenderPass();
+            if (timestamps)
+                cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *timestamps, 1);
+            cmd.end();
+            // one frame at a time, the next build overwrites slot 0
+            device.scheduler->wait(device.scheduler->submit(0, cmd));
+
+            uint64_t ticks[2];
+            if (timestamps && device.device->getQueryPoolResults(*timestamps, 0, 2, sizeof(ticks), ticks, sizeof(uint64_t),
+                vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait) == vk::Result::eSuccess)
+                gpu_ms += ((ticks[1] - ticks[0]) & tick_mask) * timestamp_period / 1e6;
+        }
+        build_ms /= frames;
+        upload_ms /= frames;
+        gpu_ms /= frames;
+        std::cout << "  " << count << " instances: build " << build_ms << " ms, upload " << upload_ms << " ms";
+        if (timestamps)
+            std::cout << ", gpu " << gpu_ms << " ms, " << gpu_ms * 1e6 / count << " ns per instance";
+        std::cout << "\n";
+    }
+}
+
+void bench_frustum_cull()
+{
+    const uint32_t object_count = 1 << 20;
+    const int reps = 50;
+    JobSystem jobs;
+    // boxes of 0.6 to 2.4 units scattered in a cube of 1000 around the camera
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(-500.f, 500.f), extent(0.3f, 1.2f);
+    CullVolumes volumes;
+    for (uint32_t i = 0; i < object_count; i++)
+    {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        glm::vec3 half(extent(rng), extent(rng), extent(rng));
+        volumes.add(glm::vec4(center, glm::length(half)), center - half, center + half);
+    }
+    glm::mat4 proj = glm::perspectiveRH_ZO(glm::radians(60.f), 16.f / 9.f, 0.1f, 1000.f);
+    proj[1][1] *= -1.f;
+    glm::mat4 view_proj = proj * glm::lookAt(glm::vec3(0.f), glm::vec3(1.f, 0.2f, 0.1f), glm::vec3(0.f, 0.f, 1.f));
+
+    FrustumCuller culler;
+    std::cout << "bench_frustum_cull: " << object_count << " objects, " << jobs.thread_count() << " threads\n";
+    SimdLevel detected = simd_detect();
+    for (int level = 0; level <= (int)detected; level++)
+    {
+        // SSSE3 runs the scalar path
+        if ((SimdLevel)level == SimdLevel::SSSE3)
+            continue;
+        simd_set_level((SimdLevel)level);
+        culler.cull(jobs, volumes, view_proj);
+        auto start = bench_clock::now();
+        for (int i = 0; i < reps; i++)
+            culler.cull(jobs, volumes, view_proj);
+        double ms = elapsed_ms(start) / reps;
+        std::cout << "  " << simd_name(simd_level()) << ": " << ms << " ms (" << object_count / ms / 1000.0
+            << " M objects/s), " << culler.visible.size() << " visible\n";
+    }
+    simd_set_level(detected);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct ResourceManager;
+struct Device;
+struct JobSystem;
+struct InstanceBuffer;
+
+// Startup cost of the cooked pack path against decoding the source images with stb.
+void bench_cold_start(ResourceManager& rm, const std::string& pack_path, const std::vector<std::string>& images);
+
+// Every texture loaded one after the other on this thread, against all of them in flight through
+// load_texture2D_async with decoding on the pool.
+void bench_async_load(ResourceManager& rm, const std::vector<std::string>& images);
+
+// Time until every texture is usable: full upload against mip tail first streaming.
+void bench_progressive(ResourceManager& rm, const std::vector<std::string>& images);
+
+// Throughput of every pixel conversion kernel at each SIMD level supported by the CPU.
+void bench_pixel_kernels();
+
+// Radix sort of 100k draw keys against std::sort, and the pipeline/material switches sorting saves.
+void bench_draw_sort();
+
+// Empty job throughput and parallel_for fork-join latency of the job system against ThreadPool.
+void bench_jobs();
+
+// Occluder rasterization and box test throughput of OcclusionBuffer, scalar against AVX2, on a
+// street of the --city scene.
+void bench_occlusion();
+
+// FrustumCuller over 1M sphere + AABB volumes, scalar against AVX2.
+void bench_frustum_cull();
+
+// Staging bytes and upload time of RGB images expanded on the CPU against the compute pass.
+void bench_rgb_upload(ResourceManager& rm, const std::vector<std::string>& images);
+
+// Startup time of uploading through a staging buffer against VK_EXT_host_image_copy.
+void bench_host_copy(ResourceManager& rm, const std::vector<std::string>& images);
+
+// Reads the files with one blocking call after the other or as a single batch on the I/O thread.
+// One mode per run, so each one can start from a cold system cache.
+void bench_file_io(ResourceManager& rm, bool batched, const std::vector<std::string>& files);
+
+// CPU cost per frame of recording command buffers reset one by one against resetting the pool of the frame.
+void bench_command_reset(Device& device, uint32_t draws);
+
+// Time to record draws split in 1 to thread_count ranges into secondary command buffers,
+// against recording them inline in the primary. record(cmd, begin, end) records draws [begin, end).
+void bench_parallel_record(Device& device, JobSystem& jobs, vk::RenderPass renderpass, vk::Framebuffer framebuffer, vk::Rect2D area,
+    uint32_t draws, const std::function<void(vk::CommandBuffer, uint32_t, uint32_t)>& record);
+
+// Instanced draw of 1 to instances.capacity instances, ten times more each step: CPU time to build
+// and upload the instance data, GPU time of the draw. record(cmd, offset, count) binds the instance
+// buffer at offset and draws count instances. framebuffer is an offscreen target the render pass
+// finds and leaves in eColorAttachmentOptimal.
+void bench_instancing(Device& device, InstanceBuffer& instances, vk::RenderPass renderpass, vk::Framebuffer framebuffer,
+    vk::Rect2D area, const std::function<void(vk::CommandBuffer, vk::DeviceSize, uint32_t)>& record);
@@ -0,0 +1,54 @@
+#include "cmdpool.h"
+#include <algorithm>
+
+CommandAllocator::CommandAllocator(vk::Device device, uint32_t family_index) : device(device)
+{
+    vk::CommandPoolCreateInfo pool_info;
+    pool_info.queueFamilyIndex = family_index;
+    // no eResetCommandBuffer: buffers are only ever reset together with the pool
+    pool_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    pool = device.createCommandPoolUnique(pool_info);
+}
+
+vk::CommandBuffer CommandAllocator::allocate(vk::CommandBufferLevel level)
+{
+    bool is_primary = level == vk::CommandBufferLevel::ePrimary;
+    auto& buffers = is_primary ? primary : secondary;
+    uint32_t& used = is_primary ? primary_used : secondary_used;
+    if (used == buffers.size())
+    {
+        // grow in small batches, after the first frames the pool never allocates again
+        uint32_t count = std::max<uint32_t>(static_cast<uint32_t>(buffers.size()), 4);
+        auto more = device.allocateCommandBuffersUnique({ *pool, level, count });
+        for (auto& cmd : more)
+            buffers.push_back(std::move(cmd));
+    }
+    return *buffers[used++];
+}
+
+void CommandAllocator::reset()
+{
+    if (primary_used == 0 && secondary_used == 0)
+        return;
+    device.resetCommandPool(*pool, {});
+    primary_used = 0;
+    secondary_used = 0;
+}
+
+CommandPoolRing::CommandPoolRing(vk::Device device, uint32_t family_index, uint32_t frames_in_flight, uint32_t threads)
+    : threads(threads)
+{
+    slots.resize(frames_in_flight);
+    for (auto& slot : slots)
+    {
+        slot.reserve(threads);
+        for (uint32_t i = 0; i < threads; i++)
+            slot.emplace_back(device, family_index);
+    }
+}
+
+void CommandPoolRing::reset(uint32_t slot)
+{
+    for (auto& allocator : slots[slot])
+        allocator.reset();
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+
+// One transient command pool used by a single thread. Buffers stay allocated across resets
+// and are handed out in order, reset() recycles all of them with one vkResetCommandPool.
+struct CommandAllocator
+{
+    vk::Device device;
+    vk::UniqueCommandPool pool;
+    std::vector<vk::UniqueCommandBuffer> primary;
+    std::vector<vk::UniqueCommandBuffer> secondary;
+    uint32_t primary_used = 0;
+    uint32_t secondary_used = 0;
+
+    CommandAllocator(vk::Device device, uint32_t family_index);
+
+    // The buffer is in the initial state, ready for begin().
+    vk::CommandBuffer allocate(vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
+    // Every buffer handed out since the last reset must be done on the GPU.
+    void reset();
+};
+
+// frames_in_flight x threads command allocators: a frame slot resets all of its pools at once
+// when the GPU finished it, instead of resetting buffers one by one.
+struct CommandPoolRing
+{
+    uint32_t threads;
+    std::vector<std::vector<CommandAllocator>> slots;
+
+    CommandPoolRing(vk::Device device, uint32_t family_index, uint32_t frames_in_flight, uint32_t threads = 1);
+
+    CommandPoolRing(const CommandPoolRing&) = delete;
+    CommandPoolRing& operator=(const CommandPoolRing&) = delete;
+
+    void reset(uint32_t slot);
+    CommandAllocator& get(uint32_t slot, uint32_t thread = 0) { return slots[slot][thread]; }
+};
@@ -1,5 +1,21 @@
 #include "device.h"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+
+#ifdef VK_EXT_host_image_copy
+static bool has_extensions(const vk::PhysicalDevice& pd, const std::vector<const char*>& names)
+{
+    std::vector<vk::ExtensionProperties> extensions = pd.enumerateDeviceExtensionProperties();
+    for (auto name : names)
+    {
+        if (std::none_of(extensions.begin(), extensions.end(),
+            [name](const vk::ExtensionProperties& ext) { return strcmp(ext.extensionName, name) == 0; }))
+            return false;
+    }
+    return true;
+}
+#endif
 
 void Device::init_instance()
 {
@@ -10,7 +26,7 @@ void Device::init_instance()
     inst_extensions.emplace_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 
     vk::ApplicationInfo app_info;
-    app_info.apiVersion = VK_VERSION_1_2;
+    app_info.apiVersion = VK_API_VERSION_1_2;
     app_info.pApplicationName = "VulcanLezione";
     app_info.applicationVersion = VK_MAKE_VERSION(0, 1, 1);
     app_info.pEngineName = "Custom";
@@ -57,17 +73,75 @@ bool Device::create_device(HWND hWnd)
                 queue_info.pQueuePriorities = queue_priority;
 
                 vk::DeviceCreateInfo device_info;
+                // timeline semaphores are core in 1.2 but still an optional feature
+                vk::PhysicalDeviceVulkan12Features supported12 = pd.getFeatures2<vk::PhysicalDeviceFeatures2,
+                    vk::PhysicalDeviceVulkan12Features>().get<vk::PhysicalDeviceVulkan12Features>();
+                vk::PhysicalDeviceVulkan12Features features12;
+                if (!supported12.timelineSemaphore)
+                    continue;
+                features12.timelineSemaphore = true;
+                device_info.pNext = &features12;
+                // GPU driven draws: a compute pass writes the draws and their count, firstInstance picks the object
+                vk::PhysicalDeviceFeatures supported = pd.getFeatures();
+                vk::PhysicalDeviceFeatures features;
+                if (supported12.drawIndirectCount && supported.multiDrawIndirect && supported.drawIndirectFirstInstance)
+                {
+                    features12.drawIndirectCount = true;
+                    features.multiDrawIndirect = true;
+                    features.drawIndirectFirstInstance = true;
+                    draw_indirect_count = true;
+                }
+                // depth pyramids are reduced by the sampler, a linear fetch returns the max of its footprint
+                if (supported12.samplerFilterMinmax)
+                {
+                    features12.samplerFilterMinmax = true;
+                    sampler_minmax = true;
+                }
+                device_info.pEnabledFeatures = &features;
+#ifdef VK_EXT_host_image_copy
+                // host image copy depends on copy_commands2 and format_feature_flags2 before Vulkan 1.3
+                std::vector<const char*> host_copy_extensions{
+                    VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME,
+                    VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME,
+                    VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME,
+                };
+                vk::PhysicalDeviceHostImageCopyFeaturesEXT host_copy_features;
+                if (has_extensions(pd, host_copy_extensions) && pd.getFeatures2<vk::PhysicalDeviceFeatures2,
+                    vk::PhysicalDeviceHostImageCopyFeaturesEXT>().get<vk::PhysicalDeviceHostImageCopyFeaturesEXT>().hostImageCopy)
+                {
+                    device_extensions.insert(device_extensions.end(), host_copy_extensions.begin(), host_copy_extensions.end());
+                    host_copy_features.hostImageCopy = true;
+                    features12.pNext = &host_copy_features;
+                    host_image_copy = true;
+
+                    vk::PhysicalDeviceHostImageCopyPropertiesEXT host_copy_props;
+                    vk::PhysicalDeviceProperties2 props2;
+                    props2.pNext = &host_copy_props;
+                    pd.getProperties2(&props2);
+                    host_copy_dst_layouts.resize(host_copy_props.copyDstLayoutCount);
+                    host_copy_props.pCopyDstLayouts = host_copy_dst_layouts.data();
+                    pd.getProperties2(&props2);
+                }
+#endif
                 device_info.queueCreateInfoCount = 1;
                 device_info.pQueueCreateInfos = &queue_info;
                 device_info.setPEnabledExtensionNames(device_extensions);
                 device_info.setPEnabledLayerNames(device_layers);
                 device = pd.createDeviceUnique(device_info);
+                if (host_image_copy)
+                {
+                    copy_memory_to_image = device->getProcAddr("vkCopyMemoryToImageEXT");
+                    transition_image_layout = device->getProcAddr("vkTransitionImageLayoutEXT");
+                    std::cout << "VK_EXT_host_image_copy abilitata\n";
+                }
 
                 q = device->getQueue(device_family_index, 0);
                 vk::CommandPoolCreateInfo pool_info;
                 pool_info.queueFamilyIndex = device_family_index;
                 pool_info.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
                 cmd_pool = device->createCommandPoolUnique(pool_info);
+                scheduler = std::make_unique<GpuScheduler>(*device);
+                scheduler->add_queue(q);
 
                 return true;
             }
@@ -2,6 +2,8 @@
 #include <windows.h>
 #include <vulkan/vulkan.hpp>
 #include <vector>
+#include <memory>
+#include "timeline.h"
 
 struct Device
 {
@@ -13,8 +15,19 @@ struct Device
     vk::UniqueDevice device;
     vk::Queue q;
     vk::UniqueCommandPool cmd_pool;
+    // timeline of q is queue 0
+    std::unique_ptr<GpuScheduler> scheduler;
     vk::UniqueSwapchainKHR swapchain;
     vk::SwapchainCreateInfoKHR swapchain_info;
+    // VK_EXT_host_image_copy: images can be written from the CPU without a queue submit
+    bool host_image_copy = false;
+    std::vector<vk::ImageLayout> host_copy_dst_layouts;
+    PFN_vkVoidFunction copy_memory_to_image = nullptr;
+    PFN_vkVoidFunction transition_image_layout = nullptr;
+    // drawIndexedIndirectCount with firstInstance, for draws written by compute passes
+    bool draw_indirect_count = false;
+    // samplerFilterMinmax, min or max reduction in place of the filter average
+    bool sampler_minmax = false;
 
     void init_instance();
     bool create_device(HWND hWnd);
@@ -0,0 +1,74 @@
+#include "drawsort.h"
+#include <algorithm>
+
+// value masked to bits
+static uint64_t key_field(uint32_t value, uint32_t bits)
+{
+    return value & ((1ull << bits) - 1);
+}
+
+uint64_t opaque_draw_key(uint32_t pass, uint32_t pipeline, uint32_t material, uint16_t depth, uint32_t mesh)
+{
+    return key_field(pass, 4) << 60
+        | key_field(pipeline, 12) << 48
+        | key_field(material, 16) << 32
+        | key_field(depth, 16) << 16
+        | key_field(mesh, 16);
+}
+
+uint64_t transparent_draw_key(uint32_t pass, uint32_t pipeline, uint32_t material, uint16_t depth, uint32_t mesh)
+{
+    // inverted so the farthest draw sorts first
+    uint16_t far_first = 0xffff - depth;
+    return key_field(pass, 4) << 60
+        | key_field(far_first, 16) << 44
+        | key_field(pipeline, 12) << 32
+        | key_field(material, 16) << 16
+        | key_field(mesh, 16);
+}
+
+uint16_t depth_bucket(float depth, float near_plane, float far_plane)
+{
+    float t = (depth - near_plane) / (far_plane - near_plane);
+    t = std::min<float>(std::max<float>(t, 0.f), 1.f);
+    return static_cast<uint16_t>(t * 65535.f + 0.5f);
+}
+
+void radix_sort(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch)
+{
+    size_t count = packets.size();
+    if (count < 2)
+        return;
+    scratch.resize(count);
+
+    // all 8 histograms in one read of the keys
+    uint32_t histograms[8][256] = {};
+    for (const DrawPacket& packet : packets)
+        for (uint32_t digit = 0; digit < 8; digit++)
+            histograms[digit][(packet.key >> (digit * 8)) & 0xff]++;
+
+    DrawPacket* src = packets.data();
+    DrawPacket* dst = scratch.data();
+    for (uint32_t digit = 0; digit < 8; digit++)
+    {
+        uint32_t* histogram = histograms[digit];
+        // one bucket holds every key: this byte is the same everywhere, nothing to move
+        if (histogram[(src[0].key >> (digit * 8)) & 0xff] == count)
+            continue;
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < 256; bucket++)
+        {
+            uint32_t size = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += size;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            const DrawPacket& packet = src[i];
+            dst[histogram[(packet.key >> (digit * 8)) & 0xff]++] = packet;
+        }
+        std::swap(src, dst);
+    }
+    if (src != packets.data())
+        packets.swap(scratch);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// One draw in the submission queue: the key decides the order, draw indexes the caller's draw data.
+struct DrawPacket
+{
+    uint64_t key;
+    uint32_t draw;
+};
+
+// 64 bit sort keys, most significant field first so sorting by key groups the draws by pass,
+// then by the state that is most expensive to switch.
+//   opaque:      pass:4 | pipeline:12 | material:16 | depth:16 | mesh:16   depth front to back
+//   transparent: pass:4 | depth:16 | pipeline:12 | material:16 | mesh:16   depth back to front
+// Transparent draws must blend in depth order, so depth goes before any state there.
+uint64_t opaque_draw_key(uint32_t pass, uint32_t pipeline, uint32_t material, uint16_t depth, uint32_t mesh);
+uint64_t transparent_draw_key(uint32_t pass, uint32_t pipeline, uint32_t material, uint16_t depth, uint32_t mesh);
+inline uint32_t draw_key_pass(uint64_t key) { return static_cast<uint32_t>(key >> 60); }
+// view depth quantized to 16 bits over [near, far], values outside clamp
+uint16_t depth_bucket(float depth, float near_plane, float far_plane);
+
+// Stable LSD radix sort on the key, 8 bits per pass. Passes where every key has the same byte
+// are skipped, scratch is resized as needed and can be kept between calls.
+void radix_sort(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch);
+
+// Draws collected during a frame, sorted once before recording.
+struct DrawQueue
+{
+    std::vector<DrawPacket> packets;
+    std::vector<DrawPacket> scratch;
+
+    void clear() { packets.clear(); }
+    void push(uint64_t key, uint32_t draw) { packets.push_back({ key, draw }); }
+    void sort() { radix_sort(packets, scratch); }
+};
@@ -0,0 +1,93 @@
+#include "executor.h"
+#include <algorithm>
+
+std::function<void()> JobQueue::pop()
+{
+    // top() is const, the job is moved out right before being popped
+    std::function<void()> fn = std::move(const_cast<Job&>(jobs.top()).fn);
+    jobs.pop();
+    return fn;
+}
+
+ThreadPool::ThreadPool(uint32_t thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max<uint32_t>(std::thread::hardware_concurrency(), 2) - 1;
+    for (uint32_t i = 0; i < thread_count; i++)
+        threads.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void ThreadPool::post(std::function<void()> job, int priority)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push(std::move(job), priority);
+    }
+    cv.notify_one();
+}
+
+void ThreadPool::worker()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            job = queue.pop();
+        }
+        job();
+    }
+}
+
+void MainExecutor::post(std::function<void()> job, int priority)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push(std::move(job), priority);
+}
+
+void MainExecutor::wait_gpu(GpuScheduler& scheduler, TimelinePoint point, std::coroutine_handle<> handle)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    gpu_waits.push_back({ &scheduler, point, handle });
+}
+
+uint32_t MainExecutor::run_pending()
+{
+    std::vector<std::function<void()>> jobs;
+    std::vector<std::coroutine_handle<>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!queue.empty())
+            jobs.push_back(queue.pop());
+        for (size_t i = 0; i < gpu_waits.size();)
+        {
+            if (gpu_waits[i].scheduler->is_complete(gpu_waits[i].point))
+            {
+                ready.push_back(gpu_waits[i].handle);
+                gpu_waits.erase(gpu_waits.begin() + i);
+            }
+            else
+                i++;
+        }
+    }
+    // run unlocked, jobs and resumed coroutines may post again, those run next call
+    for (auto& job : jobs)
+        job();
+    for (auto handle : ready)
+        handle.resume();
+    return static_cast<uint32_t>(jobs.size() + ready.size());
+}
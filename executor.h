@@ -0,0 +1,112 @@
+#pragma once
+#include "timeline.h"
+#include <coroutine>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Jobs ordered by priority, higher first, and in posting order within a priority.
+struct JobQueue
+{
+    struct Job
+    {
+        int priority;
+        uint64_t order;
+        std::function<void()> fn;
+    };
+    struct Compare
+    {
+        bool operator()(const Job& a, const Job& b) const
+        {
+            return a.priority != b.priority ? a.priority < b.priority : a.order > b.order;
+        }
+    };
+    std::priority_queue<Job, std::vector<Job>, Compare> jobs;
+    uint64_t next_order = 0;
+
+    void push(std::function<void()> fn, int priority) { jobs.push({ priority, next_order++, std::move(fn) }); }
+    std::function<void()> pop();
+    bool empty() const { return jobs.empty(); }
+};
+
+struct Executor
+{
+    virtual ~Executor() = default;
+    virtual void post(std::function<void()> job, int priority = 0) = 0;
+};
+
+struct ThreadPool : public Executor
+{
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable cv;
+    JobQueue queue;
+    bool stopping = false;
+
+    // 0 threads leaves one core to the render thread
+    ThreadPool(uint32_t thread_count = 0);
+    // Jobs still queued are dropped, the coroutines waiting in them are never resumed.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void post(std::function<void()> job, int priority = 0) override;
+    void worker();
+};
+
+// Runs its jobs on the thread calling run_pending (the render loop) and resumes the coroutines
+// waiting for a GPU timeline point there once it is reached.
+struct MainExecutor : public Executor
+{
+    struct GpuWait
+    {
+        GpuScheduler* scheduler;
+        TimelinePoint point;
+        std::coroutine_handle<> handle;
+    };
+    std::mutex mutex;
+    JobQueue queue;
+    std::vector<GpuWait> gpu_waits;
+
+    void post(std::function<void()> job, int priority = 0) override;
+    void wait_gpu(GpuScheduler& scheduler, TimelinePoint point, std::coroutine_handle<> handle);
+    // Runs the jobs queued so far and resumes the finished GPU waits, returns how many ran.
+    uint32_t run_pending();
+};
+
+// co_await schedule(executor) continues the coroutine on one of the executor threads.
+struct ScheduleAwaiter
+{
+    Executor& executor;
+    int priority;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) { executor.post([h] { h.resume(); }, priority); }
+    void await_resume() const noexcept {}
+};
+
+inline ScheduleAwaiter schedule(Executor& executor, int priority = 0)
+{
+    return { executor, priority };
+}
+
+// co_await wait_gpu(main, scheduler, point) continues on the main executor once point is reached.
+struct GpuAwaiter
+{
+    MainExecutor& executor;
+    GpuScheduler& scheduler;
+    TimelinePoint point;
+
+    bool await_ready() const { return scheduler.is_complete(point); }
+    void await_suspend(std::coroutine_handle<> h) { executor.wait_gpu(scheduler, point, h); }
+    void await_resume() const noexcept {}
+};
+
+inline GpuAwaiter wait_gpu(MainExecutor& executor, GpuScheduler& scheduler, TimelinePoint point)
+{
+    return { executor, scheduler, point };
+}
@@ -0,0 +1,139 @@
+#include "frame.h"
+#include "device.h"
+#include <iostream>
+#include <algorithm>
+
+void FrameStats::report(std::ostream& os, uint32_t frames_in_flight) const
+{
+    if (frames == 0)
+        return;
+    double frame = frame_ms / frames;
+    double wait = wait_ms / frames;
+    double cpu = frame - wait;
+    os << "FrameStats: " << frames_in_flight << " frames in flight, " << frames << " frames\n"
+        << "  frame " << frame << " ms (" << 1000.0 / frame << " fps), cpu " << cpu << " ms, gpu wait " << wait << " ms\n";
+    if (gpu_frames > 0)
+    {
+        double gpu = gpu_ms / gpu_frames;
+        // time both were busy at once, over the frame time
+        double overlap = std::max<double>(cpu + gpu - frame, 0.0) / frame;
+        os << "  gpu " << gpu << " ms, cpu/gpu overlap " << overlap * 100.0 << "%\n";
+    }
+}
+
+FrameRing::FrameRing(Device& device, uint32_t frames_in_flight, uint32_t threads)
+    : device(device), pools(*device.device, device.device_family_index, frames_in_flight, threads)
+{
+    if (frames_in_flight < 1 || frames_in_flight > 3)
+        throw std::runtime_error("FrameRing: frames in flight must be 1 to 3");
+    frames.resize(frames_in_flight);
+    for (uint32_t i = 0; i < frames_in_flight; i++)
+    {
+        frames[i].slot = i;
+        frames[i].image_acquired = device.device->createSemaphoreUnique(vk::SemaphoreCreateInfo());
+        frames[i].render_complete = device.device->createSemaphoreUnique(vk::SemaphoreCreateInfo());
+    }
+
+    auto families = device.physical_device.getQueueFamilyProperties();
+    if (families[device.device_family_index].timestampValidBits > 0)
+    {
+        vk::QueryPoolCreateInfo query_info;
+        query_info.queryType = vk::QueryType::eTimestamp;
+        query_info.queryCount = frames_in_flight * 2;
+        timestamps = device.device->createQueryPoolUnique(query_info);
+        timestamp_period = device.physical_device.getProperties().limits.timestampPeriod;
+    }
+    last_begin = std::chrono::steady_clock::now();
+}
+
+Frame& FrameRing::begin()
+{
+    uint32_t slot = static_cast<uint32_t>(frame_index % frames.size());
+    Frame& frame = frames[slot];
+
+    auto wait_start = std::chrono::steady_clock::now();
+    // value 0 on a slot never submitted returns right away
+    device.scheduler->wait(frame.done);
+    // the queue runs the submits in order, everything up to this one is done too
+    if (frame.submitted)
+        completed = std::max<uint64_t>(completed, frame.submitted_frame + 1);
+    auto now = std::chrono::steady_clock::now();
+    if (frame_index > 0)
+    {
+        stats.frames++;
+        stats.frame_ms += std::chrono::duration<double, std::milli>(now - last_begin).count();
+        stats.wait_ms += std::chrono::duration<double, std::milli>(now - wait_start).count();
+    }
+    last_begin = now;
+
+    if (timestamps && frame.submitted)
+    {
+        uint64_t ticks[2];
+        if (device.device->getQueryPoolResults(*timestamps, slot * 2, 2, sizeof(ticks), ticks, sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64) == vk::Result::eSuccess)
+        {
+            stats.gpu_ms += (ticks[1] - ticks[0]) * timestamp_period / 1e6;
+            stats.gpu_frames++;
+        }
+    }
+    frame.submitted = false;
+
+    pools.reset(slot);
+    frame.cmd = pools.get(slot).allocate();
+    frame.cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    if (timestamps)
+    {
+        frame.cmd.resetQueryPool(*timestamps, slot * 2, 2);
+        frame.cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, *timestamps, slot * 2);
+    }
+    return frame;
+}
+
+uint64_t FrameRing::completed_frames() const
+{
+    return completed;
+}
+
+bool FrameRing::acquire(Frame& frame, uint32_t& image_index)
+{
+    auto next_image = device.device->acquireNextImageKHR(*device.swapchain, UINT64_MAX, *frame.image_acquired, nullptr);
+    // suboptimal still acquired the image and will signal the semaphore
+    if (next_image.result != vk::Result::eSuccess && next_image.result != vk::Result::eSuboptimalKHR)
+        return false;
+    image_index = next_image.value;
+    return true;
+}
+
+void FrameRing::submit(Frame& frame, uint32_t image_index, const std::vector<GpuScheduler::Wait>& waits)
+{
+    uint32_t slot = frame.slot;
+    if (timestamps)
+        frame.cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *timestamps, slot * 2 + 1);
+    frame.cmd.end();
+
+    // the swapchain semaphores stay binary, present cannot wait on a timeline
+    GpuScheduler::Submit submit_info;
+    submit_info.cmds.push_back(frame.cmd);
+    submit_info.waits = waits;
+    submit_info.binary_waits.push_back(*frame.image_acquired);
+    submit_info.binary_wait_stages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+    submit_info.binary_signals.push_back(*frame.render_complete);
+    frame.done = device.scheduler->submit(submit_info);
+    frame.submitted = true;
+    frame.submitted_frame = frame_index;
+
+    vk::Result present_result;
+    vk::PresentInfoKHR present_info;
+    present_info.setWaitSemaphores(*frame.render_complete);
+    present_info.setSwapchains(*device.swapchain);
+    present_info.pImageIndices = &image_index;
+    present_info.pResults = &present_result;
+    device.q.presentKHR(present_info);
+    frame_index++;
+}
+
+void FrameRing::skip(Frame& frame)
+{
+    frame.cmd.end();
+    frame_index++;
+}
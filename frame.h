@@ -0,0 +1,73 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include "timeline.h"
+#include "cmdpool.h"
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+struct Device;
+
+// Everything one frame owns while the GPU works on it. The render loop adds what it needs per frame
+// (descriptor set, uniform region) and only touches it after begin() returned the slot.
+struct Frame
+{
+    // from the slot pool of the render thread, valid until the next begin() of the slot
+    vk::CommandBuffer cmd;
+    vk::UniqueSemaphore image_acquired;
+    vk::UniqueSemaphore render_complete;
+    uint32_t slot = 0; // index in FrameRing::frames and pools
+    // reached when the GPU finished the last submit of this slot
+    TimelinePoint done;
+    bool submitted = false;
+    uint64_t submitted_frame = 0; // frame_index of the last submit of this slot, done belongs to it
+
+    vk::UniqueDescriptorSet descrset;
+    vk::DeviceSize uniform_offset = 0;
+    // version of the texture binding written in descrset
+    uint64_t texture_version = 0;
+};
+
+struct FrameStats
+{
+    uint64_t frames = 0;
+    double frame_ms = 0; // between the starts of two frames
+    double wait_ms = 0;  // blocked on the timeline point of the slot
+    double gpu_ms = 0;   // timestamps around the command buffer
+    uint64_t gpu_frames = 0;
+
+    void report(std::ostream& os, uint32_t frames_in_flight) const;
+};
+
+// Ring of frames_in_flight frames: the CPU records frame N while the GPU still runs up to
+// N - frames_in_flight + 1, present waits on the render semaphore instead of the queue going idle.
+struct FrameRing
+{
+    Device& device;
+    std::vector<Frame> frames;
+    CommandPoolRing pools; // thread 0 is the render thread
+    vk::UniqueQueryPool timestamps; // 2 per frame, null when the queue has no timestamps
+    float timestamp_period = 1.f;
+    uint64_t frame_index = 0;
+    uint64_t completed = 0; // one past the last submitted frame begin() waited for
+    FrameStats stats;
+    std::chrono::steady_clock::time_point last_begin;
+
+    FrameRing(Device& device, uint32_t frames_in_flight = 2, uint32_t threads = 1);
+
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    // Waits for the slot of frame_index to be free, resets its command pools and starts recording its command buffer.
+    Frame& begin();
+    // Frames the GPU is known to have finished, every frame before this index is done. Skipped
+    // frames submit nothing, so only the slots whose last submit was waited for count.
+    uint64_t completed_frames() const;
+    // Acquires the next swapchain image, false when there is none to draw to this frame.
+    bool acquire(Frame& frame, uint32_t& image_index);
+    // Ends the command buffer, submits it and presents image_index, then moves to the next frame.
+    // waits are GPU work the frame consumes, uploads or compute on other queues.
+    void submit(Frame& frame, uint32_t image_index, const std::vector<GpuScheduler::Wait>& waits = {});
+    // Moves to the next frame without submitting, the command buffer is left to the pool reset.
+    void skip(Frame& frame);
+};
@@ -0,0 +1,200 @@
+#include "frustum.h"
+#include "jobs.h"
+#include "pixel.h"
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define FRUSTUM_TARGET(features)
+#else
+#define FRUSTUM_TARGET(features) __attribute__((target(features)))
+#endif
+
+void CullVolumes::clear()
+{
+    for (auto* field : { &sphere_x, &sphere_y, &sphere_z, &sphere_radius,
+        &box_x, &box_y, &box_z, &box_extent_x, &box_extent_y, &box_extent_z })
+        field->clear();
+    count = 0;
+}
+
+uint32_t CullVolumes::add(const glm::vec4& sphere, const glm::vec3& box_min, const glm::vec3& box_max)
+{
+    uint32_t index = count++;
+    // a new group of 8, the loads of the last group never read past the end
+    if (index % 8 == 0)
+        for (auto* field : { &sphere_x, &sphere_y, &sphere_z, &sphere_radius,
+            &box_x, &box_y, &box_z, &box_extent_x, &box_extent_y, &box_extent_z })
+            field->resize(index + 8, 0.f);
+    sphere_x[index] = sphere.x;
+    sphere_y[index] = sphere.y;
+    sphere_z[index] = sphere.z;
+    sphere_radius[index] = sphere.w;
+    glm::vec3 center = (box_min + box_max) * 0.5f;
+    glm::vec3 extent = (box_max - box_min) * 0.5f;
+    box_x[index] = center.x;
+    box_y[index] = center.y;
+    box_z[index] = center.z;
+    box_extent_x[index] = extent.x;
+    box_extent_y[index] = extent.y;
+    box_extent_z[index] = extent.z;
+    return index;
+}
+
+// Left packing: entry m lists the set lanes of the 8 bit mask m first
+struct PackTable
+{
+    alignas(32) uint32_t lanes[256][8];
+    uint8_t counts[256];
+
+    PackTable()
+    {
+        for (uint32_t mask = 0; mask < 256; mask++)
+        {
+            uint32_t n = 0;
+            for (uint32_t lane = 0; lane < 8; lane++)
+                if (mask >> lane & 1)
+                    lanes[mask][n++] = lane;
+            counts[mask] = static_cast<uint8_t>(n);
+            while (n < 8)
+                lanes[mask][n++] = 0;
+        }
+    }
+};
+static const PackTable pack_table;
+
+// ---- scalar ----
+
+static uint32_t cull_scalar(const CullVolumes& volumes, const std::array<glm::vec4, 6>& planes,
+    uint32_t begin, uint32_t end, uint32_t* out)
+{
+    uint32_t n = 0;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        glm::vec3 center(volumes.sphere_x[i], volumes.sphere_y[i], volumes.sphere_z[i]);
+        float radius = volumes.sphere_radius[i];
+        bool inside = true;
+        bool crossing = false;
+        for (const glm::vec4& plane : planes)
+        {
+            float d = glm::dot(glm::vec3(plane), center) + plane.w;
+            if (d < -radius)
+            {
+                inside = false;
+                break;
+            }
+            crossing |= d < radius;
+        }
+        if (inside && crossing)
+        {
+            glm::vec3 box(volumes.box_x[i], volumes.box_y[i], volumes.box_z[i]);
+            glm::vec3 extent(volumes.box_extent_x[i], volumes.box_extent_y[i], volumes.box_extent_z[i]);
+            for (const glm::vec4& plane : planes)
+                if (glm::dot(glm::vec3(plane), box) + plane.w + glm::dot(glm::abs(glm::vec3(plane)), extent) < 0.f)
+                {
+                    inside = false;
+                    break;
+                }
+        }
+        if (inside)
+            out[n++] = i;
+    }
+    return n;
+}
+
+// ---- AVX2, 8 objects per step ----
+
+FRUSTUM_TARGET("avx2,fma")
+static uint32_t cull_avx2(const CullVolumes& volumes, const std::array<glm::vec4, 6>& planes,
+    uint32_t begin, uint32_t end, uint32_t* out)
+{
+    __m256 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    for (uint32_t p = 0; p < 6; p++)
+    {
+        nx[p] = _mm256_set1_ps(planes[p].x);
+        ny[p] = _mm256_set1_ps(planes[p].y);
+        nz[p] = _mm256_set1_ps(planes[p].z);
+        nw[p] = _mm256_set1_ps(planes[p].w);
+        ax[p] = _mm256_set1_ps(std::abs(planes[p].x));
+        ay[p] = _mm256_set1_ps(std::abs(planes[p].y));
+        az[p] = _mm256_set1_ps(std::abs(planes[p].z));
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    uint32_t n = 0;
+    for (uint32_t i = begin; i < end; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(volumes.sphere_x.data() + i);
+        __m256 y = _mm256_loadu_ps(volumes.sphere_y.data() + i);
+        __m256 z = _mm256_loadu_ps(volumes.sphere_z.data() + i);
+        __m256 r = _mm256_loadu_ps(volumes.sphere_radius.data() + i);
+        __m256 neg_r = _mm256_sub_ps(zero, r);
+        __m256 outside = zero;
+        __m256 crossing = zero;
+        for (uint32_t p = 0; p < 6; p++)
+        {
+            __m256 d = _mm256_fmadd_ps(nx[p], x, _mm256_fmadd_ps(ny[p], y, _mm256_fmadd_ps(nz[p], z, nw[p])));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, neg_r, _CMP_LT_OQ));
+            crossing = _mm256_or_ps(crossing, _mm256_cmp_ps(d, r, _CMP_LT_OQ));
+        }
+        uint32_t valid = end - i >= 8 ? 0xffu : (1u << (end - i)) - 1;
+        uint32_t inside = ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & valid;
+        // only groups with a sphere across a plane load their boxes
+        if (inside & static_cast<uint32_t>(_mm256_movemask_ps(crossing)))
+        {
+            __m256 bx = _mm256_loadu_ps(volumes.box_x.data() + i);
+            __m256 by = _mm256_loadu_ps(volumes.box_y.data() + i);
+            __m256 bz = _mm256_loadu_ps(volumes.box_z.data() + i);
+            __m256 ex = _mm256_loadu_ps(volumes.box_extent_x.data() + i);
+            __m256 ey = _mm256_loadu_ps(volumes.box_extent_y.data() + i);
+            __m256 ez = _mm256_loadu_ps(volumes.box_extent_z.data() + i);
+            __m256 box_outside = zero;
+            for (uint32_t p = 0; p < 6; p++)
+            {
+                __m256 d = _mm256_fmadd_ps(nx[p], bx, _mm256_fmadd_ps(ny[p], by, _mm256_fmadd_ps(nz[p], bz, nw[p])));
+                __m256 reach = _mm256_fmadd_ps(ax[p], ex, _mm256_fmadd_ps(ay[p], ey, _mm256_mul_ps(az[p], ez)));
+                box_outside = _mm256_or_ps(box_outside, _mm256_cmp_ps(_mm256_add_ps(d, reach), zero, _CMP_LT_OQ));
+            }
+            inside &= ~static_cast<uint32_t>(_mm256_movemask_ps(box_outside));
+        }
+        // the store always writes 8 indices, at most n + 8 <= i - begin + 8 so never past the chunk
+        __m256i lanes = _mm256_load_si256(reinterpret_cast<const __m256i*>(pack_table.lanes[inside]));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + n), _mm256_add_epi32(lanes, _mm256_set1_epi32(static_cast<int>(i))));
+        n += pack_table.counts[inside];
+    }
+    return n;
+}
+
+void FrustumCuller::cull(JobSystem& jobs, const CullVolumes& volumes, const glm::mat4& view_proj)
+{
+    uint32_t count = volumes.count;
+    uint32_t chunks = (count + chunk_size - 1) / chunk_size;
+    // the last group of the last chunk stores up to 7 indices past count
+    chunk_lists.resize(count + 8);
+    chunk_counts.resize(chunks);
+    chunk_offsets.resize(chunks);
+    std::array<glm::vec4, 6> planes = frustum_planes(view_proj);
+    bool avx2 = simd_level() == SimdLevel::AVX2;
+    parallel_for(jobs, 0, chunks, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t chunk = begin; chunk < end; chunk++)
+        {
+            uint32_t first = chunk * chunk_size;
+            uint32_t last = std::min<uint32_t>(first + chunk_size, count);
+            chunk_counts[chunk] = avx2 ? cull_avx2(volumes, planes, first, last, chunk_lists.data() + first)
+                : cull_scalar(volumes, planes, first, last, chunk_lists.data() + first);
+        }
+    });
+    uint32_t total = 0;
+    for (uint32_t chunk = 0; chunk < chunks; chunk++)
+    {
+        chunk_offsets[chunk] = total;
+        total += chunk_counts[chunk];
+    }
+    visible.resize(total);
+    parallel_for(jobs, 0, chunks, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t chunk = begin; chunk < end; chunk++)
+            if (chunk_counts[chunk] > 0)
+                memcpy(visible.data() + chunk_offsets[chunk], chunk_lists.data() + chunk * chunk_size,
+                    chunk_counts[chunk] * sizeof(uint32_t));
+    });
+}
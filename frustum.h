@@ -0,0 +1,62 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+struct JobSystem;
+
+// Planes of the clip volume of view_proj in world space (left, right, bottom, top, near, far),
+// Vulkan depth range [0, 1]. Normals point inside and are normalized, so dot(plane, vec4(p, 1))
+// is the signed distance of p.
+inline std::array<glm::vec4, 6> frustum_planes(const glm::mat4& view_proj)
+{
+    // glm is column major, the planes are sums of rows
+    glm::mat4 rows = glm::transpose(view_proj);
+    std::array<glm::vec4, 6> planes{
+        rows[3] + rows[0], rows[3] - rows[0],
+        rows[3] + rows[1], rows[3] - rows[1],
+        rows[2], rows[3] - rows[2],
+    };
+    for (glm::vec4& plane : planes)
+        plane /= glm::length(glm::vec3(plane));
+    return planes;
+}
+
+inline bool sphere_in_frustum(const std::array<glm::vec4, 6>& planes, const glm::vec3& center, float radius)
+{
+    for (const glm::vec4& plane : planes)
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+            return false;
+    return true;
+}
+
+// Bounding volumes of the objects to cull as structure of arrays, so 8 objects load with one
+// instruction per field. Every object has a sphere and an AABB (center and half extents): the
+// sphere settles most objects, the box is only read for the ones the sphere leaves crossing a
+// plane. The arrays are padded with zeros to whole groups of 8.
+struct CullVolumes
+{
+    std::vector<float> sphere_x, sphere_y, sphere_z, sphere_radius;
+    std::vector<float> box_x, box_y, box_z, box_extent_x, box_extent_y, box_extent_z;
+    uint32_t count = 0;
+
+    void clear();
+    // index of the object in FrustumCuller::visible
+    uint32_t add(const glm::vec4& sphere, const glm::vec3& box_min, const glm::vec3& box_max);
+};
+
+// Frustum culling of CullVolumes in parallel chunks, AVX2 tests 8 objects per step when
+// simd_level() allows it (pixel.h). Each chunk packs its visible indices in place, the lists are
+// then joined into visible, in increasing order.
+struct FrustumCuller
+{
+    static const uint32_t chunk_size = 16384; // multiple of 8
+
+    std::vector<uint32_t> visible;
+    std::vector<uint32_t> chunk_lists; // chunk c writes from c * chunk_size
+    std::vector<uint32_t> chunk_counts;
+    std::vector<uint32_t> chunk_offsets;
+
+    void cull(JobSystem& jobs, const CullVolumes& volumes, const glm::mat4& view_proj);
+};
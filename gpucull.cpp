@@ -0,0 +1,252 @@
+#include "gpucull.h"
+#include "frustum.h"
+#include "hiz.h"
+#include "resource.h"
+#include "device.h"
+#include "allocator.h"
+#include <algorithm>
+
+// uniforms of cull-comp.glsl, std140
+struct cull_params_t
+{
+    glm::vec4 planes[6];
+    glm::mat4 view_proj;
+    glm::vec2 pyramid_size;
+    uint32_t object_count;
+    uint32_t index_count;
+    uint32_t capacity;
+};
+
+// counts then params in the range of every frame slot
+static const vk::DeviceSize slot_params_offset = 0x100;
+static const vk::DeviceSize slot_size = 0x200;
+
+GpuCuller::GpuCuller(ResourceManager& rm, uint32_t capacity, uint32_t frames_in_flight)
+    : rm(rm), capacity(capacity), culled(frames_in_flight, false)
+{
+    if (!rm.device.draw_indirect_count)
+        throw std::runtime_error("GpuCuller: drawIndirectCount not supported");
+    vk::Device device = *rm.device.device;
+
+    auto create_buffer = [&](vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags flags,
+        vk::UniqueBuffer& buffer, std::shared_ptr<MemoryRef>& mem) {
+        vk::BufferCreateInfo buffer_info;
+        buffer_info.size = size;
+        buffer_info.usage = usage;
+        buffer = device.createBufferUnique(buffer_info);
+        mem = rm.memory.allocate(device.getBufferMemoryRequirements(*buffer), flags);
+        device.bindBufferMemory(*buffer, mem->chunk->device_memory, mem->chunk->offset);
+    };
+    // storage buffer offsets of every slot stay aligned
+    draws_slot_size = (sizeof(vk::DrawIndexedIndirectCommand) * capacity * 2 + 0xff) & ~vk::DeviceSize(0xff);
+    create_buffer(sizeof(gpu_object_t) * capacity, vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, objects, objects_mem);
+    create_buffer(draws_slot_size * frames_in_flight,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal, draws, draws_mem);
+    create_buffer(sizeof(uint32_t) * capacity, vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal, flags, flags_mem);
+    create_buffer(slot_size * frames_in_flight,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eUniformBuffer
+        | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, slots, slots_mem);
+
+    // the far plane everywhere: the nearest depth of an object is never behind it
+    no_occluders = rm.create_image2D(vk::Format::eR32Sfloat, 1, 1, 1);
+    rm.submit_once([&](vk::CommandBuffer cmd) {
+        vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+        vk::ImageMemoryBarrier barrier;
+        barrier.image = *no_occluders->texture;
+        barrier.subresourceRange = range;
+        barrier.srcAccessMask = {};
+        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.oldLayout = vk::ImageLayout::eUndefined;
+        barrier.newLayout = vk::ImageLayout::eGeneral;
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+            {}, nullptr, nullptr, barrier);
+        cmd.clearColorImage(*no_occluders->texture, vk::ImageLayout::eGeneral, vk::ClearColorValue(std::array{ 1.f, 1.f, 1.f, 1.f }), range);
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        barrier.oldLayout = vk::ImageLayout::eGeneral;
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+            {}, nullptr, nullptr, barrier);
+    });
+
+    std::vector<vk::DescriptorSetLayoutBinding> descrset_layout_bindings{
+        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1,
+            vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex),
+        vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding(4, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding(5, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute),
+    };
+    vk::DescriptorSetLayoutCreateInfo descrset_layout_info;
+    descrset_layout_info.setBindings(descrset_layout_bindings);
+    descrset_layout = device.createDescriptorSetLayoutUnique(descrset_layout_info);
+
+    vk::PushConstantRange push_range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(uint32_t));
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setSetLayouts(*descrset_layout);
+    pipeline_layout_info.setPushConstantRanges(push_range);
+    pipeline_layout = device.createPipelineLayoutUnique(pipeline_layout_info);
+
+    auto module = load_shader(rm.device.device, rm.read_file("shaders/cull-comp.glsl.spv"));
+    vk::ComputePipelineCreateInfo pipeline_info;
+    pipeline_info.stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, *module, "main");
+    pipeline_info.layout = *pipeline_layout;
+    pipeline = device.createComputePipelineUnique(nullptr, pipeline_info).value;
+
+    std::vector<vk::DescriptorPoolSize> descrpool_sizes{
+        vk::DescriptorPoolSize{vk::DescriptorType::eStorageBuffer, 4 * frames_in_flight},
+        vk::DescriptorPoolSize{vk::DescriptorType::eUniformBuffer, frames_in_flight},
+        vk::DescriptorPoolSize{vk::DescriptorType::eCombinedImageSampler, frames_in_flight},
+    };
+    vk::DescriptorPoolCreateInfo descrpool_info;
+    descrpool_info.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+    descrpool_info.maxSets = frames_in_flight;
+    descrpool_info.setPoolSizes(descrpool_sizes);
+    descrpool = device.createDescriptorPoolUnique(descrpool_info);
+
+    std::vector<vk::DescriptorSetLayout> descrset_layouts(frames_in_flight, *descrset_layout);
+    vk::DescriptorSetAllocateInfo descrset_info;
+    descrset_info.descriptorPool = *descrpool;
+    descrset_info.setSetLayouts(descrset_layouts);
+    descrsets = device.allocateDescriptorSetsUnique(descrset_info);
+    vk::DescriptorImageInfo pyramid_info(rm.sampler(), *no_occluders->view, vk::ImageLayout::eGeneral);
+    for (uint32_t slot = 0; slot < frames_in_flight; slot++)
+    {
+        vk::DescriptorBufferInfo objects_info(*objects, 0, VK_WHOLE_SIZE);
+        vk::DescriptorBufferInfo draws_info(*draws, draws_slot_size * slot, draws_slot_size);
+        vk::DescriptorBufferInfo counts_info(*slots, slot_size * slot, sizeof(gpu_cull_counts_t));
+        vk::DescriptorBufferInfo params_info(*slots, slot_size * slot + slot_params_offset, sizeof(cull_params_t));
+        vk::DescriptorBufferInfo flags_info(*flags, 0, VK_WHOLE_SIZE);
+        std::vector<vk::WriteDescriptorSet> descr_sets_write{
+            vk::WriteDescriptorSet(*descrsets[slot], 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &objects_info, nullptr),
+            vk::WriteDescriptorSet(*descrsets[slot], 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &draws_info, nullptr),
+            vk::WriteDescriptorSet(*descrsets[slot], 2, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &counts_info, nullptr),
+            vk::WriteDescriptorSet(*descrsets[slot], 3, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &params_info, nullptr),
+            vk::WriteDescriptorSet(*descrsets[slot], 4, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &flags_info, nullptr),
+            vk::WriteDescriptorSet(*descrsets[slot], 5, 0, 1, vk::DescriptorType::eCombinedImageSampler, &pyramid_info, nullptr, nullptr),
+        };
+        device.updateDescriptorSets(descr_sets_write, nullptr);
+    }
+}
+
+void GpuCuller::upload(const std::vector<gpu_object_t>& new_objects)
+{
+    if (new_objects.size() > capacity)
+        throw std::runtime_error("GpuCuller::upload more objects than capacity");
+    object_count = static_cast<uint32_t>(new_objects.size());
+    if (object_count == 0)
+        return;
+    if (auto map = objects_mem->map<gpu_object_t>(0, sizeof(gpu_object_t) * object_count))
+        std::copy(new_objects.begin(), new_objects.end(), map.ptr);
+}
+
+void GpuCuller::set_pyramid(DepthPyramid& new_pyramid)
+{
+    pyramid = &new_pyramid;
+    vk::DescriptorImageInfo pyramid_info(*pyramid->sampler, *pyramid->image->view, vk::ImageLayout::eGeneral);
+    for (auto& descrset : descrsets)
+    {
+        vk::WriteDescriptorSet write(*descrset, 5, 0, 1, vk::DescriptorType::eCombinedImageSampler, &pyramid_info, nullptr, nullptr);
+        rm.device.device->updateDescriptorSets(write, nullptr);
+    }
+}
+
+void GpuCuller::cull(vk::CommandBuffer cmd, uint32_t slot, const glm::mat4& view_proj, uint32_t index_count)
+{
+    if (auto map = slots_mem->map(slot_size * slot + slot_params_offset, sizeof(cull_params_t)))
+    {
+        cull_params_t& params = *reinterpret_cast<cull_params_t*>(map.ptr);
+        auto planes = frustum_planes(view_proj);
+        std::copy(planes.begin(), planes.end(), params.planes);
+        params.view_proj = view_proj;
+        params.pyramid_size = pyramid ? glm::vec2(pyramid->width, pyramid->height) : glm::vec2(1.f);
+        params.object_count = object_count;
+        params.index_count = index_count;
+        params.capacity = capacity;
+    }
+
+    // also orders the flags and pyramid accesses of the previous frame before this one
+    cmd.fillBuffer(*slots, slot_size * slot, sizeof(gpu_cull_counts_t), 0);
+    vk::MemoryBarrier clear_barrier(vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eComputeShader, {}, clear_barrier, nullptr, nullptr);
+
+    uint32_t late = 0;
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *pipeline_layout, 0, *descrsets[slot], nullptr);
+    cmd.pushConstants(*pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(late), &late);
+    if (object_count > 0)
+        cmd.dispatch((object_count + 63) / 64, 1, 1);
+
+    // the count is read by the indirect draw and by counts() on the host, the flags by cull_late()
+    vk::MemoryBarrier cull_barrier(vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eHostRead | vk::AccessFlagBits::eShaderRead);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eHost | vk::PipelineStageFlagBits::eComputeShader,
+        {}, cull_barrier, nullptr, nullptr);
+    culled[slot] = true;
+}
+
+void GpuCuller::cull_late(vk::CommandBuffer cmd, uint32_t slot)
+{
+    uint32_t late = 1;
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *pipeline_layout, 0, *descrsets[slot], nullptr);
+    cmd.pushConstants(*pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(late), &late);
+    if (object_count > 0)
+        cmd.dispatch((object_count + 63) / 64, 1, 1);
+    vk::MemoryBarrier cull_barrier(vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eHostRead);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eHost,
+        {}, cull_barrier, nullptr, nullptr);
+}
+
+void GpuCuller::draw(vk::CommandBuffer cmd, uint32_t slot)
+{
+    cmd.drawIndexedIndirectCount(*draws, draws_slot_size * slot, *slots, slot_size * slot + offsetof(gpu_cull_counts_t, drawn),
+        capacity, sizeof(vk::DrawIndexedIndirectCommand));
+}
+
+void GpuCuller::draw_late(vk::CommandBuffer cmd, uint32_t slot)
+{
+    cmd.drawIndexedIndirectCount(*draws, draws_slot_size * slot + sizeof(vk::DrawIndexedIndirectCommand) * capacity,
+        *slots, slot_size * slot + offsetof(gpu_cull_counts_t, drawn_late), capacity, sizeof(vk::DrawIndexedIndirectCommand));
+}
+
+gpu_cull_counts_t GpuCuller::counts(uint32_t slot)
+{
+    if (auto map = slots_mem->map(slot_size * slot, sizeof(gpu_cull_counts_t)))
+        return *reinterpret_cast<gpu_cull_counts_t*>(map.ptr);
+    return {};
+}
+
+void GpuCuller::collect(uint32_t slot)
+{
+    if (!culled[slot])
+        return;
+    culled[slot] = false;
+    gpu_cull_counts_t frame = counts(slot);
+    frames++;
+    total_objects += object_count;
+    total_drawn += frame.drawn;
+    total_drawn_late += frame.drawn_late;
+    total_frustum_culled += frame.frustum_culled;
+    total_occluded += frame.occluded;
+}
+
+void GpuCuller::report(std::ostream& os) const
+{
+    if (frames == 0 || total_objects == 0)
+        return;
+    auto percent = [&](uint64_t count) { return 100.0 * count / total_objects; };
+    os << "GpuCuller: " << object_count << " objects, " << frames << " frames\n"
+        << "  drawn " << percent(total_drawn) << "% + " << percent(total_drawn_late) << "% late"
+        << ", frustum culled " << percent(total_frustum_culled) << "%"
+        << ", occluded " << percent(total_occluded - total_drawn_late) << "%\n";
+}
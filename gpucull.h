@@ -0,0 +1,98 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+struct ResourceManager;
+struct MemoryRef;
+struct ImageResource;
+struct DepthPyramid;
+
+// Object of a GPU culled draw list, read by cull-comp.glsl and the color-indirect vertex shader.
+// The mesh spans [-1, 1] on every axis and is scaled, turned around z, then moved to position.
+struct gpu_object_t
+{
+    glm::vec4 sphere;   // world space bounding sphere: center, radius
+    glm::vec4 position; // xyz, rotation around z in w
+    glm::vec4 scale;    // xyz half extents
+    glm::vec4 tint;
+};
+
+// Counters written by the culling passes of one frame.
+struct gpu_cull_counts_t
+{
+    uint32_t drawn;          // visible in the first pass
+    uint32_t drawn_late;     // hidden in the first pass, visible against the new pyramid
+    uint32_t frustum_culled;
+    uint32_t occluded;       // hidden in the first pass, drawn_late of them recovered
+};
+
+// GPU driven draws of one mesh: every object is tested against the view frustum by a compute pass
+// that packs the survivors into VkDrawIndexedIndirectCommands and counts them, the graphics pass
+// draws them with one drawIndexedIndirectCount. The CPU records the same few commands whatever
+// the number of objects. Draws, counts and parameters have a range per frame slot.
+//
+// With a depth pyramid the first pass also drops objects hidden behind the previous frame's depth.
+// The camera moved since, so after the first draws the pyramid is rebuilt from the new depth and
+// cull_late() tests the hidden objects again: the ones visible now are drawn by draw_late().
+struct GpuCuller
+{
+    ResourceManager& rm;
+    uint32_t capacity;
+    uint32_t object_count = 0;
+
+    vk::UniqueBuffer objects; // host visible, written by upload()
+    std::shared_ptr<MemoryRef> objects_mem;
+    vk::UniqueBuffer draws;   // device local, capacity commands per pass and frame slot
+    std::shared_ptr<MemoryRef> draws_mem;
+    vk::DeviceSize draws_slot_size;
+    vk::UniqueBuffer flags;   // device local, one uint per object: hidden in the first pass
+    std::shared_ptr<MemoryRef> flags_mem;
+    // per frame slot: gpu_cull_counts_t, then the cull_params_t uniforms. Host visible
+    vk::UniqueBuffer slots;
+    std::shared_ptr<MemoryRef> slots_mem;
+    // 1x1 far plane image standing in for the pyramid when there is none, nothing is ever hidden
+    std::shared_ptr<ImageResource> no_occluders;
+    DepthPyramid* pyramid = nullptr;
+
+    // set 1 of the graphics pipeline layout too, its vertex shader reads objects at binding 0
+    vk::UniqueDescriptorSetLayout descrset_layout;
+    vk::UniquePipelineLayout pipeline_layout;
+    vk::UniquePipeline pipeline;
+    vk::UniqueDescriptorPool descrpool;
+    std::vector<vk::UniqueDescriptorSet> descrsets; // one per frame slot
+
+    // totals of the frames passed to collect()
+    std::vector<bool> culled; // slot has counts not collected yet
+    uint64_t frames = 0;
+    uint64_t total_objects = 0;
+    uint64_t total_drawn = 0;
+    uint64_t total_drawn_late = 0;
+    uint64_t total_frustum_culled = 0;
+    uint64_t total_occluded = 0;
+
+    // needs Device::draw_indirect_count
+    GpuCuller(ResourceManager& rm, uint32_t capacity, uint32_t frames_in_flight);
+
+    GpuCuller(const GpuCuller&) = delete;
+    GpuCuller& operator=(const GpuCuller&) = delete;
+
+    // No frame using the objects may be in flight.
+    void upload(const std::vector<gpu_object_t>& new_objects);
+    // Enables the occlusion test against new_pyramid. No frame may be in flight.
+    void set_pyramid(DepthPyramid& new_pyramid);
+    // Outside a render pass: fills the draws of slot with the objects visible from view_proj.
+    void cull(vk::CommandBuffer cmd, uint32_t slot, const glm::mat4& view_proj, uint32_t index_count);
+    // Outside a render pass, after cull() and the pyramid build: the hidden objects visible now.
+    void cull_late(vk::CommandBuffer cmd, uint32_t slot);
+    // Inside the render pass, with the pipeline, mesh buffers and set 1 (descrsets[slot]) bound.
+    void draw(vk::CommandBuffer cmd, uint32_t slot);
+    void draw_late(vk::CommandBuffer cmd, uint32_t slot);
+    // Counts of the last cull of slot, valid once its frame completed.
+    gpu_cull_counts_t counts(uint32_t slot);
+    // Adds the counts of slot to the totals, call once its frame completed.
+    void collect(uint32_t slot);
+    void report(std::ostream& os) const;
+};
@@ -0,0 +1,136 @@
+#include "hiz.h"
+#include "resource.h"
+#include "device.h"
+#include <algorithm>
+
+static uint32_t next_power_of_two(uint32_t value)
+{
+    uint32_t power = 1;
+    while (power < value)
+        power *= 2;
+    return power;
+}
+
+DepthPyramid::DepthPyramid(ResourceManager& rm, vk::ImageView depth_view, uint32_t depth_width, uint32_t depth_height)
+    : rm(rm)
+{
+    if (!rm.device.sampler_minmax)
+        throw std::runtime_error("DepthPyramid: samplerFilterMinmax not supported");
+    vk::Device device = *rm.device.device;
+    width = next_power_of_two(depth_width);
+    height = next_power_of_two(depth_height);
+    levels = 1;
+    while ((std::max<uint32_t>(width, height) >> levels) > 0)
+        levels++;
+
+    image = rm.create_image2D(vk::Format::eR32Sfloat, width, height, levels, 1, vk::ImageViewType::e2D,
+        vk::ImageUsageFlagBits::eStorage);
+    for (uint32_t level = 0; level < levels; level++)
+    {
+        vk::ImageViewCreateInfo view_info;
+        view_info.image = *image->texture;
+        view_info.viewType = vk::ImageViewType::e2D;
+        view_info.format = vk::Format::eR32Sfloat;
+        view_info.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1);
+        level_views.push_back(device.createImageViewUnique(view_info));
+    }
+
+    vk::SamplerReductionModeCreateInfo reduction_info(vk::SamplerReductionMode::eMax);
+    vk::SamplerCreateInfo sampler_info;
+    sampler_info.pNext = &reduction_info;
+    sampler_info.minFilter = vk::Filter::eLinear;
+    sampler_info.magFilter = vk::Filter::eLinear;
+    sampler_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    sampler_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    sampler_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    sampler_info.minLod = 0.f;
+    sampler_info.maxLod = (float)levels;
+    sampler = device.createSamplerUnique(sampler_info);
+
+    std::vector<vk::DescriptorSetLayoutBinding> descrset_layout_bindings{
+        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute),
+    };
+    vk::DescriptorSetLayoutCreateInfo descrset_layout_info;
+    descrset_layout_info.setBindings(descrset_layout_bindings);
+    descrset_layout = device.createDescriptorSetLayoutUnique(descrset_layout_info);
+
+    vk::PushConstantRange push_range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(uint32_t) * 2);
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setSetLayouts(*descrset_layout);
+    pipeline_layout_info.setPushConstantRanges(push_range);
+    pipeline_layout = device.createPipelineLayoutUnique(pipeline_layout_info);
+
+    auto module = load_shader(rm.device.device, rm.read_file("shaders/hiz-comp.glsl.spv"));
+    vk::ComputePipelineCreateInfo pipeline_info;
+    pipeline_info.stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, *module, "main");
+    pipeline_info.layout = *pipeline_layout;
+    pipeline = device.createComputePipelineUnique(nullptr, pipeline_info).value;
+
+    std::vector<vk::DescriptorPoolSize> descrpool_sizes{
+        vk::DescriptorPoolSize{vk::DescriptorType::eCombinedImageSampler, levels},
+        vk::DescriptorPoolSize{vk::DescriptorType::eStorageImage, levels},
+    };
+    vk::DescriptorPoolCreateInfo descrpool_info;
+    descrpool_info.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+    descrpool_info.maxSets = levels;
+    descrpool_info.setPoolSizes(descrpool_sizes);
+    descrpool = device.createDescriptorPoolUnique(descrpool_info);
+
+    std::vector<vk::DescriptorSetLayout> descrset_layouts(levels, *descrset_layout);
+    vk::DescriptorSetAllocateInfo descrset_info;
+    descrset_info.descriptorPool = *descrpool;
+    descrset_info.setSetLayouts(descrset_layouts);
+    descrsets = device.allocateDescriptorSetsUnique(descrset_info);
+    for (uint32_t level = 0; level < levels; level++)
+    {
+        vk::DescriptorImageInfo src_info(*sampler, level == 0 ? depth_view : *level_views[level - 1],
+            level == 0 ? vk::ImageLayout::eDepthStencilReadOnlyOptimal : vk::ImageLayout::eGeneral);
+        vk::DescriptorImageInfo dst_info(nullptr, *level_views[level], vk::ImageLayout::eGeneral);
+        std::vector<vk::WriteDescriptorSet> descr_sets_write{
+            vk::WriteDescriptorSet(*descrsets[level], 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &src_info, nullptr, nullptr),
+            vk::WriteDescriptorSet(*descrsets[level], 1, 0, 1, vk::DescriptorType::eStorageImage, &dst_info, nullptr, nullptr),
+        };
+        device.updateDescriptorSets(descr_sets_write, nullptr);
+    }
+
+    // far everywhere until the first build
+    rm.submit_once([&](vk::CommandBuffer cmd) {
+        vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1);
+        vk::ImageMemoryBarrier barrier;
+        barrier.image = *image->texture;
+        barrier.subresourceRange = range;
+        barrier.srcAccessMask = {};
+        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.oldLayout = vk::ImageLayout::eUndefined;
+        barrier.newLayout = vk::ImageLayout::eGeneral;
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+            {}, nullptr, nullptr, barrier);
+        cmd.clearColorImage(*image->texture, vk::ImageLayout::eGeneral, vk::ClearColorValue(std::array{ 1.f, 1.f, 1.f, 1.f }), range);
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        barrier.oldLayout = vk::ImageLayout::eGeneral;
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+            {}, nullptr, nullptr, barrier);
+    });
+}
+
+void DepthPyramid::build(vk::CommandBuffer cmd)
+{
+    // earlier culling passes must be done reading before the levels are overwritten
+    vk::MemoryBarrier reads_done(vk::AccessFlagBits::eShaderRead, vk::AccessFlagBits::eShaderWrite);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+        {}, reads_done, nullptr, nullptr);
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+    vk::MemoryBarrier level_done(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+    for (uint32_t level = 0; level < levels; level++)
+    {
+        uint32_t size[2] = { std::max<uint32_t>(width >> level, 1), std::max<uint32_t>(height >> level, 1) };
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *pipeline_layout, 0, *descrsets[level], nullptr);
+        cmd.pushConstants(*pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(size), size);
+        cmd.dispatch((size[0] + 7) / 8, (size[1] + 7) / 8, 1);
+        // the next level reads this one, after the last one the culling pass does
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+            {}, level_done, nullptr, nullptr);
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <memory>
+#include <vector>
+
+struct ResourceManager;
+struct ImageResource;
+
+// Hierarchical Z: mip chain of the farthest depth under every texel of a depth buffer. Level 0 is
+// the depth size rounded up to powers of two, so each of its texels covers at most one depth texel
+// per axis and the 2x2 footprint of a max reduction fetch never misses one. A box whose nearest
+// depth is behind the pyramid value over its screen rectangle is hidden.
+struct DepthPyramid
+{
+    ResourceManager& rm;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    std::shared_ptr<ImageResource> image; // R32Sfloat, in eGeneral for its whole life
+    std::vector<vk::UniqueImageView> level_views;
+    // linear filter with max reduction
+    vk::UniqueSampler sampler;
+
+    vk::UniqueDescriptorSetLayout descrset_layout;
+    vk::UniquePipelineLayout pipeline_layout;
+    vk::UniquePipeline pipeline;
+    vk::UniqueDescriptorPool descrpool;
+    std::vector<vk::UniqueDescriptorSet> descrsets; // level i reads level i - 1, level 0 the depth
+
+    // Needs Device::sampler_minmax. depth_view is sampled in eDepthStencilReadOnlyOptimal. The pyramid
+    // starts at the far plane, nothing is hidden until the first build.
+    DepthPyramid(ResourceManager& rm, vk::ImageView depth_view, uint32_t depth_width, uint32_t depth_height);
+
+    DepthPyramid(const DepthPyramid&) = delete;
+    DepthPyramid& operator=(const DepthPyramid&) = delete;
+
+    // Outside a render pass, after the depth writes were made visible to compute shaders (the
+    // render pass external dependency). Leaves the pyramid readable by compute shaders.
+    void build(vk::CommandBuffer cmd);
+};
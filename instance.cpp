@@ -0,0 +1,62 @@
+#include "instance.h"
+#include "resource.h"
+#include "device.h"
+#include "allocator.h"
+#include "jobs.h"
+#include <algorithm>
+#include <cmath>
+
+vk::VertexInputBindingDescription instance_input_binding(uint32_t binding)
+{
+    return vk::VertexInputBindingDescription(binding, sizeof(instance_t), vk::VertexInputRate::eInstance);
+}
+
+std::vector<vk::VertexInputAttributeDescription> instance_input_attributes(uint32_t binding, uint32_t first_location)
+{
+    return {
+        vk::VertexInputAttributeDescription(first_location, binding, vk::Format::eR32G32B32A32Sfloat, offsetof(instance_t, transform)),
+        vk::VertexInputAttributeDescription(first_location + 1, binding, vk::Format::eR32G32B32A32Sfloat, offsetof(instance_t, tint)),
+    };
+}
+
+InstanceBuffer::InstanceBuffer(ResourceManager& rm, uint32_t capacity, uint32_t frames)
+    : rm(rm), capacity(capacity)
+{
+    vk::BufferCreateInfo buffer_info;
+    buffer_info.size = sizeof(instance_t) * capacity * frames;
+    buffer_info.usage = vk::BufferUsageFlagBits::eVertexBuffer;
+    buffer = rm.device.device->createBufferUnique(buffer_info);
+    mem = rm.memory.allocate(rm.device.device->getBufferMemoryRequirements(*buffer),
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    rm.device.device->bindBufferMemory(*buffer, mem->chunk->device_memory, mem->chunk->offset);
+    instances.reserve(capacity);
+}
+
+void InstanceBuffer::grid(uint32_t count, float rotation)
+{
+    instances.resize(count);
+    if (count == 0)
+        return;
+    uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt((float)count)));
+    float cell = 2.f / columns;
+    parallel_for(*rm.jobs, 0, count, 4096, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            glm::vec2 center(-1.f + cell * (i % columns + 0.5f), -1.f + cell * (i / columns + 0.5f));
+            float hue = (i % 64) / 64.f;
+            instances[i] = { glm::vec4(center, cell, rotation + hue * 0.5f), glm::vec4(1.f, hue, 1.f - hue, 1.f) };
+        }
+    });
+}
+
+vk::DeviceSize InstanceBuffer::upload(uint32_t slot)
+{
+    if (instances.size() > capacity)
+        throw std::runtime_error("InstanceBuffer::upload more instances than capacity");
+    vk::DeviceSize offset = sizeof(instance_t) * capacity * slot;
+    if (instances.empty())
+        return offset;
+    if (auto map = mem->map(offset, sizeof(instance_t) * instances.size()))
+        std::copy(instances.begin(), instances.end(), reinterpret_cast<instance_t*>(map.ptr));
+    return offset;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+struct ResourceManager;
+struct MemoryRef;
+
+// Per instance attributes of color-instanced-vert.glsl, read with eInstance input rate.
+struct instance_t
+{
+    glm::vec4 transform; // x, y, scale, rotation in radians
+    glm::vec4 tint;
+};
+
+// Binding and attributes to append to the vertex input of a pipeline drawing instance_t.
+vk::VertexInputBindingDescription instance_input_binding(uint32_t binding);
+std::vector<vk::VertexInputAttributeDescription> instance_input_attributes(uint32_t binding, uint32_t first_location);
+
+// Instances built on the CPU every frame and copied into the range of the frame slot in one
+// host visible vertex buffer, a frame the GPU is still drawing is never overwritten.
+struct InstanceBuffer
+{
+    ResourceManager& rm;
+    uint32_t capacity; // instances per frame slot
+    vk::UniqueBuffer buffer;
+    std::shared_ptr<MemoryRef> mem;
+    std::vector<instance_t> instances;
+
+    InstanceBuffer(ResourceManager& rm, uint32_t capacity, uint32_t frames);
+
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    void clear() { instances.clear(); }
+    void add(glm::vec2 position, float scale, float rotation, glm::vec4 tint = glm::vec4(1.f))
+    {
+        instances.push_back({ glm::vec4(position, scale, rotation), tint });
+    }
+    // Replaces the instances with count cells of a square grid over clip space, filled on rm.jobs.
+    // Every instance is turned by rotation plus a small offset of its own.
+    void grid(uint32_t count, float rotation);
+    // Copies the instances into the range of slot and returns its offset to bind. Throws past capacity.
+    vk::DeviceSize upload(uint32_t slot);
+    uint32_t size() const { return static_cast<uint32_t>(instances.size()); }
+};
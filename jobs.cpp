@@ -0,0 +1,223 @@
+#include "jobs.h"
+#include <algorithm>
+
+// worker of the system the calling thread belongs to
+static thread_local const JobSystem* current_system = nullptr;
+static thread_local int current_index = -1;
+
+JobSystem::JobSystem(uint32_t thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max<uint32_t>(std::thread::hardware_concurrency(), 1);
+    for (uint32_t i = 0; i < thread_count; i++)
+        workers.push_back(std::make_unique<Worker>());
+    outer_system = current_system;
+    outer_index = current_index;
+    current_system = this;
+    current_index = 0;
+    for (uint32_t i = 1; i < thread_count; i++)
+        threads.emplace_back(&JobSystem::worker, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+    Job* job;
+    for (auto& worker : workers)
+        while (worker->deque.steal(job))
+            delete job;
+    for (Job* job : injected)
+        delete job;
+    if (current_system == this)
+    {
+        current_system = outer_system;
+        current_index = outer_index;
+    }
+}
+
+int JobSystem::worker_index() const
+{
+    return current_system == this ? current_index : -1;
+}
+
+void JobSystem::run(std::function<void()> fn, JobCounter* counter)
+{
+    if (counter)
+        counter->value.fetch_add(1, std::memory_order_relaxed);
+    push(new Job{ std::move(fn), counter });
+}
+
+void JobSystem::run_after(JobCounter& after, std::function<void()> fn, JobCounter* counter)
+{
+    if (counter)
+        counter->value.fetch_add(1, std::memory_order_relaxed);
+    Job* job = new Job{ std::move(fn), counter };
+    {
+        // execute() takes the continuations under the same lock once the value hit zero
+        std::lock_guard<std::mutex> lock(after.mutex);
+        if (after.value.load() != 0)
+        {
+            after.continuations.push_back(job);
+            return;
+        }
+    }
+    push(job);
+}
+
+void JobSystem::push(Job* job)
+{
+    int index = worker_index();
+    if (index >= 0)
+        workers[index]->deque.push(job);
+    else
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        injected.push_back(job);
+        injected_count++;
+    }
+    queued.fetch_add(1);
+    if (sleeping.load() > 0)
+    {
+        // a worker past its check is either blocked or still holds the mutex
+        { std::lock_guard<std::mutex> lock(mutex); }
+        cv.notify_one();
+    }
+}
+
+Job* JobSystem::find_job(int index)
+{
+    Job* job = nullptr;
+    if (index >= 0 && workers[index]->deque.pop(job))
+    {
+        queued.fetch_sub(1);
+        return job;
+    }
+    if (injected_count.load(std::memory_order_relaxed) > 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!injected.empty())
+        {
+            job = injected.front();
+            injected.pop_front();
+            injected_count--;
+            queued.fetch_sub(1);
+            return job;
+        }
+    }
+    // start the victim search at a different worker every time
+    static thread_local uint32_t seed = 0x9e3779b9u ^ static_cast<uint32_t>(index + 1);
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    uint32_t count = thread_count();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t victim = (seed + i) % count;
+        if (static_cast<int>(victim) != index && workers[victim]->deque.steal(job))
+        {
+            queued.fetch_sub(1);
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void JobSystem::execute(Job* job)
+{
+    job->fn();
+    JobCounter* counter = job->counter;
+    delete job;
+    executed.fetch_add(1, std::memory_order_relaxed);
+    if (!counter)
+        return;
+    std::vector<Job*> next;
+    counter->busy.fetch_add(1);
+    if (counter->value.fetch_sub(1) == 1)
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        next.swap(counter->continuations);
+    }
+    counter->busy.fetch_sub(1);
+    for (Job* continuation : next)
+        push(continuation);
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+    int index = worker_index();
+    while (!counter.done())
+    {
+        if (Job* job = find_job(index))
+            execute(job);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void JobSystem::worker(uint32_t index)
+{
+    current_system = this;
+    current_index = static_cast<int>(index);
+    while (!stopping.load())
+    {
+        if (Job* job = find_job(index))
+        {
+            execute(job);
+            continue;
+        }
+        // queued jobs the steals missed are being popped right now, try again soon
+        if (queued.load() > 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping++;
+        cv.wait(lock, [this] { return stopping.load() || queued.load() > 0; });
+        sleeping--;
+    }
+}
+
+void parallel_for(JobSystem& jobs, uint32_t begin, uint32_t end, uint32_t grain,
+    const std::function<void(uint32_t, uint32_t)>& fn)
+{
+    if (begin >= end)
+        return;
+    if (grain == 0)
+        grain = std::max<uint32_t>((end - begin + jobs.thread_count() * 4 - 1) / (jobs.thread_count() * 4), 1);
+
+    JobCounter counter;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto run_chunk = [&](uint32_t chunk_begin, uint32_t chunk_end) {
+        try
+        {
+            fn(chunk_begin, chunk_end);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+    };
+    // the calling thread keeps the first chunk, the others can be stolen meanwhile
+    uint32_t first_end = begin + std::min<uint32_t>(grain, end - begin);
+    for (uint64_t chunk = first_end; chunk < end; chunk += grain)
+    {
+        uint32_t chunk_begin = static_cast<uint32_t>(chunk);
+        uint32_t chunk_end = static_cast<uint32_t>(std::min<uint64_t>(chunk + grain, end));
+        jobs.run([&run_chunk, chunk_begin, chunk_end] { run_chunk(chunk_begin, chunk_end); }, &counter);
+    }
+    run_chunk(begin, first_end);
+    jobs.wait(counter);
+    if (error)
+        std::rethrow_exception(error);
+}
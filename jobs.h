@@ -0,0 +1,171 @@
+#pragma once
+#include "executor.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+
+// Chase-Lev work stealing deque, with the memory orders of Le et al. "Correct and Efficient
+// Work-Stealing for Weak Memory Models". The owner thread pushes and pops at the bottom,
+// any thread steals from the top. T must be trivially copyable.
+template <typename T>
+struct WorkStealingDeque
+{
+    struct Array
+    {
+        int64_t capacity; // power of 2
+        std::unique_ptr<std::atomic<T>[]> items;
+
+        Array(int64_t capacity) : capacity(capacity), items(new std::atomic<T>[capacity]) {}
+        T get(int64_t i) const { return items[i & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t i, T item) { items[i & (capacity - 1)].store(item, std::memory_order_relaxed); }
+    };
+
+    std::atomic<int64_t> top{ 0 };
+    std::atomic<int64_t> bottom{ 0 };
+    std::atomic<Array*> array;
+    // outgrown arrays live as long as the deque, a thief may still be reading one
+    std::vector<std::unique_ptr<Array>> arrays;
+
+    WorkStealingDeque(int64_t capacity = 256)
+    {
+        arrays.push_back(std::make_unique<Array>(capacity));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // owner only
+    void push(T item)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array* a = array.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1)
+        {
+            auto bigger = std::make_unique<Array>(a->capacity * 2);
+            for (int64_t i = t; i < b; i++)
+                bigger->put(i, a->get(i));
+            a = bigger.get();
+            arrays.push_back(std::move(bigger));
+            array.store(a, std::memory_order_release);
+        }
+        a->put(b, item);
+        // release store instead of the paper's release fence, same ordering and visible to TSan
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // owner only
+    bool pop(T& item)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = a->get(b);
+        if (t < b)
+            return true;
+        // last item, the thieves race for it too
+        bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    bool steal(T& item)
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return false;
+        Array* a = array.load(std::memory_order_acquire);
+        item = a->get(t);
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+};
+
+struct Job;
+
+// Jobs still running that were started with this counter. Jobs started with run_after(counter)
+// are held until it drops to zero.
+struct JobCounter
+{
+    std::atomic<int64_t> value{ 0 };
+    // jobs between their decrement and their last touch of the counter, a waiter may destroy it
+    // only once both are zero
+    std::atomic<int64_t> busy{ 0 };
+    std::mutex mutex;
+    std::vector<Job*> continuations;
+
+    bool done() const { return value.load() == 0 && busy.load() == 0; }
+};
+
+struct Job
+{
+    std::function<void()> fn;
+    JobCounter* counter;
+};
+
+// Work stealing scheduler with one worker per core, the thread creating it is worker 0 and
+// runs jobs while it waits on a counter. Jobs started on a worker go to its own deque, idle
+// workers steal from the others; threads outside the system go through a shared queue.
+// Job functions must not throw, parallel_for forwards exceptions to the caller.
+struct JobSystem : public Executor
+{
+    struct Worker
+    {
+        WorkStealingDeque<Job*> deque;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Job*> injected;           // under mutex
+    std::atomic<int64_t> injected_count{ 0 };
+    std::atomic<int64_t> queued{ 0 };    // jobs pushed and not taken yet
+    std::atomic<uint32_t> sleeping{ 0 };
+    std::atomic<bool> stopping{ false };
+
+    std::atomic<uint64_t> executed{ 0 };
+    std::atomic<uint64_t> steals{ 0 };
+    // system the creating thread belonged to before, restored by the destructor
+    const JobSystem* outer_system;
+    int outer_index;
+
+    // 0 threads is one per core, the creating thread included
+    JobSystem(uint32_t thread_count = 0);
+    // Jobs still queued are dropped.
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    uint32_t thread_count() const { return static_cast<uint32_t>(workers.size()); }
+    // counter, when given, counts fn as running until it returned
+    void run(std::function<void()> fn, JobCounter* counter = nullptr);
+    // Starts fn once after reached zero, counter counts it from now on.
+    void run_after(JobCounter& after, std::function<void()> fn, JobCounter* counter = nullptr);
+    // Runs other jobs on the calling thread until counter reached zero.
+    void wait(JobCounter& counter);
+    // Executor for coroutines, the priority is ignored.
+    void post(std::function<void()> job, int priority = 0) override { run(std::move(job)); }
+
+    // index of the calling thread in workers, -1 outside the system
+    int worker_index() const;
+    void push(Job* job);
+    Job* find_job(int index);
+    void execute(Job* job);
+    void worker(uint32_t index);
+};
+
+// Calls fn(chunk_begin, chunk_end) over [begin, end) in chunks of grain items spread on the
+// workers, the calling thread takes part and returns when every chunk is done. grain 0 makes
+// about 4 chunks per thread. The first exception thrown by fn is rethrown here.
+void parallel_for(JobSystem& jobs, uint32_t begin, uint32_t end, uint32_t grain,
+    const std::function<void(uint32_t, uint32_t)>& fn);
@@ -0,0 +1,350 @@
+#include "occlusion.h"
+#include "jobs.h"
+#include "pixel.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define OCCLUSION_TARGET(features)
+#else
+#define OCCLUSION_TARGET(features) __attribute__((target(features)))
+#endif
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width, uint32_t height)
+    : width((width + 31) & ~31u), height((height + 7) & ~7u)
+{
+    tiles_x = this->width / 32;
+    tiles_y = this->height / 8;
+    tiles.resize(tiles_x * tiles_y);
+    clear(glm::mat4(1.f));
+}
+
+void OcclusionBuffer::clear(const glm::mat4& new_view_proj)
+{
+    view_proj = new_view_proj;
+    for (Tile& tile : tiles)
+    {
+        std::fill(std::begin(tile.mask), std::end(tile.mask), 0u);
+        tile.z_max0 = 1.f;
+        tile.z_max1 = 0.f;
+    }
+}
+
+// false when p is behind the near plane
+static bool project(const glm::mat4& view_proj, const glm::vec3& p, float width, float height, glm::vec3& screen)
+{
+    glm::vec4 clip = view_proj * glm::vec4(p, 1.f);
+    if (clip.w <= 1e-5f || clip.z < 0.f)
+        return false;
+    screen = glm::vec3((clip.x / clip.w * 0.5f + 0.5f) * width, (clip.y / clip.w * 0.5f + 0.5f) * height, clip.z / clip.w);
+    return true;
+}
+
+static OcclusionBuffer::Triangle setup_triangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, uint32_t width, uint32_t height)
+{
+    OcclusionBuffer::Triangle tri{};
+    tri.tile_x1 = tri.tile_y1 = -1;
+    if (v0.z < 0.f || v1.z < 0.f || v2.z < 0.f)
+        return tri;
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    if (std::abs(area) < 1e-4f)
+        return tri;
+    // counterclockwise in screen space, the inside is where every edge function is positive
+    if (area < 0.f)
+    {
+        std::swap(v1, v2);
+        area = -area;
+    }
+    glm::vec3 v[3] = { v0, v1, v2 };
+    for (uint32_t k = 0; k < 3; k++)
+    {
+        const glm::vec3& a = v[k];
+        const glm::vec3& b = v[(k + 1) % 3];
+        if (a.y == b.y)
+        {
+            tri.horizontal |= 1 << k;
+            continue;
+        }
+        tri.x_slope[k] = (b.x - a.x) / (b.y - a.y);
+        tri.x_offset[k] = a.x - a.y * tri.x_slope[k];
+        if (b.y < a.y)
+            tri.left |= 1 << k;
+    }
+    tri.z_dx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+    tri.z_dy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+    tri.z_0 = v0.z - tri.z_dx * v0.x - tri.z_dy * v0.y;
+    tri.z_max = std::max<float>(std::max<float>(v0.z, v1.z), v2.z);
+
+    float x_min = std::min<float>(std::min<float>(v0.x, v1.x), v2.x);
+    float x_max = std::max<float>(std::max<float>(v0.x, v1.x), v2.x);
+    tri.y_min = std::min<float>(std::min<float>(v0.y, v1.y), v2.y);
+    tri.y_max = std::max<float>(std::max<float>(v0.y, v1.y), v2.y);
+    if (x_max < 0.f || tri.y_max < 0.f || x_min >= width || tri.y_min >= height)
+        return tri;
+    tri.tile_x0 = std::max<int32_t>(static_cast<int32_t>(x_min) / 32, 0);
+    tri.tile_x1 = std::min<int32_t>(static_cast<int32_t>(x_max) / 32, width / 32 - 1);
+    tri.tile_y0 = std::max<int32_t>(static_cast<int32_t>(tri.y_min) / 8, 0);
+    tri.tile_y1 = std::min<int32_t>(static_cast<int32_t>(tri.y_max) / 8, height / 8 - 1);
+    return tri;
+}
+
+// farthest depth of the triangle plane over the tile
+static float tile_depth(const OcclusionBuffer::Triangle& tri, int32_t tx, int32_t ty)
+{
+    float z = (tx * 32 + 16) * tri.z_dx + (ty * 8 + 4) * tri.z_dy + tri.z_0
+        + std::abs(tri.z_dx) * 16.f + std::abs(tri.z_dy) * 4.f;
+    return std::min<float>(z, tri.z_max);
+}
+
+// ---- scalar ----
+
+static void rasterize_row_scalar(OcclusionBuffer& buffer, int32_t ty)
+{
+    for (const OcclusionBuffer::Triangle& tri : buffer.triangles)
+    {
+        if (ty < tri.tile_y0 || ty > tri.tile_y1)
+            continue;
+        for (int32_t tx = tri.tile_x0; tx <= tri.tile_x1; tx++)
+        {
+            uint32_t cover[8];
+            uint32_t any = 0;
+            for (uint32_t r = 0; r < 8; r++)
+            {
+                float y = ty * 8 + r + 0.5f;
+                uint32_t row = y >= tri.y_min && y <= tri.y_max ? ~0u : 0u;
+                for (uint32_t k = 0; k < 3 && row; k++)
+                {
+                    if (tri.horizontal >> k & 1)
+                        continue;
+                    // pixel px of the tile is inside when its center px + 0.5 is on the right side of x
+                    float x = y * tri.x_slope[k] + tri.x_offset[k] - 0.5f - tx * 32.f;
+                    x = std::min<float>(std::max<float>(x, -1.f), 33.f);
+                    if (tri.left >> k & 1)
+                    {
+                        int32_t first = static_cast<int32_t>(std::ceil(x));
+                        row &= first <= 0 ? ~0u : first >= 32 ? 0u : ~0u << first;
+                    }
+                    else
+                    {
+                        int32_t last = static_cast<int32_t>(std::floor(x));
+                        row &= last < 0 ? 0u : last >= 31 ? ~0u : ~0u >> (31 - last);
+                    }
+                }
+                cover[r] = row;
+                any |= row;
+            }
+            if (!any)
+                continue;
+            OcclusionBuffer::Tile& tile = buffer.tiles[ty * buffer.tiles_x + tx];
+            float z = tile_depth(tri, tx, ty);
+            if (z >= tile.z_max0)
+                continue;
+            // the triangle is much nearer than the working layer: start the layer again from it,
+            // the reference layer still bounds the pixels that drop out
+            if (tile.z_max1 - z >= tile.z_max0 - tile.z_max1)
+            {
+                tile.z_max1 = 0.f;
+                std::fill(std::begin(tile.mask), std::end(tile.mask), 0u);
+            }
+            tile.z_max1 = std::max<float>(tile.z_max1, z);
+            uint32_t full = ~0u;
+            for (uint32_t r = 0; r < 8; r++)
+            {
+                tile.mask[r] |= cover[r];
+                full &= tile.mask[r];
+            }
+            // the working layer covers the tile, it becomes the reference
+            if (full == ~0u)
+            {
+                tile.z_max0 = std::min<float>(tile.z_max0, tile.z_max1);
+                tile.z_max1 = 0.f;
+                std::fill(std::begin(tile.mask), std::end(tile.mask), 0u);
+            }
+        }
+    }
+}
+
+static bool visible_scalar(const OcclusionBuffer& buffer, int32_t px0, int32_t px1, int32_t py0, int32_t py1, float z_min)
+{
+    for (int32_t ty = py0 / 8; ty <= py1 / 8; ty++)
+    {
+        int32_t row0 = std::max<int32_t>(py0 - ty * 8, 0);
+        int32_t row1 = std::min<int32_t>(py1 - ty * 8, 7);
+        for (int32_t tx = px0 / 32; tx <= px1 / 32; tx++)
+        {
+            const OcclusionBuffer::Tile& tile = buffer.tiles[ty * buffer.tiles_x + tx];
+            if (z_min >= tile.z_max0)
+                continue;
+            // nearer than the working layer too
+            if (z_min < tile.z_max1)
+                return true;
+            int32_t first = std::max<int32_t>(px0 - tx * 32, 0);
+            int32_t last = std::min<int32_t>(px1 - tx * 32, 31);
+            uint32_t columns = (~0u << first) & (~0u >> (31 - last));
+            for (int32_t r = row0; r <= row1; r++)
+                if (columns & ~tile.mask[r])
+                    return true;
+        }
+    }
+    return false;
+}
+
+// ---- AVX2, the 8 rows of a tile in the 8 lanes ----
+
+OCCLUSION_TARGET("avx2")
+static void rasterize_row_avx2(OcclusionBuffer& buffer, int32_t ty)
+{
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256 ys = _mm256_add_ps(_mm256_set1_ps(ty * 8 + 0.5f), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+    for (const OcclusionBuffer::Triangle& tri : buffer.triangles)
+    {
+        if (ty < tri.tile_y0 || ty > tri.tile_y1)
+            continue;
+        __m256i rows = _mm256_castps_si256(_mm256_and_ps(
+            _mm256_cmp_ps(ys, _mm256_set1_ps(tri.y_min), _CMP_GE_OQ),
+            _mm256_cmp_ps(ys, _mm256_set1_ps(tri.y_max), _CMP_LE_OQ)));
+        // edge x on the rows of the band, moving to the next tile only shifts it
+        __m256 edge_x[3];
+        for (uint32_t k = 0; k < 3; k++)
+            edge_x[k] = _mm256_add_ps(_mm256_mul_ps(ys, _mm256_set1_ps(tri.x_slope[k])), _mm256_set1_ps(tri.x_offset[k] - 0.5f));
+        for (int32_t tx = tri.tile_x0; tx <= tri.tile_x1; tx++)
+        {
+            __m256i cover = rows;
+            __m256 tile_x = _mm256_set1_ps(tx * 32.f);
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                if (tri.horizontal >> k & 1)
+                    continue;
+                __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(edge_x[k], tile_x), _mm256_set1_ps(-1.f)), _mm256_set1_ps(33.f));
+                // variable shifts give 0 from 32 on
+                if (tri.left >> k & 1)
+                {
+                    __m256i first = _mm256_max_epi32(_mm256_cvtps_epi32(_mm256_ceil_ps(x)), zero);
+                    cover = _mm256_and_si256(cover, _mm256_sllv_epi32(ones, first));
+                }
+                else
+                {
+                    __m256i shift = _mm256_sub_epi32(_mm256_set1_epi32(31), _mm256_cvtps_epi32(_mm256_floor_ps(x)));
+                    cover = _mm256_and_si256(cover, _mm256_srlv_epi32(ones, _mm256_max_epi32(shift, zero)));
+                }
+            }
+            if (_mm256_testz_si256(cover, cover))
+                continue;
+            OcclusionBuffer::Tile& tile = buffer.tiles[ty * buffer.tiles_x + tx];
+            float z = tile_depth(tri, tx, ty);
+            if (z >= tile.z_max0)
+                continue;
+            __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tile.mask));
+            if (tile.z_max1 - z >= tile.z_max0 - tile.z_max1)
+            {
+                tile.z_max1 = 0.f;
+                mask = zero;
+            }
+            tile.z_max1 = std::max<float>(tile.z_max1, z);
+            mask = _mm256_or_si256(mask, cover);
+            if (_mm256_testc_si256(mask, ones))
+            {
+                tile.z_max0 = std::min<float>(tile.z_max0, tile.z_max1);
+                tile.z_max1 = 0.f;
+                mask = zero;
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(tile.mask), mask);
+        }
+    }
+}
+
+OCCLUSION_TARGET("avx2")
+static bool visible_avx2(const OcclusionBuffer& buffer, int32_t px0, int32_t px1, int32_t py0, int32_t py1, float z_min)
+{
+    const __m256i row_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (int32_t ty = py0 / 8; ty <= py1 / 8; ty++)
+    {
+        __m256i rows = _mm256_and_si256(
+            _mm256_cmpgt_epi32(row_index, _mm256_set1_epi32(py0 - ty * 8 - 1)),
+            _mm256_cmpgt_epi32(_mm256_set1_epi32(py1 - ty * 8 + 1), row_index));
+        for (int32_t tx = px0 / 32; tx <= px1 / 32; tx++)
+        {
+            const OcclusionBuffer::Tile& tile = buffer.tiles[ty * buffer.tiles_x + tx];
+            if (z_min >= tile.z_max0)
+                continue;
+            if (z_min < tile.z_max1)
+                return true;
+            int32_t first = std::max<int32_t>(px0 - tx * 32, 0);
+            int32_t last = std::min<int32_t>(px1 - tx * 32, 31);
+            __m256i rect = _mm256_and_si256(rows, _mm256_set1_epi32(static_cast<int>((~0u << first) & (~0u >> (31 - last)))));
+            // a pixel of the box outside the working layer
+            if (!_mm256_testc_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(tile.mask)), rect))
+                return true;
+        }
+    }
+    return false;
+}
+
+void OcclusionBuffer::render(JobSystem& jobs, const std::vector<glm::vec3>& vertices, const std::vector<uint32_t>& indices)
+{
+    uint32_t vertex_count = static_cast<uint32_t>(vertices.size());
+    uint32_t count = static_cast<uint32_t>(indices.size() / 3);
+    projected.resize(vertex_count);
+    triangles.resize(count);
+    parallel_for(jobs, 0, vertex_count, 4096, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+            if (!project(view_proj, vertices[i], static_cast<float>(width), static_cast<float>(height), projected[i]))
+                projected[i] = glm::vec3(0.f, 0.f, -1.f);
+    });
+    parallel_for(jobs, 0, count, 1024, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+            triangles[i] = setup_triangle(projected[indices[i * 3]], projected[indices[i * 3 + 1]],
+                projected[indices[i * 3 + 2]], width, height);
+    });
+    // one job per row of tiles, the triangles land on each tile in submission order
+    bool avx2 = simd_level() == SimdLevel::AVX2;
+    parallel_for(jobs, 0, tiles_y, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t ty = begin; ty < end; ty++)
+        {
+            if (avx2)
+                rasterize_row_avx2(*this, static_cast<int32_t>(ty));
+            else
+                rasterize_row_scalar(*this, static_cast<int32_t>(ty));
+        }
+    });
+    triangles_rendered += count;
+}
+
+bool OcclusionBuffer::visible(const Aabb& box) const
+{
+    float x_min = FLT_MAX, y_min = FLT_MAX, z_min = FLT_MAX;
+    float x_max = -FLT_MAX, y_max = -FLT_MAX;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        glm::vec3 corner(i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z);
+        glm::vec3 screen;
+        if (!project(view_proj, corner, static_cast<float>(width), static_cast<float>(height), screen))
+            return true;
+        x_min = std::min<float>(x_min, screen.x);
+        x_max = std::max<float>(x_max, screen.x);
+        y_min = std::min<float>(y_min, screen.y);
+        y_max = std::max<float>(y_max, screen.y);
+        z_min = std::min<float>(z_min, screen.z);
+    }
+    if (x_max < 0.f || y_max < 0.f || x_min >= width || y_min >= height)
+        return false;
+    // every pixel the box touches
+    int32_t px0 = std::max<int32_t>(static_cast<int32_t>(std::floor(x_min)), 0);
+    int32_t px1 = std::min<int32_t>(static_cast<int32_t>(x_max), width - 1);
+    int32_t py0 = std::max<int32_t>(static_cast<int32_t>(std::floor(y_min)), 0);
+    int32_t py1 = std::min<int32_t>(static_cast<int32_t>(y_max), height - 1);
+    if (simd_level() == SimdLevel::AVX2)
+        return visible_avx2(*this, px0, px1, py0, py1, z_min);
+    return visible_scalar(*this, px0, px1, py0, py1, z_min);
+}
+
+void OcclusionBuffer::test(JobSystem& jobs, const Aabb* boxes, uint32_t count, uint8_t* visible) const
+{
+    parallel_for(jobs, 0, count, 4096, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+            visible[i] = this->visible(boxes[i]);
+    });
+}
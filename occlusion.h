@@ -0,0 +1,71 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+struct JobSystem;
+
+struct Aabb
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// Software occlusion buffer after Hasselgren et al. "Masked Software Occlusion Culling". The
+// screen is split in 32x8 pixel tiles, each one holds a coverage mask of 1 bit per pixel for its
+// working layer and two farthest depths: z_max0 bounds every pixel of the tile, z_max1 the pixels
+// in the mask. Occluders merge into the working layer, which replaces the reference layer once it
+// covers the whole tile. Depth is z/w of view_proj, Vulkan range [0, 1], larger is farther.
+// A box is reported hidden only when every pixel it touches is nearer, so the buffer can miss
+// occlusion but never hides something visible. Rows of tiles are rasterized in parallel, AVX2
+// computes the 8 rows of a tile at once when simd_level() allows it (pixel.h).
+// Standalone for now: only --bench occlusion drives it. The quads of --draws share one plane and
+// cannot hide each other, and --city culls on the GPU against the depth pyramid (hiz.h).
+struct OcclusionBuffer
+{
+    struct Tile
+    {
+        uint32_t mask[8]; // row r, bit x: pixel (x, r) of the tile is in the working layer
+        float z_max0;
+        float z_max1;     // 0 when the mask is empty
+    };
+    // occluder triangle in screen space, pixel centers at .5
+    struct Triangle
+    {
+        // x of edge k on row y is y * x_slope[k] + x_offset[k], the inside is right of the
+        // edge when bit k of left is set, horizontal edges are left to the y range
+        float x_slope[3];
+        float x_offset[3];
+        uint32_t left;
+        uint32_t horizontal;
+        float y_min, y_max;
+        // z = x * z_dx + y * z_dy + z_0, z_max bounds the plane over the triangle
+        float z_dx, z_dy, z_0, z_max;
+        // inclusive tile range, empty when tile_x0 > tile_x1 (clipped or degenerate)
+        int32_t tile_x0, tile_x1, tile_y0, tile_y1;
+    };
+
+    uint32_t width;  // multiple of 32
+    uint32_t height; // multiple of 8
+    uint32_t tiles_x, tiles_y;
+    std::vector<Tile> tiles;
+    std::vector<glm::vec3> projected; // vertices of the last render call in screen space, z < 0 when clipped
+    std::vector<Triangle> triangles;  // set up by the last render call
+    glm::mat4 view_proj{ 1.f };
+
+    uint64_t triangles_rendered = 0;
+
+    // sizes are rounded up to whole tiles
+    OcclusionBuffer(uint32_t width, uint32_t height);
+
+    // Starts a frame: every tile back to the far plane.
+    void clear(const glm::mat4& new_view_proj);
+    // Rasterizes the indexed world space triangles, can be called several times per frame.
+    // Triangles crossing the near plane are dropped, which only loses occlusion.
+    void render(JobSystem& jobs, const std::vector<glm::vec3>& vertices, const std::vector<uint32_t>& indices);
+    // false when the box is hidden by the occluders or outside the screen. Boxes crossing the
+    // near plane are visible. Reads the buffer only, safe from any thread between renders.
+    bool visible(const Aabb& box) const;
+    // visible[i] = visible(boxes[i]) in parallel chunks
+    void test(JobSystem& jobs, const Aabb* boxes, uint32_t count, uint8_t* visible) const;
+};
@@ -0,0 +1,253 @@
+#include "pack.h"
+#include "pixel.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+#include <stb_image.h>
+
+PackFile::PackFile(const std::string& path) : path(path)
+{
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("PackFile: cannot open " + path);
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    size = file_size.QuadPart;
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        CloseHandle(file);
+        throw std::runtime_error("PackFile: cannot map " + path);
+    }
+    base = reinterpret_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (base == nullptr)
+    {
+        close();
+        throw std::runtime_error("PackFile: cannot map " + path);
+    }
+
+    auto header = reinterpret_cast<const PackHeader*>(base);
+    if (size < sizeof(PackHeader) || header->magic != PACK_MAGIC || header->version != PACK_VERSION
+        || size < sizeof(PackHeader) + header->entry_count * sizeof(PackEntry))
+    {
+        close();
+        throw std::runtime_error("PackFile: invalid pack " + path);
+    }
+    auto entry = reinterpret_cast<const PackEntry*>(base + sizeof(PackHeader));
+    for (uint32_t i = 0; i < header->entry_count; i++, entry++)
+    {
+        // data_size() and the uploads trust the mip table: every mip inside the file and in order
+        bool valid = entry->mip_count >= 1 && entry->mip_count <= PACK_MAX_MIPS;
+        for (uint32_t m = 0; valid && m < entry->mip_count; m++)
+            valid = entry->mips[m].offset <= size && entry->mips[m].size <= size - entry->mips[m].offset
+                && (m == 0 || entry->mips[m].offset >= entry->mips[m - 1].offset + entry->mips[m - 1].size);
+        if (!valid)
+        {
+            close();
+            throw std::runtime_error("PackFile: invalid entry " + std::to_string(i) + " in " + path);
+        }
+        entries.emplace(std::string(entry->name, strnlen(entry->name, PACK_MAX_NAME)), entry);
+    }
+    std::cout << "PackFile: mounted " << path << " with " << entries.size() << " entries\n";
+}
+
+PackFile::~PackFile()
+{
+    close();
+}
+
+void PackFile::close()
+{
+    if (base)
+        UnmapViewOfFile(base);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+    base = nullptr;
+    mapping = NULL;
+    file = INVALID_HANDLE_VALUE;
+}
+
+const PackEntry* PackFile::find(const std::string& name) const
+{
+    if (auto it = entries.find(name); it != entries.end())
+        return it->second;
+    return nullptr;
+}
+
+uint32_t mip_count(uint32_t width, uint32_t height)
+{
+    uint32_t count = 1;
+    while ((width | height) > 1)
+    {
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        count++;
+    }
+    return count;
+}
+
+std::vector<uint8_t> downsample_rgba8(const uint8_t* src, uint32_t width, uint32_t height)
+{
+    uint32_t dst_width = width > 1 ? width / 2 : 1;
+    uint32_t dst_height = height > 1 ? height / 2 : 1;
+    std::vector<uint8_t> dst(dst_width * dst_height * 4);
+    for (uint32_t y = 0; y < dst_height; y++)
+    {
+        uint32_t y0 = y * 2;
+        uint32_t y1 = y0 + 1 < height ? y0 + 1 : y0;
+        for (uint32_t x = 0; x < dst_width; x++)
+        {
+            uint32_t x0 = x * 2;
+            uint32_t x1 = x0 + 1 < width ? x0 + 1 : x0;
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                uint32_t sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c]
+                    + src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+                dst[(y * dst_width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+            }
+        }
+    }
+    return dst;
+}
+
+std::vector<float> downsample_rgba32f(const float* src, uint32_t width, uint32_t height)
+{
+    uint32_t dst_width = width > 1 ? width / 2 : 1;
+    uint32_t dst_height = height > 1 ? height / 2 : 1;
+    std::vector<float> dst((size_t)dst_width * dst_height * 4);
+    for (uint32_t y = 0; y < dst_height; y++)
+    {
+        uint32_t y0 = y * 2;
+        uint32_t y1 = y0 + 1 < height ? y0 + 1 : y0;
+        for (uint32_t x = 0; x < dst_width; x++)
+        {
+            uint32_t x0 = x * 2;
+            uint32_t x1 = x0 + 1 < width ? x0 + 1 : x0;
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                float sum = src[((size_t)y0 * width + x0) * 4 + c] + src[((size_t)y0 * width + x1) * 4 + c]
+                    + src[((size_t)y1 * width + x0) * 4 + c] + src[((size_t)y1 * width + x1) * 4 + c];
+                dst[((size_t)y * dst_width + x) * 4 + c] = sum * 0.25f;
+            }
+        }
+    }
+    return dst;
+}
+
+vk::Format float_format(int channels, bool compact)
+{
+    bool alpha = channels == 2 || channels == 4;
+    return compact && !alpha ? vk::Format::eB10G11R11UfloatPack32 : vk::Format::eR16G16B16A16Sfloat;
+}
+
+std::vector<std::vector<uint8_t>> build_float_mips(const float* rgba, uint32_t width, uint32_t height,
+    vk::Format format, uint32_t levels)
+{
+    std::vector<std::vector<uint8_t>> mips;
+    // filtering stays in float, only the stored levels are packed
+    std::vector<float> scratch;
+    const float* level_pixels = rgba;
+    for (uint32_t level = 0; level < levels; level++)
+    {
+        if (level > 0)
+        {
+            scratch = downsample_rgba32f(level_pixels, width, height);
+            level_pixels = scratch.data();
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+        size_t count = (size_t)width * height;
+        if (format == vk::Format::eB10G11R11UfloatPack32)
+        {
+            mips.emplace_back(count * 4);
+            float_to_b10g11r11(level_pixels, reinterpret_cast<uint32_t*>(mips.back().data()), count);
+        }
+        else
+        {
+            mips.emplace_back(count * 8);
+            float_to_half(level_pixels, reinterpret_cast<uint16_t*>(mips.back().data()), count * 4);
+        }
+    }
+    return mips;
+}
+
+static uint64_t pack_align(uint64_t offset)
+{
+    return (offset + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+}
+
+bool cook_pack(const std::string& out_path, const std::vector<std::string>& inputs)
+{
+    std::vector<PackEntry> entries(inputs.size());
+    std::vector<std::vector<std::vector<uint8_t>>> payloads(inputs.size());
+    uint64_t offset = pack_align(sizeof(PackHeader) + entries.size() * sizeof(PackEntry));
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        if (inputs[i].size() >= PACK_MAX_NAME)
+        {
+            std::cout << "cook_pack: name too long " << inputs[i] << "\n";
+            return false;
+        }
+        int w, h, c;
+        bool hdr = stbi_is_hdr(inputs[i].c_str());
+        void* pixels = hdr ? (void*)stbi_loadf(inputs[i].c_str(), &w, &h, &c, 4) : (void*)stbi_load(inputs[i].c_str(), &w, &h, &c, 4);
+        if (!pixels)
+        {
+            std::cout << "cook_pack: cannot decode " << inputs[i] << "\n";
+            return false;
+        }
+        PackEntry& entry = entries[i];
+        memset(&entry, 0, sizeof(PackEntry));
+        inputs[i].copy(entry.name, PACK_MAX_NAME - 1);
+        entry.format = static_cast<uint32_t>(hdr ? float_format(c) : vk::Format::eR8G8B8A8Unorm);
+        entry.width = w;
+        entry.height = h;
+        entry.mip_count = std::min<uint32_t>(mip_count(w, h), PACK_MAX_MIPS);
+
+        if (hdr)
+            payloads[i] = build_float_mips(static_cast<float*>(pixels), w, h, static_cast<vk::Format>(entry.format), entry.mip_count);
+        else
+            payloads[i].emplace_back(static_cast<uint8_t*>(pixels), static_cast<uint8_t*>(pixels) + w * h * 4);
+        stbi_image_free(pixels);
+        uint32_t mip_w = w, mip_h = h;
+        for (uint32_t level = 0; level < entry.mip_count; level++)
+        {
+            if (level > 0)
+            {
+                if (!hdr)
+                    payloads[i].push_back(downsample_rgba8(payloads[i].back().data(), mip_w, mip_h));
+                mip_w = mip_w > 1 ? mip_w / 2 : 1;
+                mip_h = mip_h > 1 ? mip_h / 2 : 1;
+            }
+            entry.mips[level].offset = offset;
+            entry.mips[level].size = payloads[i][level].size();
+            entry.mips[level].width = mip_w;
+            entry.mips[level].height = mip_h;
+            offset = pack_align(offset + entry.mips[level].size);
+        }
+        std::cout << "cook_pack: " << inputs[i] << " " << w << "x" << h
+            << " mips " << entry.mip_count << "\n";
+    }
+
+    std::ofstream file(out_path, std::ios::binary);
+    if (!file)
+        return false;
+    PackHeader header{ PACK_MAGIC, PACK_VERSION, static_cast<uint32_t>(entries.size()), PACK_ALIGNMENT };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(PackEntry));
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        for (uint32_t level = 0; level < entries[i].mip_count; level++)
+        {
+            // zero fill up to the aligned start of the payload
+            file.seekp(entries[i].mips[level].offset);
+            file.write(reinterpret_cast<const char*>(payloads[i][level].data()), payloads[i][level].size());
+        }
+    }
+    return file.good();
+}
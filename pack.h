@@ -0,0 +1,81 @@
+#pragma once
+#include <windows.h>
+#include <vulkan/vulkan.hpp>
+#include <string>
+#include <vector>
+#include <map>
+
+// Cooked texture pack, laid out as:
+//   PackHeader | PackEntry[entry_count] | payloads
+// Every mip payload starts on a PackHeader::alignment boundary with tightly packed rows,
+// so a whole entry can be copied into a staging buffer and fed to copyBufferToImage as is.
+constexpr uint32_t PACK_MAGIC = 0x4b435056; // "VPCK"
+constexpr uint32_t PACK_VERSION = 1;
+constexpr uint32_t PACK_ALIGNMENT = 512;
+constexpr uint32_t PACK_MAX_MIPS = 16;
+constexpr uint32_t PACK_MAX_NAME = 128;
+
+struct PackHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t alignment;
+};
+
+struct PackMip
+{
+    uint64_t offset; // from the beginning of the file
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct PackEntry
+{
+    char name[PACK_MAX_NAME];
+    uint32_t format; // VkFormat, block compressed formats are uploaded untouched
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_count;
+    PackMip mips[PACK_MAX_MIPS];
+
+    // payload span covering all the mips, contiguous in the file
+    uint64_t data_offset() const { return mips[0].offset; }
+    uint64_t data_size() const { return mips[mip_count - 1].offset + mips[mip_count - 1].size - mips[0].offset; }
+};
+
+struct PackFile
+{
+    std::string path;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+    const uint8_t* base = nullptr;
+    uint64_t size = 0;
+    std::map<std::string, const PackEntry*> entries;
+
+    PackFile(const std::string& path);
+    ~PackFile();
+    void close();
+
+    PackFile(const PackFile&) = delete;
+    PackFile& operator=(const PackFile&) = delete;
+
+    const PackEntry* find(const std::string& name) const;
+    const uint8_t* data(const PackEntry& entry) const { return base + entry.data_offset(); }
+};
+
+// Box filter one RGBA8 level into the next one, odd sizes clamp at the border.
+std::vector<uint8_t> downsample_rgba8(const uint8_t* src, uint32_t width, uint32_t height);
+uint32_t mip_count(uint32_t width, uint32_t height);
+// Box filter one linear RGBA float level into the next one.
+std::vector<float> downsample_rgba32f(const float* src, uint32_t width, uint32_t height);
+// Format HDR images are stored in: eB10G11R11UfloatPack32 is half the size of eR16G16B16A16Sfloat
+// but has no alpha, no sign and only 6 bits of mantissa.
+vk::Format float_format(int channels, bool compact = true);
+// Builds levels mips from linear RGBA float pixels, each one packed into format (one of float_format()).
+std::vector<std::vector<uint8_t>> build_float_mips(const float* rgba, uint32_t width, uint32_t height,
+    vk::Format format, uint32_t levels);
+
+// Offline cooker: decodes the images, builds the full mip chain and writes the pack.
+bool cook_pack(const std::string& out_path, const std::vector<std::string>& inputs);
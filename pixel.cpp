@@ -0,0 +1,588 @@
+#include "pixel.h"
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PIXEL_TARGET(features)
+static void cpuid(int info[4], int leaf, int subleaf) { __cpuidex(info, leaf, subleaf); }
+static uint64_t xgetbv0() { return _xgetbv(0); }
+#else
+#include <cpuid.h>
+#define PIXEL_TARGET(features) __attribute__((target(features)))
+static void cpuid(int info[4], int leaf, int subleaf) { __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]); }
+static uint64_t xgetbv0()
+{
+    uint32_t lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+#endif
+
+SimdLevel simd_detect()
+{
+    int info[4];
+    cpuid(info, 0, 0);
+    int max_leaf = info[0];
+    cpuid(info, 1, 0);
+    bool ssse3 = info[2] & (1 << 9);
+    bool fma = info[2] & (1 << 12);
+    bool osxsave = info[2] & (1 << 27);
+    bool avx = info[2] & (1 << 28);
+    bool f16c = info[2] & (1 << 29);
+    bool avx2 = false;
+    if (max_leaf >= 7)
+    {
+        cpuid(info, 7, 0);
+        avx2 = info[1] & (1 << 5);
+    }
+    // the OS must save the ymm registers too
+    bool ymm = osxsave && avx && (xgetbv0() & 0x6) == 0x6;
+    if (ymm && avx2 && fma && f16c)
+        return SimdLevel::AVX2;
+    if (ssse3)
+        return SimdLevel::SSSE3;
+    return SimdLevel::Scalar;
+}
+
+static SimdLevel current_level = simd_detect();
+
+SimdLevel simd_level()
+{
+    return current_level;
+}
+
+void simd_set_level(SimdLevel level)
+{
+    current_level = level <= simd_detect() ? level : simd_detect();
+}
+
+const char* simd_name(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2: return "AVX2";
+    case SimdLevel::SSSE3: return "SSSE3";
+    default: return "Scalar";
+    }
+}
+
+// Lookup tables, filled once at startup
+struct PixelTables
+{
+    // [0, 256) sRGB to linear, [256, 512) alpha normalization
+    float to_linear[512];
+    // piecewise linear fit of linear to sRGB*255 on 104 buckets indexed by the float
+    // exponent and top 3 mantissa bits, covering [2^-13, 1)
+    float to_srgb_bias[104];
+    float to_srgb_scale[104];
+
+    PixelTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            float c = i / 255.f;
+            to_linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            to_linear[256 + i] = c;
+        }
+        for (uint32_t bucket = 0; bucket < 104; bucket++)
+        {
+            // least squares over the 256 sub steps of the bucket
+            double sum_t = 0, sum_s = 0, sum_tt = 0, sum_ts = 0;
+            for (uint32_t t = 0; t < 256; t++)
+            {
+                uint32_t bits = 0x39000000 + (bucket << 20) + (t << 12) + (1 << 11);
+                float x;
+                memcpy(&x, &bits, sizeof(x));
+                double s = (x <= 0.0031308 ? x * 12.92 : 1.055 * std::pow(x, 1 / 2.4) - 0.055) * 255.0;
+                sum_t += t;
+                sum_s += s;
+                sum_tt += t * t;
+                sum_ts += t * s;
+            }
+            double scale = (256 * sum_ts - sum_t * sum_s) / (256 * sum_tt - sum_t * sum_t);
+            to_srgb_scale[bucket] = static_cast<float>(scale);
+            to_srgb_bias[bucket] = static_cast<float>((sum_s - scale * sum_t) / 256);
+        }
+    }
+};
+static const PixelTables tables;
+
+// ---- RGB -> RGBA ----
+
+static void rgb_to_rgba_scalar(const uint8_t* src, uint8_t* dst, size_t count, uint8_t alpha)
+{
+    for (size_t i = 0; i < count; i++, src += 3, dst += 4)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = alpha;
+    }
+}
+
+PIXEL_TARGET("ssse3")
+static void rgb_to_rgba_ssse3(const uint8_t* src, uint8_t* dst, size_t count, uint8_t alpha)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha_mask = _mm_set1_epi32(static_cast<int>(static_cast<uint32_t>(alpha) << 24));
+    size_t i = 0;
+    // 4 pixels per step, the 16 byte load reads 4 bytes past them
+    for (; i + 6 <= count; i += 4)
+    {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(px, shuffle), alpha_mask));
+    }
+    rgb_to_rgba_scalar(src + i * 3, dst + i * 4, count - i, alpha);
+}
+
+PIXEL_TARGET("avx2")
+static void rgb_to_rgba_avx2(const uint8_t* src, uint8_t* dst, size_t count, uint8_t alpha)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha_mask = _mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(alpha) << 24));
+    size_t i = 0;
+    // 8 pixels per step, 4 in each lane
+    for (; i + 10 <= count; i += 8)
+    {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3 + 12));
+        __m256i px = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(px, shuffle), alpha_mask));
+    }
+    rgb_to_rgba_scalar(src + i * 3, dst + i * 4, count - i, alpha);
+}
+
+void rgb_to_rgba(const uint8_t* src, uint8_t* dst, size_t count, uint8_t alpha)
+{
+    switch (current_level)
+    {
+    case SimdLevel::AVX2: return rgb_to_rgba_avx2(src, dst, count, alpha);
+    case SimdLevel::SSSE3: return rgb_to_rgba_ssse3(src, dst, count, alpha);
+    default: return rgb_to_rgba_scalar(src, dst, count, alpha);
+    }
+}
+
+// ---- RGBA <-> BGRA ----
+
+static void swizzle_bgra_scalar(const uint8_t* src, uint8_t* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++, src += 4, dst += 4)
+    {
+        uint8_t r = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = r;
+        dst[3] = src[3];
+    }
+}
+
+PIXEL_TARGET("ssse3")
+static void swizzle_bgra_ssse3(const uint8_t* src, uint8_t* dst, size_t count)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_shuffle_epi8(px, shuffle));
+    }
+    swizzle_bgra_scalar(src + i * 4, dst + i * 4, count - i);
+}
+
+PIXEL_TARGET("avx2")
+static void swizzle_bgra_avx2(const uint8_t* src, uint8_t* dst, size_t count)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_shuffle_epi8(px, shuffle));
+    }
+    swizzle_bgra_scalar(src + i * 4, dst + i * 4, count - i);
+}
+
+void swizzle_bgra(const uint8_t* src, uint8_t* dst, size_t count)
+{
+    switch (current_level)
+    {
+    case SimdLevel::AVX2: return swizzle_bgra_avx2(src, dst, count);
+    case SimdLevel::SSSE3: return swizzle_bgra_ssse3(src, dst, count);
+    default: return swizzle_bgra_scalar(src, dst, count);
+    }
+}
+
+// ---- premultiplied alpha ----
+
+// x / 255 rounded to nearest, exact for x in [0, 255 * 255]
+static inline uint8_t div255(uint32_t x)
+{
+    x += 128;
+    return static_cast<uint8_t>((x + (x >> 8)) >> 8);
+}
+
+static void premultiply_alpha_scalar(const uint8_t* src, uint8_t* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++, src += 4, dst += 4)
+    {
+        uint32_t a = src[3];
+        dst[0] = div255(src[0] * a);
+        dst[1] = div255(src[1] * a);
+        dst[2] = div255(src[2] * a);
+        dst[3] = static_cast<uint8_t>(a);
+    }
+}
+
+PIXEL_TARGET("ssse3")
+static inline __m128i premultiply_2px(__m128i px16)
+{
+    // broadcast alpha to r g b, multiply alpha itself by 255 so it survives the division
+    const __m128i alpha_shuffle = _mm_setr_epi8(6, 7, 6, 7, 6, 7, -1, -1, 14, 15, 14, 15, 14, 15, -1, -1);
+    const __m128i alpha_255 = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+    __m128i a = _mm_or_si128(_mm_shuffle_epi8(px16, alpha_shuffle), alpha_255);
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(px16, a), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+PIXEL_TARGET("ssse3")
+static void premultiply_alpha_ssse3(const uint8_t* src, uint8_t* dst, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i lo = premultiply_2px(_mm_unpacklo_epi8(px, zero));
+        __m128i hi = premultiply_2px(_mm_unpackhi_epi8(px, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_packus_epi16(lo, hi));
+    }
+    premultiply_alpha_scalar(src + i * 4, dst + i * 4, count - i);
+}
+
+PIXEL_TARGET("avx2")
+static inline __m256i premultiply_4px(__m256i px16)
+{
+    const __m256i alpha_shuffle = _mm256_setr_epi8(
+        6, 7, 6, 7, 6, 7, -1, -1, 14, 15, 14, 15, 14, 15, -1, -1,
+        6, 7, 6, 7, 6, 7, -1, -1, 14, 15, 14, 15, 14, 15, -1, -1);
+    const __m256i alpha_255 = _mm256_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255);
+    __m256i a = _mm256_or_si256(_mm256_shuffle_epi8(px16, alpha_shuffle), alpha_255);
+    __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(px16, a), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+PIXEL_TARGET("avx2")
+static void premultiply_alpha_avx2(const uint8_t* src, uint8_t* dst, size_t count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        // unpack and pack work per lane, so the pixel order is preserved
+        __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+        __m256i lo = premultiply_4px(_mm256_unpacklo_epi8(px, zero));
+        __m256i hi = premultiply_4px(_mm256_unpackhi_epi8(px, zero));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_packus_epi16(lo, hi));
+    }
+    premultiply_alpha_scalar(src + i * 4, dst + i * 4, count - i);
+}
+
+void premultiply_alpha(const uint8_t* src, uint8_t* dst, size_t count)
+{
+    switch (current_level)
+    {
+    case SimdLevel::AVX2: return premultiply_alpha_avx2(src, dst, count);
+    case SimdLevel::SSSE3: return premultiply_alpha_ssse3(src, dst, count);
+    default: return premultiply_alpha_scalar(src, dst, count);
+    }
+}
+
+// ---- sRGB -> linear ----
+
+static void srgb_to_linear_scalar(const uint8_t* src, float* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++, src += 4, dst += 4)
+    {
+        dst[0] = tables.to_linear[src[0]];
+        dst[1] = tables.to_linear[src[1]];
+        dst[2] = tables.to_linear[src[2]];
+        dst[3] = tables.to_linear[256 + src[3]];
+    }
+}
+
+PIXEL_TARGET("avx2")
+static void srgb_to_linear_avx2(const uint8_t* src, float* dst, size_t count)
+{
+    const __m256i alpha_offset = _mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i px = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m256i index = _mm256_add_epi32(_mm256_cvtepu8_epi32(px), alpha_offset);
+        _mm256_storeu_ps(dst + i * 4, _mm256_i32gather_ps(tables.to_linear, index, 4));
+    }
+    srgb_to_linear_scalar(src + i * 4, dst + i * 4, count - i);
+}
+
+void srgb_to_linear(const uint8_t* src, float* dst, size_t count)
+{
+    // the SSSE3 level has no gather, the scalar lookups are as fast there
+    if (current_level == SimdLevel::AVX2)
+        return srgb_to_linear_avx2(src, dst, count);
+    return srgb_to_linear_scalar(src, dst, count);
+}
+
+// ---- linear -> sRGB ----
+
+static inline uint8_t to_srgb8(float x)
+{
+    const float min_value = 1.f / 8192.f; // 2^-13, below that the result rounds to 0
+    const float max_value = 0.99999994f;  // largest float below 1
+    if (!(x > min_value))
+        x = min_value;
+    if (x > max_value)
+        x = max_value;
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    uint32_t bucket = (bits - 0x39000000) >> 20;
+    uint32_t t = (bits >> 12) & 0xff;
+    return static_cast<uint8_t>(tables.to_srgb_bias[bucket] + tables.to_srgb_scale[bucket] * t + 0.5f);
+}
+
+static void linear_to_srgb_scalar(const float* src, uint8_t* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++, src += 4, dst += 4)
+    {
+        dst[0] = to_srgb8(src[0]);
+        dst[1] = to_srgb8(src[1]);
+        dst[2] = to_srgb8(src[2]);
+        float a = src[3] > 0.f ? (src[3] < 1.f ? src[3] : 1.f) : 0.f;
+        dst[3] = static_cast<uint8_t>(a * 255.f + 0.5f);
+    }
+}
+
+PIXEL_TARGET("avx2,fma")
+static void linear_to_srgb_avx2(const float* src, uint8_t* dst, size_t count)
+{
+    const __m256 min_value = _mm256_set1_ps(1.f / 8192.f);
+    const __m256 max_value = _mm256_set1_ps(0.99999994f);
+    const __m256i base = _mm256_set1_epi32(0x39000000);
+    const __m256i t_mask = _mm256_set1_epi32(0xff);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 alpha_lanes = _mm256_castsi256_ps(_mm256_setr_epi32(0, 0, 0, -1, 0, 0, 0, -1));
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m256 v = _mm256_loadu_ps(src + i * 4);
+        // max first so NaN turns into the minimum
+        __m256 x = _mm256_min_ps(_mm256_max_ps(v, min_value), max_value);
+        __m256i bits = _mm256_castps_si256(x);
+        __m256i bucket = _mm256_srli_epi32(_mm256_sub_epi32(bits, base), 20);
+        __m256 t = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(bits, 12), t_mask));
+        __m256 bias = _mm256_i32gather_ps(tables.to_srgb_bias, bucket, 4);
+        __m256 scale = _mm256_i32gather_ps(tables.to_srgb_scale, bucket, 4);
+        __m256 srgb = _mm256_fmadd_ps(scale, t, bias);
+        __m256 alpha = _mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(1.f)),
+            _mm256_set1_ps(255.f));
+        __m256i result = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_blendv_ps(srgb, alpha, alpha_lanes), half));
+        __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i * 4), _mm_packus_epi16(words, words));
+    }
+    linear_to_srgb_scalar(src + i * 4, dst + i * 4, count - i);
+}
+
+void linear_to_srgb(const float* src, uint8_t* dst, size_t count)
+{
+    if (current_level == SimdLevel::AVX2)
+        return linear_to_srgb_avx2(src, dst, count);
+    return linear_to_srgb_scalar(src, dst, count);
+}
+
+// ---- float -> half ----
+
+static inline uint16_t to_half(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+    uint16_t h;
+    if (f >= 0x47800000u) // 65536 and above, inf and nan
+        h = f > 0x7f800000u ? 0x7e00 : 0x7c00;
+    else if (f < 0x38800000u) // below 2^-14 the result is subnormal or zero
+    {
+        // let the float adder do the round to nearest even into the low mantissa bits
+        const uint32_t magic_bits = 0x3f000000u; // 0.5
+        float magic, x;
+        memcpy(&magic, &magic_bits, sizeof(magic));
+        memcpy(&x, &f, sizeof(x));
+        x += magic;
+        memcpy(&f, &x, sizeof(f));
+        h = static_cast<uint16_t>(f - magic_bits);
+    }
+    else
+    {
+        uint32_t mantissa_odd = (f >> 13) & 1;
+        f += 0xc8000fffu; // rebias the exponent (15 - 127) << 23 and round
+        f += mantissa_odd;
+        h = static_cast<uint16_t>(f >> 13);
+    }
+    return h | static_cast<uint16_t>(sign >> 16);
+}
+
+static void float_to_half_scalar(const float* src, uint16_t* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        dst[i] = to_half(src[i]);
+}
+
+PIXEL_TARGET("avx2,f16c")
+static void float_to_half_f16c(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+    }
+    float_to_half_scalar(src + i, dst + i, count - i);
+}
+
+void float_to_half(const float* src, uint16_t* dst, size_t count)
+{
+    if (current_level == SimdLevel::AVX2)
+        return float_to_half_f16c(src, dst, count);
+    return float_to_half_scalar(src, dst, count);
+}
+
+// ---- float -> B10G11R11 ----
+
+// Unsigned float with a 5 bit exponent (bias 15) and MANTISSA bits of mantissa, no inf or nan kept.
+template<int MANTISSA>
+static inline uint32_t to_ufloat(float value)
+{
+    constexpr int drop = 23 - MANTISSA;
+    constexpr uint32_t max_bits = (142u << 23) | (((1u << MANTISSA) - 1) << drop); // largest finite value
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    if (f >= 0x80000000u || f > 0x7f800000u) // negative or nan
+        return 0;
+    if (f > max_bits)
+        return (30u << MANTISSA) | ((1u << MANTISSA) - 1);
+    if (f < 0x38800000u) // below 2^-14 the result is subnormal, scale by the smallest step and round
+        return static_cast<uint32_t>(std::lrint(value * static_cast<float>(1u << (14 + MANTISSA))));
+    f += 0xc8000000u; // rebias the exponent (15 - 127) << 23
+    return (f + ((1u << (drop - 1)) - 1) + ((f >> drop) & 1)) >> drop;
+}
+
+static void float_to_b10g11r11_scalar(const float* src, uint32_t* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++, src += 4)
+        dst[i] = to_ufloat<6>(src[0]) | (to_ufloat<6>(src[1]) << 11) | (to_ufloat<5>(src[2]) << 22);
+}
+
+// Same steps as to_ufloat on 4 lanes, the subnormal rounding comes from cvtps in the default MXCSR mode
+template<int MANTISSA>
+PIXEL_TARGET("ssse3")
+static inline __m128i to_ufloat_sse(__m128 value)
+{
+    constexpr int drop = 23 - MANTISSA;
+    constexpr int max_bits = (142 << 23) | (((1 << MANTISSA) - 1) << drop);
+    __m128i f = _mm_castps_si128(value);
+    // signed compares: negatives are below zero, positive nan above inf
+    __m128i zero_mask = _mm_or_si128(_mm_cmplt_epi32(f, _mm_setzero_si128()), _mm_cmpgt_epi32(f, _mm_set1_epi32(0x7f800000)));
+    __m128i max_mask = _mm_cmpgt_epi32(f, _mm_set1_epi32(max_bits));
+    __m128i sub_mask = _mm_cmplt_epi32(f, _mm_set1_epi32(0x38800000));
+
+    __m128i normal = _mm_add_epi32(f, _mm_set1_epi32(static_cast<int>(0xc8000000u + (1u << (drop - 1)) - 1)));
+    normal = _mm_add_epi32(normal, _mm_and_si128(_mm_srli_epi32(f, drop), _mm_set1_epi32(1)));
+    normal = _mm_srli_epi32(normal, drop);
+    __m128i sub = _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(static_cast<float>(1 << (14 + MANTISSA)))));
+
+    __m128i result = _mm_or_si128(_mm_and_si128(sub_mask, sub), _mm_andnot_si128(sub_mask, normal));
+    result = _mm_or_si128(_mm_and_si128(max_mask, _mm_set1_epi32((30 << MANTISSA) | ((1 << MANTISSA) - 1))),
+        _mm_andnot_si128(max_mask, result));
+    return _mm_andnot_si128(zero_mask, result);
+}
+
+PIXEL_TARGET("ssse3")
+static void float_to_b10g11r11_ssse3(const float* src, uint32_t* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 r = _mm_loadu_ps(src + i * 4);
+        __m128 g = _mm_loadu_ps(src + i * 4 + 4);
+        __m128 b = _mm_loadu_ps(src + i * 4 + 8);
+        __m128 a = _mm_loadu_ps(src + i * 4 + 12);
+        _MM_TRANSPOSE4_PS(r, g, b, a);
+        __m128i packed = _mm_or_si128(_mm_or_si128(to_ufloat_sse<6>(r),
+            _mm_slli_epi32(to_ufloat_sse<6>(g), 11)), _mm_slli_epi32(to_ufloat_sse<5>(b), 22));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+    }
+    float_to_b10g11r11_scalar(src + i * 4, dst + i, count - i);
+}
+
+template<int MANTISSA>
+PIXEL_TARGET("avx2")
+static inline __m256i to_ufloat_avx2(__m256 value)
+{
+    constexpr int drop = 23 - MANTISSA;
+    constexpr int max_bits = (142 << 23) | (((1 << MANTISSA) - 1) << drop);
+    __m256i f = _mm256_castps_si256(value);
+    __m256i zero_mask = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), f),
+        _mm256_cmpgt_epi32(f, _mm256_set1_epi32(0x7f800000)));
+    __m256i max_mask = _mm256_cmpgt_epi32(f, _mm256_set1_epi32(max_bits));
+    __m256i sub_mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(0x38800000), f);
+
+    __m256i normal = _mm256_add_epi32(f, _mm256_set1_epi32(static_cast<int>(0xc8000000u + (1u << (drop - 1)) - 1)));
+    normal = _mm256_add_epi32(normal, _mm256_and_si256(_mm256_srli_epi32(f, drop), _mm256_set1_epi32(1)));
+    normal = _mm256_srli_epi32(normal, drop);
+    __m256i sub = _mm256_cvtps_epi32(_mm256_mul_ps(value, _mm256_set1_ps(static_cast<float>(1 << (14 + MANTISSA)))));
+
+    __m256i result = _mm256_blendv_epi8(normal, sub, sub_mask);
+    result = _mm256_blendv_epi8(result, _mm256_set1_epi32((30 << MANTISSA) | ((1 << MANTISSA) - 1)), max_mask);
+    return _mm256_andnot_si256(zero_mask, result);
+}
+
+PIXEL_TARGET("avx2")
+static void float_to_b10g11r11_avx2(const float* src, uint32_t* dst, size_t count)
+{
+    // the per lane transpose leaves even pixels in the low lane and odd ones in the high lane
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 p01 = _mm256_loadu_ps(src + i * 4);
+        __m256 p23 = _mm256_loadu_ps(src + i * 4 + 8);
+        __m256 p45 = _mm256_loadu_ps(src + i * 4 + 16);
+        __m256 p67 = _mm256_loadu_ps(src + i * 4 + 24);
+        __m256 rg_lo = _mm256_unpacklo_ps(p01, p23); // r0 r2 g0 g2 | r1 r3 g1 g3
+        __m256 rg_hi = _mm256_unpacklo_ps(p45, p67); // r4 r6 g4 g6 | r5 r7 g5 g7
+        __m256 ba_lo = _mm256_unpackhi_ps(p01, p23);
+        __m256 ba_hi = _mm256_unpackhi_ps(p45, p67);
+        __m256 r = _mm256_castpd_ps(_mm256_unpacklo_pd(_mm256_castps_pd(rg_lo), _mm256_castps_pd(rg_hi)));
+        __m256 g = _mm256_castpd_ps(_mm256_unpackhi_pd(_mm256_castps_pd(rg_lo), _mm256_castps_pd(rg_hi)));
+        __m256 b = _mm256_castpd_ps(_mm256_unpacklo_pd(_mm256_castps_pd(ba_lo), _mm256_castps_pd(ba_hi)));
+        __m256i packed = _mm256_or_si256(_mm256_or_si256(to_ufloat_avx2<6>(r),
+            _mm256_slli_epi32(to_ufloat_avx2<6>(g), 11)), _mm256_slli_epi32(to_ufloat_avx2<5>(b), 22));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permutevar8x32_epi32(packed, order));
+    }
+    float_to_b10g11r11_scalar(src + i * 4, dst + i, count - i);
+}
+
+void float_to_b10g11r11(const float* src, uint32_t* dst, size_t count)
+{
+    switch (current_level)
+    {
+    case SimdLevel::AVX2: return float_to_b10g11r11_avx2(src, dst, count);
+    case SimdLevel::SSSE3: return float_to_b10g11r11_ssse3(src, dst, count);
+    default: return float_to_b10g11r11_scalar(src, dst, count);
+    }
+}
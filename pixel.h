@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Pixel conversion kernels used on the texture ingest path. Every kernel has a scalar
+// version and SSE/AVX2 versions picked at runtime from the CPU features, counts are in
+// pixels (or in floats for float_to_half). Unless noted src and dst may be the same buffer.
+enum class SimdLevel
+{
+    Scalar,
+    SSSE3,
+    AVX2, // AVX2 + F16C + FMA
+};
+
+SimdLevel simd_detect();
+SimdLevel simd_level();
+// Forces a lower level, used by the benchmarks to compare the paths.
+void simd_set_level(SimdLevel level);
+const char* simd_name(SimdLevel level);
+
+// RGB8 -> RGBA8 with constant alpha, src and dst must not overlap.
+void rgb_to_rgba(const uint8_t* src, uint8_t* dst, size_t count, uint8_t alpha = 255);
+// RGBA8 <-> BGRA8
+void swizzle_bgra(const uint8_t* src, uint8_t* dst, size_t count);
+// RGBA8, rgb = rgb * a / 255 rounded to nearest
+void premultiply_alpha(const uint8_t* src, uint8_t* dst, size_t count);
+// sRGB RGBA8 -> linear RGBA float, alpha is linear already and only gets normalized
+void srgb_to_linear(const uint8_t* src, float* dst, size_t count);
+// linear RGBA float -> sRGB RGBA8, values are clamped to [0, 1]
+void linear_to_srgb(const float* src, uint8_t* dst, size_t count);
+// float -> IEEE half, round to nearest even, src and dst must not overlap
+void float_to_half(const float* src, uint16_t* dst, size_t count);
+// linear RGBA float -> B10G11R11 unsigned float (eB10G11R11UfloatPack32) with round to nearest even,
+// alpha is dropped, negatives and NaN become 0 and values past the range clamp to the largest finite one.
+// src and dst must not overlap.
+void float_to_b10g11r11(const float* src, uint32_t* dst, size_t count);
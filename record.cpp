@@ -0,0 +1,145 @@
+#include "record.h"
+#include <algorithm>
+
+ParallelRecorder::ParallelRecorder(CommandPoolRing& pools, JobSystem& jobs) : pools(pools), jobs(jobs)
+{
+    secondaries.resize(pools.threads);
+}
+
+void ParallelRecorder::record(vk::CommandBuffer primary, uint32_t slot, const vk::CommandBufferInheritanceInfo& inheritance,
+    uint32_t count, const RecordRange& record)
+{
+    // no empty secondary buffers when there are fewer draws than ranges
+    uint32_t ranges = std::min<uint32_t>(pools.threads, count);
+    if (ranges == 0)
+        return;
+
+    // a range uses only its own pool, whichever worker picks it up
+    parallel_for(jobs, 0, ranges, 1, [&](uint32_t range, uint32_t) {
+        vk::CommandBuffer cmd = pools.get(slot, range).allocate(vk::CommandBufferLevel::eSecondary);
+        vk::CommandBufferBeginInfo begin_info(
+            vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+            &inheritance);
+        cmd.begin(begin_info);
+        record(cmd, (uint64_t)count * range / ranges, (uint64_t)count * (range + 1) / ranges);
+        cmd.end();
+        secondaries[range] = cmd;
+    });
+    primary.executeCommands(ranges, secondaries.data());
+}
+
+CachedCommands::CachedCommands(vk::Device device, uint32_t family_index, uint32_t count)
+{
+    vk::CommandPoolCreateInfo pool_info;
+    pool_info.queueFamilyIndex = family_index;
+    // entries go stale one at a time, so they are reset one at a time
+    pool_info.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    pool = device.createCommandPoolUnique(pool_info);
+    auto cmds = device.allocateCommandBuffersUnique({ *pool, vk::CommandBufferLevel::eSecondary, count });
+    entries.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+        entries[i].cmd = std::move(cmds[i]);
+}
+
+vk::CommandBuffer CachedCommands::get(uint32_t index, const std::vector<uint64_t>& versions,
+    const vk::CommandBufferInheritanceInfo& inheritance, const std::function<void(vk::CommandBuffer)>& record)
+{
+    Entry& entry = entries[index];
+    if (entry.versions == versions)
+    {
+        reused++;
+        return *entry.cmd;
+    }
+    // no eOneTimeSubmit: the buffer is submitted again every frame it stays valid
+    entry.cmd->reset();
+    entry.cmd->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eRenderPassContinue, &inheritance));
+    record(*entry.cmd);
+    entry.cmd->end();
+    entry.versions = versions;
+    recorded++;
+    return *entry.cmd;
+}
+
+void CommandRecorder::bind_pipeline(vk::Pipeline new_pipeline)
+{
+    if (pipeline == new_pipeline)
+    {
+        filtered++;
+        return;
+    }
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, new_pipeline);
+    pipeline = new_pipeline;
+    emitted++;
+}
+
+void CommandRecorder::bind_vertex_buffer(uint32_t binding, vk::Buffer buffer, vk::DeviceSize offset)
+{
+    if (binding < vertex_buffers.size() && vertex_buffers[binding].buffer == buffer && vertex_buffers[binding].offset == offset)
+    {
+        filtered++;
+        return;
+    }
+    cmd.bindVertexBuffers(binding, buffer, offset);
+    if (binding < vertex_buffers.size())
+        vertex_buffers[binding] = { buffer, offset };
+    emitted++;
+}
+
+void CommandRecorder::bind_index_buffer(vk::Buffer buffer, vk::DeviceSize offset, vk::IndexType type)
+{
+    if (index_buffer.buffer == buffer && index_buffer.offset == offset && index_type == type)
+    {
+        filtered++;
+        return;
+    }
+    cmd.bindIndexBuffer(buffer, offset, type);
+    index_buffer = { buffer, offset };
+    index_type = type;
+    emitted++;
+}
+
+void CommandRecorder::bind_descriptor_set(vk::PipelineLayout layout, uint32_t index, vk::DescriptorSet set)
+{
+    bool tracked = index < sets.size();
+    if (tracked && sets[index].layout == layout && sets[index].set == set)
+    {
+        filtered++;
+        return;
+    }
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, index, set, nullptr);
+    if (tracked)
+    {
+        if (sets[index].layout != layout)
+            for (uint32_t i = 0; i < sets.size(); i++)
+                if (i != index)
+                    sets[i] = {};
+        sets[index] = { layout, set };
+    }
+    emitted++;
+}
+
+void CommandRecorder::set_viewport(const vk::Viewport& new_viewport)
+{
+    if (has_viewport && viewport == new_viewport)
+    {
+        filtered++;
+        return;
+    }
+    cmd.setViewport(0, new_viewport);
+    viewport = new_viewport;
+    has_viewport = true;
+    emitted++;
+}
+
+void CommandRecorder::set_scissor(const vk::Rect2D& new_scissor)
+{
+    if (has_scissor && scissor == new_scissor)
+    {
+        filtered++;
+        return;
+    }
+    cmd.setScissor(0, new_scissor);
+    scissor = new_scissor;
+    has_scissor = true;
+    emitted++;
+}
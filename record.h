@@ -0,0 +1,111 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include "cmdpool.h"
+#include "jobs.h"
+#include <array>
+#include <functional>
+#include <vector>
+
+// Records the draws of one subpass split in pools.threads contiguous ranges, each recorded on the
+// job system into a secondary command buffer from the pool of its range in the slot. The primary
+// executes them in range order so the result matches recording on one thread.
+struct ParallelRecorder
+{
+    using RecordRange = std::function<void(vk::CommandBuffer cmd, uint32_t begin, uint32_t end)>;
+
+    CommandPoolRing& pools;
+    JobSystem& jobs;
+    std::vector<vk::CommandBuffer> secondaries;
+
+    ParallelRecorder(CommandPoolRing& pools, JobSystem& jobs);
+
+    ParallelRecorder(const ParallelRecorder&) = delete;
+    ParallelRecorder& operator=(const ParallelRecorder&) = delete;
+
+    // primary must be inside a render pass begun with eSecondaryCommandBuffers matching inheritance.
+    // Secondary buffers inherit no state, record binds whatever its draws need.
+    void record(vk::CommandBuffer primary, uint32_t slot, const vk::CommandBufferInheritanceInfo& inheritance,
+        uint32_t count, const RecordRange& record);
+};
+
+// Secondary command buffers recorded once and executed again every frame until what they depend
+// on changes. The caller passes the versions of everything the recording reads (scene, pipelines,
+// descriptor sets it binds: writing a bound set invalidates the buffer), the entry is re-recorded
+// only when one differs from the last recording. An entry must not be in flight when it is
+// re-recorded, so use one per frame slot.
+struct CachedCommands
+{
+    struct Entry
+    {
+        vk::UniqueCommandBuffer cmd;
+        std::vector<uint64_t> versions; // empty until recorded
+    };
+
+    vk::UniqueCommandPool pool;
+    std::vector<Entry> entries;
+    uint64_t recorded = 0;
+    uint64_t reused = 0;
+
+    CachedCommands(vk::Device device, uint32_t family_index, uint32_t count);
+
+    CachedCommands(const CachedCommands&) = delete;
+    CachedCommands& operator=(const CachedCommands&) = delete;
+
+    // inheritance is only read when the entry is recorded again.
+    vk::CommandBuffer get(uint32_t index, const std::vector<uint64_t>& versions,
+        const vk::CommandBufferInheritanceInfo& inheritance, const std::function<void(vk::CommandBuffer)>& record);
+    void invalidate() { for (auto& entry : entries) entry.versions.clear(); }
+};
+
+// Thin wrapper over a command buffer that remembers the bound graphics state and drops binds
+// that would not change it, so draws can state everything they need without paying for it.
+// State does not carry over between command buffers, start every buffer with a new recorder.
+struct CommandRecorder
+{
+    struct VertexBinding
+    {
+        vk::Buffer buffer;
+        vk::DeviceSize offset = 0;
+    };
+    struct SetBinding
+    {
+        vk::PipelineLayout layout;
+        vk::DescriptorSet set;
+    };
+
+    vk::CommandBuffer cmd;
+    vk::Pipeline pipeline;
+    std::array<VertexBinding, 8> vertex_buffers;
+    VertexBinding index_buffer;
+    vk::IndexType index_type = vk::IndexType::eUint32;
+    std::array<SetBinding, 8> sets;
+    vk::Viewport viewport;
+    vk::Rect2D scissor;
+    bool has_viewport = false;
+    bool has_scissor = false;
+
+    // state calls sent to the driver and dropped as redundant, draws are not counted
+    uint64_t emitted = 0;
+    uint64_t filtered = 0;
+
+    CommandRecorder(vk::CommandBuffer cmd) : cmd(cmd) {}
+
+    void bind_pipeline(vk::Pipeline new_pipeline);
+    void bind_vertex_buffer(uint32_t binding, vk::Buffer buffer, vk::DeviceSize offset = 0);
+    void bind_index_buffer(vk::Buffer buffer, vk::DeviceSize offset, vk::IndexType type);
+    // Binding with another layout than the tracked one forgets every other set, the tracked ones may
+    // have been bound with an incompatible layout and a later bind must not be filtered against them.
+    void bind_descriptor_set(vk::PipelineLayout layout, uint32_t index, vk::DescriptorSet set);
+    void set_viewport(const vk::Viewport& new_viewport);
+    void set_scissor(const vk::Rect2D& new_scissor);
+    // per draw data, never filtered
+    void push_constants(vk::PipelineLayout layout, vk::ShaderStageFlags stages, uint32_t offset, uint32_t size, const void* data)
+    {
+        cmd.pushConstants(layout, stages, offset, size, data);
+    }
+    void draw_indexed(uint32_t index_count, uint32_t instance_count = 1, uint32_t first_index = 0,
+        int32_t vertex_offset = 0, uint32_t first_instance = 0)
+    {
+        cmd.drawIndexed(index_count, instance_count, first_index, vertex_offset, first_instance);
+    }
+};
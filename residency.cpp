@@ -0,0 +1,131 @@
+#include "residency.h"
+#include "resource.h"
+#include "device.h"
+#include "allocator.h"
+#include <algorithm>
+
+ResidencyManager::ResidencyManager(ResourceManager& rm, vk::DeviceSize budget, uint32_t min_age)
+    : rm(rm), budget(budget), min_age(min_age)
+{
+    if (this->budget == 0)
+        this->budget = rm.memory.heap_size(vk::MemoryPropertyFlagBits::eDeviceLocal) / 4 * 3;
+}
+
+void ResidencyManager::track(const std::shared_ptr<ImageResource>& tex)
+{
+    if (find(tex.get()))
+        return;
+    vk::DeviceSize size = tex->mem ? tex->mem->chunk->size : 0;
+    entries.push_back({ tex, frame, size });
+    resident_bytes += size;
+}
+
+ResidencyManager::Entry* ResidencyManager::find(const ImageResource* tex)
+{
+    for (auto& entry : entries)
+        if (entry.tex.lock().get() == tex)
+            return &entry;
+    return nullptr;
+}
+
+void ResidencyManager::reload(Entry& entry, ImageResource& tex, uint32_t base_mip)
+{
+    resident_bytes -= entry.size;
+    rm.reload_texture2D(tex, base_mip);
+    entry.size = tex.mem->chunk->size;
+    resident_bytes += entry.size;
+}
+
+void ResidencyManager::evict(Entry& entry, ImageResource& tex)
+{
+    // frames in flight may still sample it
+    rm.retire(tex);
+    resident_bytes -= entry.size;
+    evicted_bytes += entry.size;
+    entry.size = 0;
+    evictions++;
+}
+
+bool ResidencyManager::use(const std::shared_ptr<ImageResource>& tex)
+{
+    Entry* entry = find(tex.get());
+    if (!entry)
+    {
+        track(tex);
+        entry = find(tex.get());
+    }
+    entry->last_used = frame;
+    if (tex->texture && tex->base_mip == 0)
+    {
+        hits++;
+        return false;
+    }
+    misses++;
+    reload(*entry, *tex, 0);
+    reloaded_bytes += entry->size;
+    enforce();
+    return true;
+}
+
+void ResidencyManager::next_frame()
+{
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [this](const Entry& entry) {
+        if (!entry.tex.expired())
+            return false;
+        resident_bytes -= entry.size;
+        return true;
+    }), entries.end());
+    enforce();
+    frame++;
+}
+
+void ResidencyManager::enforce()
+{
+    if (resident_bytes <= budget)
+        return;
+
+    // textures still streaming are skipped, the streamer writes to their current image
+    std::vector<Entry*> candidates;
+    for (auto& entry : entries)
+    {
+        auto tex = entry.tex.lock();
+        if (tex && entry.size > 0 && entry.last_used + min_age < frame && tex->source
+            && tex->resident_lod <= tex->requested_lod)
+            candidates.push_back(&entry);
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Entry* a, const Entry* b) {
+        return a->last_used < b->last_used;
+    });
+
+    // first pass drops the top mip, about three quarters of each image
+    for (auto entry : candidates)
+    {
+        if (resident_bytes <= budget)
+            return;
+        auto tex = entry->tex.lock();
+        if (tex->info.mipLevels > 1)
+        {
+            vk::DeviceSize before = entry->size;
+            reload(*entry, *tex, tex->base_mip + 1);
+            evicted_bytes += before - entry->size;
+            trims++;
+        }
+    }
+    // second pass evicts whole textures
+    for (auto entry : candidates)
+    {
+        if (resident_bytes <= budget)
+            return;
+        evict(*entry, *entry->tex.lock());
+    }
+}
+
+void ResidencyManager::report(std::ostream& os) const
+{
+    uint64_t lookups = hits + misses;
+    os << "ResidencyManager: " << entries.size() << " textures, "
+        << (resident_bytes >> 20) << "/" << (budget >> 20) << " MiB resident, hit rate "
+        << (lookups ? 100.0 * hits / lookups : 100.0) << "% (" << hits << "/" << lookups << "), "
+        << trims << " trims, " << evictions << " evictions, "
+        << (evicted_bytes >> 20) << " MiB evicted, " << (reloaded_bytes >> 20) << " MiB reloaded\n";
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <memory>
+#include <vector>
+#include <ostream>
+
+struct ResourceManager;
+struct ImageResource;
+
+// Keeps the textures it tracks under a device memory budget. Least recently used textures
+// first lose their top mip, then get evicted entirely; both are reloaded from their
+// TextureSource the next time use() is called on them.
+struct ResidencyManager
+{
+    struct Entry
+    {
+        std::weak_ptr<ImageResource> tex;
+        uint64_t last_used = 0;
+        vk::DeviceSize size = 0; // bytes on the GPU, 0 when evicted
+    };
+
+    ResourceManager& rm;
+    vk::DeviceSize budget;
+    // textures used in the last min_age frames may still be read by the GPU and are never touched
+    uint32_t min_age;
+    uint64_t frame = 0;
+    std::vector<Entry> entries;
+    vk::DeviceSize resident_bytes = 0;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t trims = 0;
+    uint64_t evictions = 0;
+    vk::DeviceSize evicted_bytes = 0;
+    vk::DeviceSize reloaded_bytes = 0;
+
+    // budget 0 takes three quarters of the device local heap
+    ResidencyManager(ResourceManager& rm, vk::DeviceSize budget = 0, uint32_t min_age = 2);
+
+    ResidencyManager(const ResidencyManager&) = delete;
+    ResidencyManager& operator=(const ResidencyManager&) = delete;
+
+    void track(const std::shared_ptr<ImageResource>& tex);
+    // Marks the texture as used this frame and brings it back at full resolution if needed.
+    // Returns true when the image view changed and descriptors must be rewritten.
+    bool use(const std::shared_ptr<ImageResource>& tex);
+    void next_frame();
+    void enforce();
+    void report(std::ostream& os) const;
+    Entry* find(const ImageResource* tex);
+    void reload(Entry& entry, ImageResource& tex, uint32_t base_mip);
+    void evict(Entry& entry, ImageResource& tex);
+};
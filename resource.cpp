@@ -1,138 +1,712 @@
 #include "resource.h"
 #include "device.h"
 #include "allocator.h"
+#include "pack.h"
+#include "atlas.h"
+#include "pixel.h"
+#include <iostream>
+#include <algorithm>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-std::shared_ptr<ImageResource> ResourceManager::create_texture2D(int width, int height, uint8_t* data)
+vk::UniqueShaderModule load_shader(const vk::UniqueDevice& device, const FileData& file)
+{
+    // SPIR-V words must be 4 byte aligned, the read buffer only guarantees it when offset is 0
+    std::vector<uint32_t> code((file.size + 3) / 4);
+    std::copy_n(file.data(), file.size, reinterpret_cast<uint8_t*>(code.data()));
+    vk::ShaderModuleCreateInfo module_info;
+    module_info.codeSize = file.size;
+    module_info.pCode = code.data();
+    return device->createShaderModuleUnique(module_info);
+}
+
+ResourceManager::ResourceManager(Device& device, MemoryAllocator& memory)
+    : device(device), memory(memory), pool(std::make_unique<ThreadPool>())
+{
+    files = std::make_unique<FileSystem>(*pool);
+    jobs = std::make_unique<JobSystem>();
+}
+
+ResourceManager::~ResourceManager()
+{
+    device.scheduler->wait(last_submit);
+    uploads.clear();
+    // the I/O thread posts completions to the pool, stop it first
+    files.reset();
+    pool.reset();
+}
+
+std::shared_ptr<ImageResource> ResourceManager::create_image2D(vk::Format format, uint32_t width, uint32_t height, uint32_t mip_levels,
+    uint32_t layers, vk::ImageViewType view_type, vk::ImageUsageFlags extra_usage, vk::ComponentMapping components)
 {
     auto res = std::make_shared<ImageResource>();
+    create_image2D(*res, format, width, height, mip_levels, layers, view_type, extra_usage, components);
+    return res;
+}
 
-    res->info.imageType = vk::ImageType::e2D;
-    res->info.format = vk::Format::eR8G8B8A8Unorm;
-    res->info.extent = vk::Extent3D(width, height, 1);
-    res->info.mipLevels = 1;
-    res->info.arrayLayers = 1;
-    res->info.samples = vk::SampleCountFlagBits::e1;
-    res->info.tiling = vk::ImageTiling::eLinear;
-    res->info.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
-    res->info.initialLayout = vk::ImageLayout::eUndefined;
-    res->texture = device.device->createImageUnique(res->info);
-    vk::MemoryRequirements tex_mem_req = device.device->getImageMemoryRequirements(*res->texture);
-    res->mem = memory.allocate(tex_mem_req, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    device.device->bindImageMemory(*res->texture, res->mem->chunk->device_memory, res->mem->chunk->offset);
+void ResourceManager::create_image2D(ImageResource& res, vk::Format format, uint32_t width, uint32_t height, uint32_t mip_levels,
+    uint32_t layers, vk::ImageViewType view_type, vk::ImageUsageFlags extra_usage, vk::ComponentMapping components)
+{
+    retire(res);
+    res.info = vk::ImageCreateInfo();
+    res.info.imageType = vk::ImageType::e2D;
+    res.info.format = format;
+    res.info.extent = vk::Extent3D(width, height, 1);
+    res.info.mipLevels = mip_levels;
+    res.info.arrayLayers = layers;
+    res.info.samples = vk::SampleCountFlagBits::e1;
+    res.info.tiling = vk::ImageTiling::eOptimal;
+    res.info.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst | extra_usage;
+#ifdef VK_EXT_host_image_copy
+    if (host_copy_supported(format))
+        res.info.usage |= vk::ImageUsageFlagBits::eHostTransferEXT;
+#endif
+    res.info.initialLayout = vk::ImageLayout::eUndefined;
+    res.texture = device.device->createImageUnique(res.info);
+    vk::MemoryRequirements tex_mem_req = device.device->getImageMemoryRequirements(*res.texture);
+    res.mem = memory.allocate(tex_mem_req, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    device.device->bindImageMemory(*res.texture, res.mem->chunk->device_memory, res.mem->chunk->offset);
 
     vk::ImageViewCreateInfo tex_view_info;
-    tex_view_info.image = *res->texture;
-    tex_view_info.viewType = vk::ImageViewType::e2D;
-    tex_view_info.format = res->info.format;
-    tex_view_info.components = vk::ComponentMapping();
+    tex_view_info.image = *res.texture;
+    tex_view_info.viewType = view_type;
+    tex_view_info.format = res.info.format;
+    tex_view_info.components = components;
     tex_view_info.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
     tex_view_info.subresourceRange.baseMipLevel = 0;
-    tex_view_info.subresourceRange.levelCount = 1;
+    tex_view_info.subresourceRange.levelCount = mip_levels;
     tex_view_info.subresourceRange.baseArrayLayer = 0;
-    tex_view_info.subresourceRange.layerCount = 1;
-    res->view = device.device->createImageViewUnique(tex_view_info);
+    tex_view_info.subresourceRange.layerCount = layers;
+    res.view = device.device->createImageViewUnique(tex_view_info);
+}
 
-    if (data)
+void ResourceManager::upload_image2D(ImageResource& res, const uint8_t* data, vk::DeviceSize size,
+    const std::vector<vk::BufferImageCopy>& regions, vk::ImageLayout old_layout)
+{
+    if (host_upload(res, data, regions, old_layout))
+    {
+        host_copy_bytes += size;
+        return;
+    }
+    upload_image2D(res, size, regions, [&](uint8_t* dst) { std::copy_n(data, size, dst); }, old_layout);
+}
+
+void ResourceManager::upload_image2D(ImageResource& res, vk::DeviceSize size, const std::vector<vk::BufferImageCopy>& regions,
+    const std::function<void(uint8_t*)>& write, vk::ImageLayout old_layout)
+{
+#ifdef VK_EXT_host_image_copy
+    if (res.info.usage & vk::ImageUsageFlagBits::eHostTransferEXT)
     {
-        vk::ImageCreateInfo staging_info;
-        staging_info.imageType = vk::ImageType::e2D;
-        staging_info.format = res->info.format;
-        staging_info.extent = vk::Extent3D(width, height, 1);
-        staging_info.mipLevels = 1;
-        staging_info.arrayLayers = 1;
-        staging_info.samples = vk::SampleCountFlagBits::e1;
-        staging_info.tiling = vk::ImageTiling::eLinear;
-        staging_info.usage = vk::ImageUsageFlagBits::eTransferSrc;
-        staging_info.initialLayout = vk::ImageLayout::ePreinitialized;
-        vk::UniqueImage staging = device.device->createImageUnique(staging_info);
-        vk::MemoryRequirements staging_mem_req = device.device->getImageMemoryRequirements(*staging);
-        auto staging_mem = memory.allocate(staging_mem_req,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-        device.device->bindImageMemory(*staging, staging_mem->chunk->device_memory, staging_mem->chunk->offset);
-        vk::SubresourceLayout staging_layout = device.device->getImageSubresourceLayout(*staging,
-            vk::ImageSubresource(vk::ImageAspectFlagBits::eColor, 0, 0));
-        if (auto map = staging_mem->map(0, VK_WHOLE_SIZE))
+        // the conversion still needs somewhere to land, plain memory is cheaper than a staging buffer and a submit
+        std::vector<uint8_t> pixels(size);
+        write(pixels.data());
+        host_upload(res, pixels.data(), regions, old_layout);
+        host_copy_bytes += size;
+        return;
+    }
+#endif
+    StagingBuffer staging = create_staging(size, write);
+    PendingSubmit submit = submit_async([&](vk::CommandBuffer cmd) {
+        record_upload(cmd, *staging.buffer, res, regions, old_layout);
+    });
+    uploads.push_back({ std::move(submit), std::move(staging) });
+}
+
+StagingBuffer ResourceManager::create_staging(vk::DeviceSize size, const std::function<void(uint8_t*)>& write)
+{
+    StagingBuffer staging;
+    vk::BufferCreateInfo staging_info;
+    staging_info.size = size;
+    staging_info.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    staging.buffer = device.device->createBufferUnique(staging_info);
+    vk::MemoryRequirements staging_mem_req = device.device->getBufferMemoryRequirements(*staging.buffer);
+    staging.mem = memory.allocate(staging_mem_req,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    device.device->bindBufferMemory(*staging.buffer, staging.mem->chunk->device_memory, staging.mem->chunk->offset);
+    if (auto map = staging.mem->map(0, size))
+        write(map.ptr);
+    staging_bytes += size;
+    return staging;
+}
+
+void ResourceManager::record_upload(vk::CommandBuffer cmd, vk::Buffer staging, ImageResource& res,
+    const std::vector<vk::BufferImageCopy>& regions, vk::ImageLayout old_layout)
+{
+    vk::ImageMemoryBarrier barrier;
+    barrier.image = *res.texture;
+    barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor,
+        0, res.info.mipLevels, 0, res.info.arrayLayers);
+    barrier.srcAccessMask = {};
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    cmd.pipelineBarrier(
+        old_layout == vk::ImageLayout::eUndefined
+            ? vk::PipelineStageFlagBits::eTopOfPipe : vk::PipelineStageFlagBits::eFragmentShader,
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlagBits::eByRegion,
+        nullptr, nullptr, barrier);
+
+    cmd.copyBufferToImage(staging, *res.texture, vk::ImageLayout::eTransferDstOptimal, regions);
+
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eFragmentShader,
+        vk::DependencyFlagBits::eByRegion,
+        nullptr, nullptr, barrier);
+}
+
+bool ResourceManager::host_copy_supported(vk::Format format)
+{
+#ifdef VK_EXT_host_image_copy
+    if (!device.host_image_copy || !host_copy)
+        return false;
+    if (auto it = host_copy_formats.find(format); it != host_copy_formats.end())
+        return it->second;
+
+    bool supported = false;
+    auto props = device.physical_device.getFormatProperties2<vk::FormatProperties2, vk::FormatProperties3>(format);
+    if (props.get<vk::FormatProperties3>().optimalTilingFeatures & vk::FormatFeatureFlagBits2::eHostImageTransferEXT)
+    {
+        // skip formats where the host transfer usage would cost GPU sampling performance
+        vk::PhysicalDeviceImageFormatInfo2 image_info;
+        image_info.format = format;
+        image_info.type = vk::ImageType::e2D;
+        image_info.tiling = vk::ImageTiling::eOptimal;
+        image_info.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst
+            | vk::ImageUsageFlagBits::eHostTransferEXT;
+        try
         {
-            for (int row = 0; row < height; row++)
-                std::copy_n(
-                    data + row * width * 4,
-                    width * 4,
-                    map.ptr + row * staging_layout.rowPitch);
+            auto image_props = device.physical_device.getImageFormatProperties2<vk::ImageFormatProperties2,
+                vk::HostImageCopyDevicePerformanceQueryEXT>(image_info);
+            auto& perf = image_props.get<vk::HostImageCopyDevicePerformanceQueryEXT>();
+            supported = perf.optimalDeviceAccess || perf.identicalMemoryLayout;
         }
+        catch (const vk::FormatNotSupportedError&) {}
+    }
+    std::cout << "ResourceManager::host_copy_supported " << vk::to_string(format) << " = " << supported << "\n";
+    host_copy_formats[format] = supported;
+    return supported;
+#else
+    return false;
+#endif
+}
+
+bool ResourceManager::host_upload(ImageResource& res, const uint8_t* data, const std::vector<vk::BufferImageCopy>& regions,
+    vk::ImageLayout old_layout)
+{
+#ifdef VK_EXT_host_image_copy
+    if (!(res.info.usage & vk::ImageUsageFlagBits::eHostTransferEXT))
+        return false;
+    auto transition_image_layout = reinterpret_cast<PFN_vkTransitionImageLayoutEXT>(device.transition_image_layout);
+    auto copy_memory_to_image = reinterpret_cast<PFN_vkCopyMemoryToImageEXT>(device.copy_memory_to_image);
+    VkDevice vk_device = static_cast<VkDevice>(*device.device);
+    VkImage vk_image = static_cast<VkImage>(*res.texture);
 
-        vk::CommandBufferAllocateInfo cmd_tex_info;
-        cmd_tex_info.commandPool = *device.cmd_pool;
-        cmd_tex_info.level = vk::CommandBufferLevel::ePrimary;
-        cmd_tex_info.commandBufferCount = 1;
-        vk::UniqueCommandBuffer cmd_tex = std::move(
-            device.device->allocateCommandBuffersUnique(cmd_tex_info).front());
-        cmd_tex->begin(vk::CommandBufferBeginInfo({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit }));
+    // copy in the layout the image is sampled in when the driver allows it, saving both transitions
+    const auto& layouts = device.host_copy_dst_layouts;
+    vk::ImageLayout copy_layout = std::find(layouts.begin(), layouts.end(), vk::ImageLayout::eShaderReadOnlyOptimal) != layouts.end()
+        ? vk::ImageLayout::eShaderReadOnlyOptimal : vk::ImageLayout::eGeneral;
+    // host transitions are not ordered with the queue, the image must not be in use (same as the staging path)
+    auto transition = [&](vk::ImageLayout from, vk::ImageLayout to) {
+        VkHostImageLayoutTransitionInfoEXT transition_info{ VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT };
+        transition_info.image = vk_image;
+        transition_info.oldLayout = static_cast<VkImageLayout>(from);
+        transition_info.newLayout = static_cast<VkImageLayout>(to);
+        transition_info.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, res.info.mipLevels, 0, res.info.arrayLayers };
+        if (transition_image_layout(vk_device, 1, &transition_info) != VK_SUCCESS)
+            throw std::runtime_error("ResourceManager::host_upload layout transition failed");
+    };
+    if (old_layout != copy_layout)
+        transition(old_layout, copy_layout);
+
+    std::vector<VkMemoryToImageCopyEXT> copies;
+    copies.reserve(regions.size());
+    for (const auto& region : regions)
+    {
+        VkMemoryToImageCopyEXT copy{ VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT };
+        copy.pHostPointer = data + region.bufferOffset;
+        copy.memoryRowLength = region.bufferRowLength;
+        copy.memoryImageHeight = region.bufferImageHeight;
+        copy.imageSubresource = region.imageSubresource;
+        copy.imageOffset = region.imageOffset;
+        copy.imageExtent = region.imageExtent;
+        copies.push_back(copy);
+    }
+    VkCopyMemoryToImageInfoEXT copy_info{ VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT };
+    copy_info.dstImage = vk_image;
+    copy_info.dstImageLayout = static_cast<VkImageLayout>(copy_layout);
+    copy_info.regionCount = static_cast<uint32_t>(copies.size());
+    copy_info.pRegions = copies.data();
+    if (copy_memory_to_image(vk_device, &copy_info) != VK_SUCCESS)
+        throw std::runtime_error("ResourceManager::host_upload copy failed");
+
+    if (copy_layout != vk::ImageLayout::eShaderReadOnlyOptimal)
+        transition(copy_layout, vk::ImageLayout::eShaderReadOnlyOptimal);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ResourceManager::submit_once(const std::function<void(vk::CommandBuffer)>& record)
+{
+    // waits for these commands only, not for the frames in flight on the same queue
+    PendingSubmit submit = submit_async(record);
+    device.scheduler->wait(submit.done);
+}
+
+PendingSubmit ResourceManager::submit_async(const std::function<void(vk::CommandBuffer)>& record)
+{
+    release_uploads();
+    PendingSubmit submit;
+    vk::CommandBufferAllocateInfo cmd_info;
+    cmd_info.commandPool = *device.cmd_pool;
+    cmd_info.level = vk::CommandBufferLevel::ePrimary;
+    cmd_info.commandBufferCount = 1;
+    submit.cmd = std::move(device.device->allocateCommandBuffersUnique(cmd_info).front());
+    submit.cmd->begin(vk::CommandBufferBeginInfo({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit }));
+    record(*submit.cmd);
+    submit.cmd->end();
+
+    submit.done = device.scheduler->submit(0, *submit.cmd);
+    last_submit = submit.done;
+    return submit;
+}
+
+void ResourceManager::release_uploads()
+{
+    uploads.erase(std::remove_if(uploads.begin(), uploads.end(),
+        [&](const InFlightUpload& u) { return device.scheduler->is_complete(u.submit.done); }), uploads.end());
+}
+
+FileData ResourceManager::read_file(const std::string& path)
+{
+    return std::move(files->read_all({ path }).front());
+}
+
+// payloads are already aligned and tightly packed, the offsets map 1:1 into the staging buffer
+static std::vector<vk::BufferImageCopy> pack_regions(const PackEntry& entry)
+{
+    std::vector<vk::BufferImageCopy> regions(entry.mip_count);
+    for (uint32_t level = 0; level < entry.mip_count; level++)
+    {
+        regions[level].bufferOffset = entry.mips[level].offset - entry.data_offset();
+        regions[level].imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+        regions[level].imageExtent = vk::Extent3D(entry.mips[level].width, entry.mips[level].height, 1);
+    }
+    return regions;
+}
+
+task<std::shared_ptr<ImageResource>> ResourceManager::load_texture2D_async(std::string path, int priority,
+    std::shared_ptr<CancelToken> cancel, Executor* caller)
+{
+    Executor& resume_on = caller ? *caller : main_executor;
+    const PackFile* pack = nullptr;
+    const PackEntry* entry = nullptr;
+    for (auto& mounted : packs)
+    {
+        if ((entry = mounted->find(path)))
         {
-            vk::ImageMemoryBarrier barrier;
-            barrier.subresourceRange = tex_view_info.subresourceRange;
-
-            barrier.image = *staging;
-            barrier.srcAccessMask = {};
-            barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
-            barrier.oldLayout = vk::ImageLayout::ePreinitialized;
-            barrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
-            cmd_tex->pipelineBarrier(
-                vk::PipelineStageFlagBits::eAllCommands,
-                vk::PipelineStageFlagBits::eTransfer,
-                vk::DependencyFlagBits::eByRegion,
-                nullptr, nullptr, barrier);
-
-            barrier.image = *res->texture;
-            barrier.srcAccessMask = {};
-            barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-            barrier.oldLayout = vk::ImageLayout::eUndefined;
-            barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
-            cmd_tex->pipelineBarrier(
-                vk::PipelineStageFlagBits::eAllCommands,
-                vk::PipelineStageFlagBits::eTransfer,
-                vk::DependencyFlagBits::eByRegion,
-                nullptr, nullptr, barrier);
-
-            vk::ImageCopy copy;
-            copy.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-            copy.srcSubresource.mipLevel = 0;
-            copy.srcSubresource.baseArrayLayer = 0;
-            copy.srcSubresource.layerCount = 1;
-            copy.dstSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-            copy.dstSubresource.mipLevel = 0;
-            copy.dstSubresource.baseArrayLayer = 0;
-            copy.dstSubresource.layerCount = 1;
-            copy.extent = res->info.extent;
-            cmd_tex->copyImage(*staging, vk::ImageLayout::eTransferSrcOptimal,
-                *res->texture, vk::ImageLayout::eTransferDstOptimal, copy);
-
-            barrier.image = *res->texture;
-            barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-            barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-            barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-            barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-            cmd_tex->pipelineBarrier(
-                vk::PipelineStageFlagBits::eTransfer,
-                vk::PipelineStageFlagBits::eFragmentShader,
-                vk::DependencyFlagBits::eByRegion,
-                nullptr, nullptr, barrier);
+            pack = mounted.get();
+            break;
         }
-        cmd_tex->end();
+    }
+    if (pack && !direct_pack_reads)
+    {
+        // pack entries are mapped and ready to copy, only the upload is left
+        co_await schedule(main_executor, priority);
+        throw_if_cancelled(cancel);
+        auto res = load_texture2D(path);
+        if (&resume_on != &main_executor)
+            co_await schedule(resume_on, priority);
+        co_return res;
+    }
+
+    if (!pack)
+    {
+        // read on the I/O thread, decode on the pool, the same layouts as load_texture2D
+        FileData file = co_await read_async(*files, path, *pool, priority);
+        throw_if_cancelled(cancel);
+        DecodedImage image = decode_image(file, path);
+        file = {};
+        // device objects, the allocator and the queue belong to the main thread
+        co_await schedule(main_executor, priority);
+        throw_if_cancelled(cancel);
+        auto res = create_texture2D(image);
+        co_await wait_gpu(main_executor, *device.scheduler, last_submit);
+        if (&resume_on != &main_executor)
+            co_await schedule(resume_on, priority);
+        co_return res;
+    }
 
-        vk::SubmitInfo cmd_tex_submit_info;
-        cmd_tex_submit_info.setCommandBuffers(*cmd_tex);
-        device.q.submit(cmd_tex_submit_info);
-        device.q.waitIdle();
+    // the payload goes to the GPU once, keep it out of the system cache
+    FileData file = co_await read_async(*files, pack->path, main_executor, priority,
+        entry->data_offset(), entry->data_size(), true);
+    throw_if_cancelled(cancel);
+    std::vector<vk::BufferImageCopy> regions = pack_regions(*entry);
+    vk::DeviceSize size = file.size;
+    auto res = create_image2D(static_cast<vk::Format>(entry->format), entry->width, entry->height, entry->mip_count);
+    if (host_upload(*res, file.data(), regions, vk::ImageLayout::eUndefined))
+        host_copy_bytes += size;
+    else
+    {
+        StagingBuffer staging = create_staging(size, [&](uint8_t* dst) { std::copy_n(file.data(), size, dst); });
+        file = {};
+        PendingSubmit submit = submit_async([&](vk::CommandBuffer cmd) {
+            record_upload(cmd, *staging.buffer, *res, regions, vk::ImageLayout::eUndefined);
+        });
+        co_await wait_gpu(main_executor, *device.scheduler, submit.done);
+    }
+    res->source = load_source(path);
+    if (&resume_on != &main_executor)
+        co_await schedule(resume_on, priority);
+    co_return res;
+}
+
+std::shared_ptr<ImageResource> ResourceManager::create_texture2D(int width, int height, uint8_t* data)
+{
+    auto res = create_image2D(vk::Format::eR8G8B8A8Unorm, width, height, 1);
+    if (data)
+    {
+        vk::BufferImageCopy region;
+        region.bufferOffset = 0;
+        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+        region.imageExtent = res->info.extent;
+        upload_image2D(*res, data, (vk::DeviceSize)width * height * 4, { region });
     }
     return res;
 }
 
+std::shared_ptr<ImageResource> ResourceManager::create_texture2D(const PackFile& pack, const PackEntry& entry)
+{
+    auto res = create_image2D(static_cast<vk::Format>(entry.format), entry.width, entry.height, entry.mip_count);
+    upload_image2D(*res, pack.data(entry), entry.data_size(), pack_regions(entry));
+    return res;
+}
+
 std::shared_ptr<ImageResource> ResourceManager::load_texture2D(const std::string& path)
 {
+    for (auto& pack : packs)
+    {
+        if (auto entry = pack->find(path))
+        {
+            // pack sources are just views in the mapping, keep them around for reloads
+            auto res = create_texture2D(*pack, *entry);
+            res->source = load_source(path);
+            return res;
+        }
+    }
+
+    return create_texture2D(decode_image(read_file(path), path));
+}
+
+DecodedImage ResourceManager::decode_image(const FileData& file, const std::string& path)
+{
+    DecodedImage image;
+    if (stbi_is_hdr_from_memory(file.data(), static_cast<int>(file.size)))
+    {
+        image.source = decode_source(file, path);
+        return image;
+    }
+    int c;
+    if (!stbi_info_from_memory(file.data(), static_cast<int>(file.size), &image.width, &image.height, &c))
+        throw std::runtime_error("ResourceManager::decode_image cannot load " + path);
+    // 1 and 3 channel images keep their layout in the staging buffer,
+    // stb expands 2 channels to RGBA
+    image.channels = c == 2 ? 4 : c;
+    image.pixels.reset(stbi_load_from_memory(file.data(), static_cast<int>(file.size),
+        &image.width, &image.height, &c, image.channels), stbi_image_free);
+    if (!image.pixels)
+        throw std::runtime_error("ResourceManager::decode_image cannot load " + path);
+    return image;
+}
+
+std::shared_ptr<ImageResource> ResourceManager::create_texture2D(const DecodedImage& image)
+{
+    if (image.source)
+    {
+        // float images are packed with their whole mip chain, which then stays around as the source
+        auto res = std::make_shared<ImageResource>();
+        res->source = image.source;
+        reload_texture2D(*res, 0);
+        return res;
+    }
+
+    int w = image.width, h = image.height, channels = image.channels;
+    const uint8_t* data = image.pixels.get();
+    size_t pixels = (size_t)w * h;
+    vk::BufferImageCopy region;
+    region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+    region.imageExtent = vk::Extent3D(w, h, 1);
+
+    if (channels == 1)
+    {
+        // single channel is sampled as grey straight from an R8 image
+        auto res = create_image2D(vk::Format::eR8Unorm, w, h, 1, 1, vk::ImageViewType::e2D, {},
+            vk::ComponentMapping(vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eR,
+                vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eOne));
+        upload_image2D(*res, data, pixels, { region });
+        return res;
+    }
+    if (channels == 3 && gpu_expand)
+        return expand_texture2D(w, h, 3, data);
+
+    // RGB is expanded while writing the staging buffer
+    auto res = create_image2D(vk::Format::eR8G8B8A8Unorm, w, h, 1);
+    upload_image2D(*res, pixels * 4, { region }, [&](uint8_t* dst) {
+        // rows split across the workers, the staging memory is written once by every core
+        parallel_for(*jobs, 0, h, 64, [&](uint32_t row_begin, uint32_t row_end) {
+            size_t first = (size_t)row_begin * w;
+            size_t count = (size_t)(row_end - row_begin) * w;
+            if (channels == 3)
+                rgb_to_rgba(data + first * 3, dst + first * 4, count);
+            else if (premultiplied)
+                premultiply_alpha(data + first * 4, dst + first * 4, count);
+            else
+                std::copy_n(data + first * 4, count * 4, dst + first * 4);
+        });
+    });
+    return res;
+}
+
+void ResourceManager::create_expand_pipeline()
+{
+    std::vector<vk::DescriptorSetLayoutBinding> descrset_layout_bindings{
+        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute),
+    };
+    vk::DescriptorSetLayoutCreateInfo descrset_layout_info;
+    descrset_layout_info.setBindings(descrset_layout_bindings);
+    expand_descrset_layout = device.device->createDescriptorSetLayoutUnique(descrset_layout_info);
+
+    vk::PushConstantRange push_range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(uint32_t) * 3);
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setSetLayouts(*expand_descrset_layout);
+    pipeline_layout_info.setPushConstantRanges(push_range);
+    expand_pipeline_layout = device.device->createPipelineLayoutUnique(pipeline_layout_info);
+
+    auto module = load_shader(device.device, read_file("shaders/expand-comp.glsl.spv"));
+    vk::ComputePipelineCreateInfo pipeline_info;
+    pipeline_info.stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, *module, "main");
+    pipeline_info.layout = *expand_pipeline_layout;
+    expand_pipeline = device.device->createComputePipelineUnique(nullptr, pipeline_info).value;
+
+    std::vector<vk::DescriptorPoolSize> descrpool_sizes{
+        vk::DescriptorPoolSize{vk::DescriptorType::eStorageBuffer, 1},
+        vk::DescriptorPoolSize{vk::DescriptorType::eStorageImage, 1},
+    };
+    vk::DescriptorPoolCreateInfo descrpool_info;
+    descrpool_info.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+    descrpool_info.maxSets = 1;
+    descrpool_info.setPoolSizes(descrpool_sizes);
+    expand_descrpool = device.device->createDescriptorPoolUnique(descrpool_info);
+
+    vk::DescriptorSetAllocateInfo descrset_info;
+    descrset_info.descriptorPool = *expand_descrpool;
+    descrset_info.setSetLayouts(*expand_descrset_layout);
+    expand_descrset = std::move(device.device->allocateDescriptorSetsUnique(descrset_info).front());
+}
+
+std::shared_ptr<ImageResource> ResourceManager::expand_texture2D(int width, int height, int channels, const uint8_t* data)
+{
+    if (!expand_pipeline)
+        create_expand_pipeline();
+
+    auto res = create_image2D(vk::Format::eR8G8B8A8Unorm, width, height, 1, 1, vk::ImageViewType::e2D,
+        vk::ImageUsageFlagBits::eStorage);
+
+    // the shader reads whole words
+    vk::DeviceSize size = ((vk::DeviceSize)width * height * channels + 3) & ~3ull;
+    vk::BufferCreateInfo staging_info;
+    staging_info.size = size;
+    staging_info.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+    vk::UniqueBuffer staging = device.device->createBufferUnique(staging_info);
+    vk::MemoryRequirements staging_mem_req = device.device->getBufferMemoryRequirements(*staging);
+    auto staging_mem = memory.allocate(staging_mem_req,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    device.device->bindBufferMemory(*staging, staging_mem->chunk->device_memory, staging_mem->chunk->offset);
+    if (auto map = staging_mem->map(0, size))
+        std::copy_n(data, (size_t)width * height * channels, map.ptr);
+    staging_bytes += size;
+
+    vk::DescriptorBufferInfo src_info(*staging, 0, size);
+    vk::DescriptorImageInfo dst_info(nullptr, *res->view, vk::ImageLayout::eGeneral);
+    std::vector<vk::WriteDescriptorSet> descr_sets_write{
+        vk::WriteDescriptorSet(*expand_descrset, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &src_info, nullptr),
+        vk::WriteDescriptorSet(*expand_descrset, 1, 0, 1, vk::DescriptorType::eStorageImage, &dst_info, nullptr, nullptr),
+    };
+    device.device->updateDescriptorSets(descr_sets_write, nullptr);
+
+    submit_once([&](vk::CommandBuffer cmd) {
+        vk::ImageMemoryBarrier barrier;
+        barrier.image = *res->texture;
+        barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+        barrier.srcAccessMask = {};
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+        barrier.oldLayout = vk::ImageLayout::eUndefined;
+        barrier.newLayout = vk::ImageLayout::eGeneral;
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTopOfPipe,
+            vk::PipelineStageFlagBits::eComputeShader,
+            {}, nullptr, nullptr, barrier);
+
+        uint32_t params[3] = { (uint32_t)width, (uint32_t)height, (uint32_t)channels };
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *expand_pipeline);
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *expand_pipeline_layout, 0, *expand_descrset, nullptr);
+        cmd.pushConstants(*expand_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(params), params);
+        cmd.dispatch((width + 7) / 8, (height + 7) / 8, 1);
+
+        barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        barrier.oldLayout = vk::ImageLayout::eGeneral;
+        barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eFragmentShader,
+            {}, nullptr, nullptr, barrier);
+    });
+    return res;
+}
+
+std::shared_ptr<TextureSource> ResourceManager::load_source(const std::string& path)
+{
+    auto source = std::make_shared<TextureSource>();
+    for (auto& pack : packs)
+    {
+        if (auto entry = pack->find(path))
+        {
+            source->format = static_cast<vk::Format>(entry->format);
+            for (uint32_t level = 0; level < entry->mip_count; level++)
+            {
+                const PackMip& mip = entry->mips[level];
+                source->mips.push_back({ pack->base + mip.offset, mip.size, mip.width, mip.height });
+            }
+            return source;
+        }
+    }
+    return decode_source(read_file(path), path);
+}
+
+std::shared_ptr<TextureSource> ResourceManager::decode_source(const FileData& file, const std::string& path)
+{
+    auto source = std::make_shared<TextureSource>();
+    int w, h, c;
+    if (stbi_is_hdr_from_memory(file.data(), static_cast<int>(file.size)))
+    {
+        std::unique_ptr<float, decltype(&stbi_image_free)> data(
+            stbi_loadf_from_memory(file.data(), static_cast<int>(file.size), &w, &h, &c, 4), stbi_image_free);
+        if (!data)
+            throw std::runtime_error("ResourceManager::load_source cannot load " + path);
+        source->format = float_format(c, hdr_compact);
+        source->storage = build_float_mips(data.get(), w, h, source->format, mip_count(w, h));
+        uint32_t mip_w = w, mip_h = h;
+        for (auto& mip : source->storage)
+        {
+            source->mips.push_back({ mip.data(), mip.size(), mip_w, mip_h });
+            mip_w = mip_w > 1 ? mip_w / 2 : 1;
+            mip_h = mip_h > 1 ? mip_h / 2 : 1;
+        }
+        return source;
+    }
+    std::unique_ptr<uint8_t, decltype(&stbi_image_free)> data(
+        stbi_load_from_memory(file.data(), static_cast<int>(file.size), &w, &h, &c, 4), stbi_image_free);
+    if (!data)
+        throw std::runtime_error("ResourceManager::load_source cannot load " + path);
+    source->format = vk::Format::eR8G8B8A8Unorm;
+    source->storage.emplace_back(data.get(), data.get() + w * h * 4);
+    uint32_t mip_w = w, mip_h = h, levels = mip_count(w, h);
+    for (uint32_t level = 0; level < levels; level++)
+    {
+        if (level > 0)
+        {
+            source->storage.push_back(downsample_rgba8(source->storage.back().data(), mip_w, mip_h));
+            mip_w = mip_w > 1 ? mip_w / 2 : 1;
+            mip_h = mip_h > 1 ? mip_h / 2 : 1;
+        }
+        source->mips.push_back({ nullptr, source->storage.back().size(), mip_w, mip_h });
+    }
+    for (size_t level = 0; level < source->mips.size(); level++)
+        source->mips[level].data = source->storage[level].data();
+    return source;
+}
+
+void ResourceManager::reload_texture2D(ImageResource& res, uint32_t base_mip)
+{
+    const auto& mips = res.source->mips;
+    create_image2D(res, res.source->format, mips[base_mip].width, mips[base_mip].height,
+        static_cast<uint32_t>(mips.size()) - base_mip);
+    vk::DeviceSize size = 0;
+    std::vector<vk::BufferImageCopy> regions;
+    for (uint32_t level = base_mip; level < mips.size(); level++)
+    {
+        vk::BufferImageCopy region;
+        region.bufferOffset = (size + 15) & ~15ull;
+        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level - base_mip, 0, 1);
+        region.imageExtent = vk::Extent3D(mips[level].width, mips[level].height, 1);
+        regions.push_back(region);
+        size = region.bufferOffset + mips[level].size;
+    }
+    // the mips are copied straight into the staging buffer
+    upload_image2D(res, size, regions, [&](uint8_t* dst) {
+        for (uint32_t level = base_mip; level < mips.size(); level++)
+            std::copy_n(mips[level].data, mips[level].size, dst + regions[level - base_mip].bufferOffset);
+    });
+    res.base_mip = base_mip;
+    res.resident_lod = 0;
+}
+
+std::shared_ptr<AtlasEntry> ResourceManager::load_atlas_texture(const std::string& path)
+{
+    FileData file = read_file(path);
     int w, h, c;
-    std::unique_ptr<uint8_t> data(stbi_load(path.c_str(), &w, &h, &c, 4));
-    return create_texture2D(w, h, data.get());
+    std::unique_ptr<uint8_t, decltype(&stbi_image_free)> data(
+        stbi_load_from_memory(file.data(), static_cast<int>(file.size), &w, &h, &c, 4), stbi_image_free);
+    if (!data)
+        throw std::runtime_error("ResourceManager::load_atlas_texture cannot load " + path);
+    if ((uint32_t)w > atlas_max_size || (uint32_t)h > atlas_max_size)
+        throw std::runtime_error("ResourceManager::load_atlas_texture too big for the atlas " + path);
+    if (!atlas)
+        atlas = std::make_unique<TextureAtlas>(*this);
+    return atlas->insert(w, h, data.get());
+}
+
+void ResourceManager::retire(ImageResource& res)
+{
+    if (!res.texture)
+        return;
+    retired.push_back({ frame, std::move(res.mem), std::move(res.texture), std::move(res.view) });
+}
+
+void ResourceManager::collect(uint64_t completed_frames)
+{
+    retired.erase(std::remove_if(retired.begin(), retired.end(),
+        [&](const Retired& r) { return r.frame < completed_frames; }), retired.end());
+    release_uploads();
+}
+
+void ResourceManager::mount_pack(const std::string& path)
+{
+    packs.push_back(std::make_unique<PackFile>(path));
+}
+
+vk::Sampler ResourceManager::sampler(uint32_t min_lod)
+{
+    auto& sampler = samplers[min_lod];
+    if (!sampler)
+    {
+        vk::SamplerCreateInfo sampler_info;
+        sampler_info.minFilter = vk::Filter::eLinear;
+        sampler_info.magFilter = vk::Filter::eLinear;
+        sampler_info.mipmapMode = vk::SamplerMipmapMode::eLinear;
+        sampler_info.minLod = (float)min_lod;
+        sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+        sampler = device.device->createSamplerUnique(sampler_info);
+    }
+    return *sampler;
 }
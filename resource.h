@@ -1,10 +1,22 @@
 #pragma once
 #include <vulkan/vulkan.hpp>
+#include "task.h"
+#include "executor.h"
+#include "jobs.h"
+#include "vfs.h"
 #include <memory>
+#include <functional>
+#include <string>
+#include <vector>
+#include <map>
 
 struct Device;
 struct MemoryAllocator;
 struct MemoryRef;
+struct PackFile;
+struct PackEntry;
+struct TextureAtlas;
+struct AtlasEntry;
 
 struct Resource
 {
@@ -13,27 +25,175 @@ struct Resource
     Resource& operator=(const Resource&) = delete;
 };
 
+struct MipSource
+{
+    const uint8_t* data;
+    vk::DeviceSize size;
+    uint32_t width;
+    uint32_t height;
+};
+
+// CPU side pixels of a texture, either views into a mounted pack or a decoded mip chain owned here
+struct TextureSource
+{
+    vk::Format format;
+    std::vector<MipSource> mips;
+    std::vector<std::vector<uint8_t>> storage;
+};
+
+// Loose image file decoded on any thread, create_texture2D turns it into a texture on the main thread
+struct DecodedImage
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0; // 1, 3 or 4, the layout staged
+    std::shared_ptr<uint8_t> pixels;
+    // float images, packed with their whole mip chain
+    std::shared_ptr<TextureSource> source;
+};
+
 struct ImageResource : public Resource
 {
     std::shared_ptr<MemoryRef> mem;
     vk::UniqueImage texture;
     vk::UniqueImageView view;
     vk::ImageCreateInfo info;
+    std::shared_ptr<TextureSource> source;
+    // image level 0 is source mip base_mip, raised when the residency manager trims the top mips
+    uint32_t base_mip = 0;
+    // mips [resident_lod, mipLevels) hold valid data, streaming goes down to requested_lod
+    uint32_t resident_lod = 0;
+    uint32_t requested_lod = 0;
+};
+
+struct StagingBuffer
+{
+    vk::UniqueBuffer buffer;
+    std::shared_ptr<MemoryRef> mem;
+};
+
+// Commands in flight, cmd must outlive the wait on done
+struct PendingSubmit
+{
+    vk::UniqueCommandBuffer cmd;
+    TimelinePoint done;
 };
 
+vk::UniqueShaderModule load_shader(const vk::UniqueDevice& device, const FileData& file);
+
 struct ResourceManager
 {
     Device& device;
     MemoryAllocator& memory;
+    std::vector<std::unique_ptr<PackFile>> packs;
+    std::map<uint32_t/*min_lod*/, vk::UniqueSampler> samplers;
+    std::unique_ptr<TextureAtlas> atlas;
+    uint32_t atlas_max_size = 256;
+    // load_texture2D stores loose images with premultiplied alpha
+    bool premultiplied = false;
+    // HDR images without alpha are stored as B10G11R11 instead of RGBA16F
+    bool hdr_compact = true;
+    // RGB images are staged with 3 channels and expanded to RGBA by a compute pass
+    bool gpu_expand = true;
+    vk::DeviceSize staging_bytes = 0;
+    // with VK_EXT_host_image_copy images are written by the CPU straight from memory, no staging or submit
+    bool host_copy = true;
+    std::map<vk::Format, bool> host_copy_formats;
+    vk::DeviceSize host_copy_bytes = 0;
+
+    // channel expansion pass, created on first use
+    vk::UniqueDescriptorSetLayout expand_descrset_layout;
+    vk::UniquePipelineLayout expand_pipeline_layout;
+    vk::UniquePipeline expand_pipeline;
+    vk::UniqueDescriptorPool expand_descrpool;
+    vk::UniqueDescriptorSet expand_descrset;
 
-    ResourceManager(Device& device, MemoryAllocator& memory)
-        : device(device), memory(memory) {}
+    // Image handles replaced while earlier frames may still sample them, kept until those frames completed.
+    struct Retired
+    {
+        uint64_t frame;
+        std::shared_ptr<MemoryRef> mem;
+        vk::UniqueImage image;
+        vk::UniqueImageView view;
+    };
+    std::vector<Retired> retired;
+    // index of the frame being recorded, advanced by the render loop
+    uint64_t frame = 0;
+
+    // Staging uploads are submitted without waiting, buffers and commands are freed once done is reached.
+    struct InFlightUpload
+    {
+        PendingSubmit submit;
+        StagingBuffer staging;
+    };
+    std::vector<InFlightUpload> uploads;
+    // reached once everything the manager submitted completed, frames sampling its images wait on it
+    TimelinePoint last_submit;
+
+    // read pack payloads in load_texture2D_async unbuffered instead of copying from the mapping
+    bool direct_pack_reads = false;
+
+    // async loads decode on the pool and touch the device on main_executor, pumped by the render loop.
+    // files and pool are torn down first, in that order, by the destructor.
+    MainExecutor main_executor;
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<FileSystem> files;
+    // CPU work split across cores (pixel conversion, culling, recording), the creating thread is worker 0
+    std::unique_ptr<JobSystem> jobs;
+
+    ResourceManager(Device& device, MemoryAllocator& memory);
+    ~ResourceManager();
 
     ResourceManager(const ResourceManager&) = delete;
     ResourceManager& operator=(const ResourceManager&) = delete;
 
+    std::shared_ptr<ImageResource> create_image2D(vk::Format format, uint32_t width, uint32_t height, uint32_t mip_levels,
+        uint32_t layers = 1, vk::ImageViewType view_type = vk::ImageViewType::e2D,
+        vk::ImageUsageFlags extra_usage = {}, vk::ComponentMapping components = {});
+    void create_image2D(ImageResource& res, vk::Format format, uint32_t width, uint32_t height, uint32_t mip_levels,
+        uint32_t layers = 1, vk::ImageViewType view_type = vk::ImageViewType::e2D,
+        vk::ImageUsageFlags extra_usage = {}, vk::ComponentMapping components = {});
+    // old_layout eUndefined discards the previous content, pass eShaderReadOnlyOptimal to update parts of an image
+    void upload_image2D(ImageResource& res, const uint8_t* data, vk::DeviceSize size,
+        const std::vector<vk::BufferImageCopy>& regions, vk::ImageLayout old_layout = vk::ImageLayout::eUndefined);
+    // write fills the mapped staging buffer directly, so conversions need no intermediate copy
+    void upload_image2D(ImageResource& res, vk::DeviceSize size, const std::vector<vk::BufferImageCopy>& regions,
+        const std::function<void(uint8_t*)>& write, vk::ImageLayout old_layout = vk::ImageLayout::eUndefined);
+    bool host_copy_supported(vk::Format format);
+    // Copies regions (offsets relative to data) with the host, returns false if res was not created for it.
+    bool host_upload(ImageResource& res, const uint8_t* data, const std::vector<vk::BufferImageCopy>& regions,
+        vk::ImageLayout old_layout);
     std::shared_ptr<ImageResource> create_texture2D(int width, int height, uint8_t* data);
+    std::shared_ptr<ImageResource> create_texture2D(const PackFile& pack, const PackEntry& entry);
+    // Stages width * height * channels bytes and expands them to RGBA8 on the GPU.
+    std::shared_ptr<ImageResource> expand_texture2D(int width, int height, int channels, const uint8_t* data);
+    void create_expand_pipeline();
     std::shared_ptr<ImageResource> load_texture2D(const std::string& path);
+    // CPU half of loading a loose image, safe on the pool. Throws if the file is not an image.
+    DecodedImage decode_image(const FileData& file, const std::string& path);
+    std::shared_ptr<ImageResource> create_texture2D(const DecodedImage& image);
+    // Reads and decodes on the pool, uploads without blocking the queue and continues on caller
+    // (main_executor by default) with the texture. Higher priorities are decoded and uploaded first.
+    task<std::shared_ptr<ImageResource>> load_texture2D_async(std::string path, int priority = 0,
+        std::shared_ptr<CancelToken> cancel = {}, Executor* caller = nullptr);
+    std::shared_ptr<TextureSource> load_source(const std::string& path);
+    std::shared_ptr<TextureSource> decode_source(const FileData& file, const std::string& path);
+    // Blocking read through files, resolved against its mounted directories.
+    FileData read_file(const std::string& path);
+    // Recreates the GPU image from res.source starting at base_mip, uploading every level.
+    void reload_texture2D(ImageResource& res, uint32_t base_mip);
+    void mount_pack(const std::string& path);
+    // Small images (up to atlas_max_size) share the layers of one atlas image, call atlas->flush() before drawing.
+    std::shared_ptr<AtlasEntry> load_atlas_texture(const std::string& path);
+    vk::Sampler sampler(uint32_t min_lod = 0);
+    // Moves the GPU objects of res out to be destroyed by collect() once the current frame completed.
+    void retire(ImageResource& res);
+    void collect(uint64_t completed_frames);
+    void release_uploads();
+    StagingBuffer create_staging(vk::DeviceSize size, const std::function<void(uint8_t*)>& write);
+    void record_upload(vk::CommandBuffer cmd, vk::Buffer staging, ImageResource& res,
+        const std::vector<vk::BufferImageCopy>& regions, vk::ImageLayout old_layout);
+    void submit_once(const std::function<void(vk::CommandBuffer)>& record);
+    // Like submit_once without waiting, done is reached when the commands completed.
+    PendingSubmit submit_async(const std::function<void(vk::CommandBuffer)>& record);
 };
-
-
@@ -0,0 +1,42 @@
+#version 450
+
+layout(location = 0) in vec3 v_pos;
+layout(location = 1) in vec3 v_col;
+layout(location = 2) in vec2 v_uvs;
+
+layout(set = 0, binding = 0) uniform ubo_t{
+    mat4 model;
+} ubo;
+
+struct object_t
+{
+    vec4 sphere;
+    vec4 position; // xyz, rotation around z
+    vec4 scale;    // half extents
+    vec4 tint;
+};
+
+// same buffer the culling pass read, gl_InstanceIndex is the first_instance it wrote
+layout(set = 1, binding = 0) readonly buffer objects_t
+{
+    object_t objects[];
+};
+
+layout(push_constant) uniform push_t{
+    mat4 view_proj;
+} pc;
+
+layout(location = 0) out vec3 f_col;
+layout(location = 1) out vec2 f_uvs;
+
+void main()
+{
+    object_t object = objects[gl_InstanceIndex];
+    vec3 pos = (ubo.model * vec4(v_pos, 1.0)).xyz * object.scale.xyz;
+    float c = cos(object.position.w);
+    float s = sin(object.position.w);
+    pos.xy = mat2(c, s, -s, c) * pos.xy;
+    gl_Position = pc.view_proj * vec4(object.position.xyz + pos, 1.0);
+    f_col = v_col * object.tint.rgb;
+    f_uvs = v_uvs;
+}
@@ -0,0 +1,27 @@
+#version 450
+
+layout(location = 0) in vec3 v_pos;
+layout(location = 1) in vec3 v_col;
+layout(location = 2) in vec2 v_uvs;
+// per instance: x, y, scale, rotation and a tint
+layout(location = 3) in vec4 i_transform;
+layout(location = 4) in vec4 i_tint;
+
+// shared by every instance
+layout(binding = 0) uniform ubo_t{
+    mat4 model;
+} ubo;
+
+layout(location = 0) out vec3 f_col;
+layout(location = 1) out vec2 f_uvs;
+
+void main()
+{
+    vec4 pos = ubo.model * vec4(v_pos, 1.0);
+    float c = cos(i_transform.w);
+    float s = sin(i_transform.w);
+    pos.xy = i_transform.xy + i_transform.z * (mat2(c, s, -s, c) * pos.xy);
+    gl_Position = pos;
+    f_col = v_col * i_tint.rgb;
+    f_uvs = v_uvs;
+}
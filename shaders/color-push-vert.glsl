@@ -0,0 +1,22 @@
+#version 450
+
+layout(location = 0) in vec3 v_pos;
+layout(location = 1) in vec3 v_col;
+layout(location = 2) in vec2 v_uvs;
+
+// per draw data, one pushConstants per draw instead of a uniform buffer update
+layout(push_constant) uniform push_t{
+    mat4 model;
+    uint index;
+} pc;
+
+layout(location = 0) out vec3 f_col;
+layout(location = 1) out vec2 f_uvs;
+
+void main()
+{
+    gl_Position = pc.model * vec4(v_pos, 1.0);
+    // vary the vertex color per draw so neighbours can be told apart
+    f_col = v_col * (0.5 + 0.5 * fract(float(pc.index) * 0.618034));
+    f_uvs = v_uvs;
+}
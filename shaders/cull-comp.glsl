@@ -0,0 +1,131 @@
+#version 450
+
+layout(local_size_x = 64) in;
+
+struct object_t
+{
+    vec4 sphere;   // center, radius
+    vec4 position; // xyz, rotation around z
+    vec4 scale;    // half extents
+    vec4 tint;
+};
+
+// VkDrawIndexedIndirectCommand
+struct draw_t
+{
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int vertex_offset;
+    uint first_instance;
+};
+
+layout(binding = 0) readonly buffer objects_t
+{
+    object_t objects[];
+};
+
+// the first pass draws at [0, capacity), the late pass at [capacity, 2 capacity)
+layout(binding = 1) writeonly buffer draws_t
+{
+    draw_t draws[];
+};
+
+// cleared before the first pass
+layout(binding = 2) buffer counts_t
+{
+    uint draw_count;
+    uint late_draw_count;
+    uint frustum_culled;
+    uint occluded;
+};
+
+layout(binding = 3) uniform params_t
+{
+    vec4 planes[6];
+    mat4 view_proj;
+    vec2 pyramid_size;
+    uint object_count;
+    uint index_count;
+    uint capacity;
+} params;
+
+// objects hidden in the first pass, tested again by the late one
+layout(binding = 4) buffer flags_t
+{
+    uint hidden[];
+};
+
+// max depth pyramid, sampled with a max reduction sampler
+layout(binding = 5) uniform sampler2D pyramid;
+
+layout(push_constant) uniform pass_t
+{
+    uint late;
+} pass;
+
+bool is_occluded(object_t object)
+{
+    // screen rectangle and nearest depth of the 8 corners of the box
+    float c = cos(object.position.w);
+    float s = sin(object.position.w);
+    vec2 lo = vec2(1.0);
+    vec2 hi = vec2(-1.0);
+    float near_depth = 1.0;
+    for (int i = 0; i < 8; i++)
+    {
+        vec3 corner = vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0) * object.scale.xyz;
+        corner.xy = mat2(c, s, -s, c) * corner.xy;
+        vec4 clip = params.view_proj * vec4(object.position.xyz + corner, 1.0);
+        // crossing the camera plane, the rectangle is unbounded
+        if (clip.w <= 0.0)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        lo = min(lo, ndc.xy);
+        hi = max(hi, ndc.xy);
+        near_depth = min(near_depth, ndc.z);
+    }
+    lo = clamp(lo * 0.5 + 0.5, 0.0, 1.0);
+    hi = clamp(hi * 0.5 + 0.5, 0.0, 1.0);
+    // the level where the rectangle is at most one texel wide, the 2x2 fetch around its center covers it
+    vec2 size = (hi - lo) * params.pyramid_size;
+    float level = ceil(log2(max(max(size.x, size.y), 1.0)));
+    float far_depth = textureLod(pyramid, (lo + hi) * 0.5, level).x;
+    return near_depth > far_depth;
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= params.object_count)
+        return;
+    object_t object = objects[i];
+
+    if (pass.late != 0)
+    {
+        if (hidden[i] == 0 || is_occluded(object))
+            return;
+        uint slot = atomicAdd(late_draw_count, 1);
+        draws[params.capacity + slot] = draw_t(params.index_count, 1, 0, 0, i);
+        return;
+    }
+
+    hidden[i] = 0;
+    for (int p = 0; p < 6; p++)
+    {
+        if (dot(params.planes[p].xyz, object.sphere.xyz) + params.planes[p].w < -object.sphere.w)
+        {
+            atomicAdd(frustum_culled, 1);
+            return;
+        }
+    }
+    if (is_occluded(object))
+    {
+        hidden[i] = 1;
+        atomicAdd(occluded, 1);
+        return;
+    }
+    // survivors are packed at the front, first_instance lets the vertex shader find its object
+    uint slot = atomicAdd(draw_count, 1);
+    draws[slot] = draw_t(params.index_count, 1, 0, 0, i);
+}
@@ -0,0 +1,35 @@
+#version 450
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// tightly packed 8 bit channels, read as words
+layout(binding = 0) readonly buffer src_t
+{
+    uint data[];
+} src;
+
+layout(binding = 1, rgba8) uniform writeonly image2D dst;
+
+layout(push_constant) uniform params_t
+{
+    uint width;
+    uint height;
+    uint channels;
+} params;
+
+float fetch(uint index)
+{
+    return float((src.data[index >> 2] >> ((index & 3) * 8)) & 0xff) / 255.0;
+}
+
+void main()
+{
+    uvec2 p = gl_GlobalInvocationID.xy;
+    if (p.x >= params.width || p.y >= params.height)
+        return;
+    uint base = (p.y * params.width + p.x) * params.channels;
+    vec4 color = vec4(0, 0, 0, 1);
+    for (uint c = 0; c < params.channels; c++)
+        color[c] = fetch(base + c);
+    imageStore(dst, ivec2(p), color);
+}
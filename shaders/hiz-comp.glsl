@@ -0,0 +1,21 @@
+#version 450
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// max reduction sampler: a linear fetch returns the farthest depth of its 2x2 footprint
+layout(binding = 0) uniform sampler2D src;
+layout(binding = 1, r32f) uniform writeonly image2D dst;
+
+layout(push_constant) uniform params_t
+{
+    uvec2 size;
+} params;
+
+void main()
+{
+    uvec2 p = gl_GlobalInvocationID.xy;
+    if (p.x >= params.size.x || p.y >= params.size.y)
+        return;
+    float depth = textureLod(src, (vec2(p) + 0.5) / vec2(params.size), 0.0).x;
+    imageStore(dst, ivec2(p), vec4(depth));
+}
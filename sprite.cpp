@@ -0,0 +1,112 @@
+#include "sprite.h"
+#include "resource.h"
+#include "device.h"
+#include "allocator.h"
+#include "record.h"
+#include <algorithm>
+#include <cmath>
+
+SpriteBatcher::SpriteBatcher(ResourceManager& rm, uint32_t capacity, uint32_t frames_in_flight)
+    : rm(rm), capacity(capacity)
+{
+    vk::DeviceSize indices_size = sizeof(uint32_t) * 6 * capacity;
+    vertices_offset = (indices_size + 0xff) & ~vk::DeviceSize(0xff);
+    vk::BufferCreateInfo buffer_info;
+    buffer_info.size = vertices_offset + sizeof(sprite_vertex_t) * 4 * capacity * frames_in_flight;
+    buffer_info.usage = vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eVertexBuffer;
+    buffer = rm.device.device->createBufferUnique(buffer_info);
+    mem = rm.memory.allocate(rm.device.device->getBufferMemoryRequirements(*buffer),
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    rm.device.device->bindBufferMemory(*buffer, mem->chunk->device_memory, mem->chunk->offset);
+
+    // every sprite is the same two triangles, only the vertex offset of the batch differs
+    if (auto map = mem->map<uint32_t>(0, indices_size))
+    {
+        for (uint32_t i = 0; i < capacity; i++)
+        {
+            uint32_t* quad = map.ptr + i * 6;
+            uint32_t v = i * 4;
+            quad[0] = v; quad[1] = v + 1; quad[2] = v + 2;
+            quad[3] = v; quad[4] = v + 2; quad[5] = v + 3;
+        }
+    }
+    pending.reserve(4 * std::min<uint32_t>(capacity, 4096));
+}
+
+void SpriteBatcher::begin(CommandRecorder& recorder, uint32_t frame_slot, vk::Pipeline sprite_pipeline, vk::PipelineLayout sprite_layout)
+{
+    frame_start = std::chrono::steady_clock::now();
+    rec = &recorder;
+    slot = frame_slot;
+    pipeline = sprite_pipeline;
+    layout = sprite_layout;
+    flushed = 0;
+    texture = nullptr;
+    pending.clear();
+}
+
+void SpriteBatcher::draw(vk::DescriptorSet sprite_texture, const Sprite& sprite)
+{
+    if (sprite_texture != texture)
+    {
+        flush();
+        texture = sprite_texture;
+    }
+    if (flushed + pending.size() / 4 >= capacity)
+        throw std::runtime_error("SpriteBatcher::draw more sprites than capacity");
+
+    glm::vec2 half = sprite.size * 0.5f;
+    float c = std::cos(sprite.rotation);
+    float s = std::sin(sprite.rotation);
+    glm::vec2 x_axis(c * half.x, s * half.x);
+    glm::vec2 y_axis(-s * half.y, c * half.y);
+    // same winding as the quad: (-1,-1) (-1,1) (1,1) (1,-1)
+    glm::vec2 p0 = sprite.center - x_axis - y_axis;
+    glm::vec2 p1 = sprite.center - x_axis + y_axis;
+    glm::vec2 p2 = sprite.center + x_axis + y_axis;
+    glm::vec2 p3 = sprite.center + x_axis - y_axis;
+    const glm::vec4& uv = sprite.uvs;
+    pending.push_back({ glm::vec3(p0, 0), sprite.color, glm::vec2(uv.x, uv.y) });
+    pending.push_back({ glm::vec3(p1, 0), sprite.color, glm::vec2(uv.x, uv.w) });
+    pending.push_back({ glm::vec3(p2, 0), sprite.color, glm::vec2(uv.z, uv.w) });
+    pending.push_back({ glm::vec3(p3, 0), sprite.color, glm::vec2(uv.z, uv.y) });
+}
+
+void SpriteBatcher::flush()
+{
+    if (pending.empty())
+        return;
+    uint32_t count = static_cast<uint32_t>(pending.size() / 4);
+    // the allocator maps one range at a time, so the batch is built on the CPU and copied with a single map
+    vk::DeviceSize slot_offset = vertices_offset + sizeof(sprite_vertex_t) * 4 * capacity * slot;
+    if (auto map = mem->map<sprite_vertex_t>(slot_offset + sizeof(sprite_vertex_t) * 4 * flushed,
+        sizeof(sprite_vertex_t) * pending.size()))
+        std::copy(pending.begin(), pending.end(), map.ptr);
+
+    rec->bind_pipeline(pipeline);
+    rec->bind_vertex_buffer(0, *buffer, slot_offset);
+    rec->bind_index_buffer(*buffer, 0, vk::IndexType::eUint32);
+    rec->bind_descriptor_set(layout, 0, texture);
+    rec->draw_indexed(6 * count, 1, 0, static_cast<int32_t>(4 * flushed));
+
+    flushed += count;
+    sprites += count;
+    batches++;
+    pending.clear();
+}
+
+void SpriteBatcher::end()
+{
+    flush();
+    rec = nullptr;
+    frames++;
+    cpu_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+}
+
+void SpriteBatcher::report(std::ostream& os) const
+{
+    if (frames == 0)
+        return;
+    os << "SpriteBatcher: " << sprites / frames << " sprites, " << (double)batches / frames << " batches per frame, "
+        << (cpu_ms > 0 ? sprites / cpu_ms / 1000.0 : 0.0) << " M sprites/s\n";
+}
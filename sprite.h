@@ -0,0 +1,70 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+struct ResourceManager;
+struct MemoryRef;
+struct CommandRecorder;
+
+// Same layout as the vertices of the quad pipeline, so sprites draw with it.
+struct sprite_vertex_t
+{
+    glm::vec3 pos;
+    glm::vec3 col;
+    glm::vec2 uvs;
+};
+
+struct Sprite
+{
+    glm::vec2 center;
+    glm::vec2 size;
+    float rotation = 0;
+    glm::vec4 uvs = glm::vec4(0, 0, 1, 1); // u0, v0, u1, v1
+    glm::vec3 color = glm::vec3(1);
+};
+
+// Collects the sprites of a frame into batches of sprites sharing a texture (its descriptor set),
+// each batch is one indexed draw. A texture change or end() flushes the batch: its vertices are
+// copied after the previous ones in the frame slot range of the stream buffer and drawn with a
+// vertex offset, so the buffer is bound once per frame.
+struct SpriteBatcher
+{
+    ResourceManager& rm;
+    uint32_t capacity; // sprites per frame slot
+    // 6 indices per sprite, then one range of 4 * capacity vertices per frame slot
+    vk::UniqueBuffer buffer;
+    std::shared_ptr<MemoryRef> mem;
+    vk::DeviceSize vertices_offset;
+
+    // frame being recorded
+    CommandRecorder* rec = nullptr;
+    vk::Pipeline pipeline;
+    vk::PipelineLayout layout;
+    uint32_t slot = 0;
+    uint32_t flushed = 0; // sprites of the frame already in the buffer
+    vk::DescriptorSet texture;
+    std::vector<sprite_vertex_t> pending;
+    std::chrono::steady_clock::time_point frame_start;
+
+    uint64_t sprites = 0;
+    uint64_t batches = 0;
+    uint64_t frames = 0;
+    double cpu_ms = 0; // between begin() and end()
+
+    SpriteBatcher(ResourceManager& rm, uint32_t capacity, uint32_t frames_in_flight);
+
+    SpriteBatcher(const SpriteBatcher&) = delete;
+    SpriteBatcher& operator=(const SpriteBatcher&) = delete;
+
+    // pipeline must take sprite_vertex_t at binding 0 and the texture as set 0 of layout
+    void begin(CommandRecorder& recorder, uint32_t frame_slot, vk::Pipeline sprite_pipeline, vk::PipelineLayout sprite_layout);
+    // Throws once the frame holds more than capacity sprites.
+    void draw(vk::DescriptorSet sprite_texture, const Sprite& sprite);
+    void flush();
+    void end();
+    void report(std::ostream& os) const;
+};
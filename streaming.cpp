@@ -0,0 +1,181 @@
+#include "streaming.h"
+#include "resource.h"
+#include "device.h"
+#include "allocator.h"
+#include <iostream>
+#include <algorithm>
+
+TextureStreamer::TextureStreamer(ResourceManager& rm, vk::DeviceSize frame_budget, uint32_t tail_size)
+    : rm(rm), frame_budget(frame_budget), tail_size(tail_size)
+{
+    vk::BufferCreateInfo staging_info;
+    staging_info.size = frame_budget;
+    staging_info.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    staging = rm.device.device->createBufferUnique(staging_info);
+    staging_mem = rm.memory.allocate(rm.device.device->getBufferMemoryRequirements(*staging),
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    rm.device.device->bindBufferMemory(*staging, staging_mem->chunk->device_memory, staging_mem->chunk->offset);
+
+    cmd = std::move(rm.device.device->allocateCommandBuffersUnique(
+        { *rm.device.cmd_pool, vk::CommandBufferLevel::ePrimary, 1 }).front());
+}
+
+std::shared_ptr<ImageResource> TextureStreamer::load_texture2D(const std::string& path)
+{
+    auto source = rm.load_source(path);
+    auto res = rm.create_image2D(source->format, source->mips[0].width, source->mips[0].height,
+        static_cast<uint32_t>(source->mips.size()));
+    res->source = source;
+
+    // the tail is every level fitting in tail_size x tail_size, always at least the last one
+    uint32_t tail = static_cast<uint32_t>(source->mips.size()) - 1;
+    while (tail > 0 && std::max<uint32_t>(source->mips[tail - 1].width, source->mips[tail - 1].height) <= tail_size)
+        tail--;
+
+    std::vector<uint8_t> data;
+    std::vector<vk::BufferImageCopy> regions;
+    for (uint32_t level = tail; level < source->mips.size(); level++)
+    {
+        const MipSource& mip = source->mips[level];
+        vk::BufferImageCopy region;
+        region.bufferOffset = (data.size() + 15) & ~15ull;
+        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+        region.imageExtent = vk::Extent3D(mip.width, mip.height, 1);
+        regions.push_back(region);
+        data.resize(region.bufferOffset + mip.size);
+        std::copy_n(mip.data, mip.size, data.data() + region.bufferOffset);
+    }
+    // every level ends up in eShaderReadOnlyOptimal, the ones above the tail are masked by minLod
+    rm.upload_image2D(*res, data.data(), data.size(), regions);
+
+    res->resident_lod = tail;
+    res->requested_lod = 0;
+    if (tail > 0)
+        entries.push_back({ res, static_cast<int32_t>(tail) - 1, 0 });
+    return res;
+}
+
+void TextureStreamer::request(const std::shared_ptr<ImageResource>& tex, uint32_t lod)
+{
+    tex->requested_lod = lod;
+    for (auto& entry : entries)
+        if (entry.tex.lock() == tex)
+            return;
+    if (lod < tex->resident_lod)
+        entries.push_back({ tex, static_cast<int32_t>(tex->resident_lod) - 1, 0 });
+}
+
+bool TextureStreamer::update()
+{
+    bool changed = false;
+    if (pending)
+    {
+        if (!rm.device.scheduler->is_complete(done))
+            return false;
+        pending = false;
+        for (auto& done : completed)
+        {
+            done.tex->resident_lod = std::min<uint32_t>(done.tex->resident_lod, done.level);
+            changed = true;
+        }
+        completed.clear();
+    }
+
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry& entry) {
+        auto tex = entry.tex.lock();
+        return !tex || entry.level < static_cast<int32_t>(tex->requested_lod);
+    }), entries.end());
+    if (entries.empty())
+        return changed;
+
+    // smallest pending mips first across all textures
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        auto ta = a.tex.lock(), tb = b.tex.lock();
+        return ta->source->mips[ta->base_mip + a.level].size < tb->source->mips[tb->base_mip + b.level].size;
+    });
+
+    struct Copy
+    {
+        std::shared_ptr<ImageResource> tex;
+        vk::BufferImageCopy region;
+    };
+    std::vector<Copy> copies;
+    vk::DeviceSize offset = 0;
+    if (auto map = staging_mem->map(0, frame_budget))
+    {
+        for (auto& entry : entries)
+        {
+            auto tex = entry.tex.lock();
+            while (entry.level >= static_cast<int32_t>(tex->requested_lod))
+            {
+                // uncompressed formats only: a level is split in bands of whole rows
+                const MipSource& mip = tex->source->mips[tex->base_mip + entry.level];
+                vk::DeviceSize row_pitch = mip.size / mip.height;
+                offset = (offset + 15) & ~15ull;
+                uint32_t rows = static_cast<uint32_t>(std::min<vk::DeviceSize>(
+                    mip.height - entry.row, offset < frame_budget ? (frame_budget - offset) / row_pitch : 0));
+                if (rows == 0)
+                    break;
+
+                Copy copy{ tex };
+                copy.region.bufferOffset = offset;
+                copy.region.imageSubresource = vk::ImageSubresourceLayers(
+                    vk::ImageAspectFlagBits::eColor, entry.level, 0, 1);
+                copy.region.imageOffset = vk::Offset3D(0, entry.row, 0);
+                copy.region.imageExtent = vk::Extent3D(mip.width, rows, 1);
+                copies.push_back(copy);
+                std::copy_n(mip.data + entry.row * row_pitch, rows * row_pitch, map.ptr + offset);
+                offset += rows * row_pitch;
+
+                entry.row += rows;
+                if (entry.row < mip.height)
+                    break;
+                completed.push_back({ tex, static_cast<uint32_t>(entry.level) });
+                entry.level--;
+                entry.row = 0;
+            }
+        }
+    }
+    if (copies.empty())
+        return changed;
+
+    // levels being written are never sampled because of the minLod clamp,
+    // keep eShaderReadOnlyOptimal as old layout so the bands of previous frames survive
+    std::vector<vk::ImageMemoryBarrier> to_transfer, to_shader;
+    for (auto& copy : copies)
+    {
+        vk::ImageMemoryBarrier barrier;
+        barrier.image = *copy.tex->texture;
+        barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor,
+            copy.region.imageSubresource.mipLevel, 1, 0, 1);
+        barrier.srcAccessMask = vk::AccessFlagBits::eShaderRead;
+        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.oldLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+        to_transfer.push_back(barrier);
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+        barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        to_shader.push_back(barrier);
+    }
+
+    cmd->reset();
+    cmd->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eFragmentShader,
+        vk::PipelineStageFlagBits::eTransfer,
+        {}, nullptr, nullptr, to_transfer);
+    for (auto& copy : copies)
+        cmd->copyBufferToImage(*staging, *copy.tex->texture, vk::ImageLayout::eTransferDstOptimal, copy.region);
+    cmd->pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eFragmentShader,
+        {}, nullptr, nullptr, to_shader);
+    cmd->end();
+
+    done = rm.device.scheduler->submit(0, *cmd);
+    pending = true;
+    streamed_bytes += offset;
+    return changed;
+}
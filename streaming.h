@@ -0,0 +1,53 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include "timeline.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ResourceManager;
+struct ImageResource;
+struct MemoryRef;
+
+// Progressive texture loading: the mip tail is uploaded at load time so the texture can be
+// sampled right away (clamped with ResourceManager::sampler(resident_lod)), the bigger mips
+// are streamed in over the following frames within frame_budget bytes per frame.
+struct TextureStreamer
+{
+    struct Entry
+    {
+        std::weak_ptr<ImageResource> tex;
+        int32_t level; // mip currently being streamed
+        uint32_t row;  // first row of level not uploaded yet
+    };
+    struct Completed
+    {
+        std::shared_ptr<ImageResource> tex;
+        uint32_t level;
+    };
+
+    ResourceManager& rm;
+    vk::DeviceSize frame_budget;
+    uint32_t tail_size;
+    std::vector<Entry> entries;
+
+    // one batch in flight at a time, reusing a staging buffer of frame_budget bytes
+    vk::UniqueBuffer staging;
+    std::shared_ptr<MemoryRef> staging_mem;
+    vk::UniqueCommandBuffer cmd;
+    TimelinePoint done; // of the batch in flight
+    bool pending = false;
+    std::vector<Completed> completed;
+    vk::DeviceSize streamed_bytes = 0;
+
+    TextureStreamer(ResourceManager& rm, vk::DeviceSize frame_budget = 4 << 20, uint32_t tail_size = 64);
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    std::shared_ptr<ImageResource> load_texture2D(const std::string& path);
+    void request(const std::shared_ptr<ImageResource>& tex, uint32_t lod);
+    // Call once per frame, returns true when a texture got a new resident_lod and its
+    // descriptors need a sampler with the new clamp.
+    bool update();
+};
@@ -0,0 +1,101 @@
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+// Shared between the caller and a running task, checked by the task at every suspension point.
+struct CancelToken
+{
+    std::atomic<bool> cancelled = false;
+    void cancel() { cancelled = true; }
+};
+
+struct TaskCancelled : std::runtime_error
+{
+    TaskCancelled() : std::runtime_error("task cancelled") {}
+};
+
+inline void throw_if_cancelled(const std::shared_ptr<CancelToken>& cancel)
+{
+    if (cancel && cancel->cancelled)
+        throw TaskCancelled();
+}
+
+// Lazy coroutine producing a T. Awaiting it from another coroutine starts it and continues the
+// awaiter when it finishes; plain code calls start() and polls done() before get().
+// A started task must not be destroyed before it is done, cancel it and wait instead.
+template<typename T>
+struct task
+{
+    struct promise_type
+    {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+        std::atomic<bool> finished = false;
+
+        struct final_awaiter
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                // once finished is set the owner may destroy the frame, read everything before
+                auto next = h.promise().continuation;
+                h.promise().finished.store(true, std::memory_order_release);
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        final_awaiter final_suspend() noexcept { return {}; }
+        template<typename U>
+        void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+
+    task() = default;
+    explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    task(task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    task& operator=(task&& other) noexcept
+    {
+        if (handle)
+            handle.destroy();
+        handle = std::exchange(other.handle, nullptr);
+        return *this;
+    }
+    ~task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    // Runs the coroutine up to its first suspension.
+    void start() { handle.resume(); }
+    bool done() const { return handle && handle.promise().finished.load(std::memory_order_acquire); }
+    // Result of a finished task, rethrows what the coroutine threw (TaskCancelled included).
+    T get()
+    {
+        if (handle.promise().error)
+            std::rethrow_exception(handle.promise().error);
+        return std::move(*handle.promise().value);
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+    T await_resume() { return get(); }
+};
@@ -0,0 +1,90 @@
+#include "timeline.h"
+#include <algorithm>
+
+uint32_t GpuScheduler::add_queue(vk::Queue queue)
+{
+    vk::SemaphoreTypeCreateInfo type_info(vk::SemaphoreType::eTimeline, 0);
+    vk::SemaphoreCreateInfo semaphore_info;
+    semaphore_info.pNext = &type_info;
+    Timeline timeline;
+    timeline.queue = queue;
+    timeline.semaphore = device.createSemaphoreUnique(semaphore_info);
+    timelines.push_back(std::move(timeline));
+    return static_cast<uint32_t>(timelines.size() - 1);
+}
+
+TimelinePoint GpuScheduler::submit(const Submit& submit)
+{
+    Timeline& timeline = timelines[submit.queue];
+    // binary semaphores first, their values in the timeline info are ignored
+    std::vector<vk::Semaphore> wait_semaphores = submit.binary_waits;
+    std::vector<vk::PipelineStageFlags> wait_stages = submit.binary_wait_stages;
+    std::vector<uint64_t> wait_values(wait_semaphores.size(), 0);
+    for (const Wait& wait : submit.waits)
+    {
+        if (is_complete(wait.point))
+            continue;
+        wait_semaphores.push_back(*timelines[wait.point.queue].semaphore);
+        wait_stages.push_back(wait.stage);
+        wait_values.push_back(wait.point.value);
+    }
+    std::vector<vk::Semaphore> signal_semaphores = submit.binary_signals;
+    std::vector<uint64_t> signal_values(signal_semaphores.size(), 0);
+    uint64_t value = ++timeline.submitted;
+    signal_semaphores.push_back(*timeline.semaphore);
+    signal_values.push_back(value);
+
+    vk::TimelineSemaphoreSubmitInfo timeline_info;
+    timeline_info.setWaitSemaphoreValues(wait_values);
+    timeline_info.setSignalSemaphoreValues(signal_values);
+    vk::SubmitInfo submit_info;
+    submit_info.pNext = &timeline_info;
+    submit_info.setWaitSemaphores(wait_semaphores);
+    submit_info.setWaitDstStageMask(wait_stages);
+    submit_info.setCommandBuffers(submit.cmds);
+    submit_info.setSignalSemaphores(signal_semaphores);
+    timeline.queue.submit(submit_info);
+    submits++;
+    return { submit.queue, value };
+}
+
+TimelinePoint GpuScheduler::submit(uint32_t queue, vk::CommandBuffer cmd, const std::vector<Wait>& waits)
+{
+    Submit submit_info;
+    submit_info.queue = queue;
+    submit_info.cmds.push_back(cmd);
+    submit_info.waits = waits;
+    return submit(submit_info);
+}
+
+uint64_t GpuScheduler::completed(uint32_t queue) const
+{
+    const Timeline& timeline = timelines[queue];
+    timeline.completed = std::max<uint64_t>(timeline.completed, device.getSemaphoreCounterValue(*timeline.semaphore));
+    return timeline.completed;
+}
+
+bool GpuScheduler::is_complete(TimelinePoint point) const
+{
+    return point.value <= timelines[point.queue].completed || point.value <= completed(point.queue);
+}
+
+bool GpuScheduler::wait(TimelinePoint point, uint64_t timeout)
+{
+    if (is_complete(point))
+        return true;
+    cpu_waits++;
+    vk::SemaphoreWaitInfo wait_info;
+    wait_info.setSemaphores(*timelines[point.queue].semaphore);
+    wait_info.setValues(point.value);
+    if (device.waitSemaphores(wait_info, timeout) != vk::Result::eSuccess)
+        return false;
+    timelines[point.queue].completed = std::max<uint64_t>(timelines[point.queue].completed, point.value);
+    return true;
+}
+
+void GpuScheduler::wait_all()
+{
+    for (uint32_t i = 0; i < timelines.size(); i++)
+        wait(last(i));
+}
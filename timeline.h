@@ -0,0 +1,63 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+
+// A value on the timeline of one queue, reached once every submit up to it completed.
+struct TimelinePoint
+{
+    uint32_t queue = 0;
+    uint64_t value = 0; // 0 is always complete
+};
+
+// Every queue gets a timeline semaphore whose value only grows: each submit signals the next
+// value and returns it, later submits (on any queue) wait on points instead of fences and the
+// CPU polls or blocks on them. Swapchain acquire/present still need binary semaphores, they
+// go alongside in the same submit.
+struct GpuScheduler
+{
+    struct Timeline
+    {
+        vk::Queue queue;
+        vk::UniqueSemaphore semaphore;
+        uint64_t submitted = 0;          // last value a submit will signal
+        mutable uint64_t completed = 0;  // last value read back, only grows
+    };
+    struct Wait
+    {
+        TimelinePoint point;
+        vk::PipelineStageFlags stage;
+    };
+    struct Submit
+    {
+        uint32_t queue = 0;
+        std::vector<vk::CommandBuffer> cmds;
+        std::vector<Wait> waits;
+        std::vector<vk::Semaphore> binary_waits;
+        std::vector<vk::PipelineStageFlags> binary_wait_stages;
+        std::vector<vk::Semaphore> binary_signals;
+    };
+
+    vk::Device device;
+    std::vector<Timeline> timelines;
+    uint64_t submits = 0;
+    uint64_t cpu_waits = 0;
+
+    GpuScheduler(vk::Device device) : device(device) {}
+
+    GpuScheduler(const GpuScheduler&) = delete;
+    GpuScheduler& operator=(const GpuScheduler&) = delete;
+
+    // Returns the index used in TimelinePoint::queue.
+    uint32_t add_queue(vk::Queue queue);
+    // Submits and signals the next value of the queue timeline, returned as the point to wait on.
+    // Waits already complete on the CPU side are dropped.
+    TimelinePoint submit(const Submit& submit);
+    TimelinePoint submit(uint32_t queue, vk::CommandBuffer cmd, const std::vector<Wait>& waits = {});
+    // Point reached once everything submitted to queue so far completed.
+    TimelinePoint last(uint32_t queue = 0) const { return { queue, timelines[queue].submitted }; }
+    uint64_t completed(uint32_t queue = 0) const;
+    bool is_complete(TimelinePoint point) const;
+    // Blocks until point completed, false on timeout.
+    bool wait(TimelinePoint point, uint64_t timeout = UINT64_MAX);
+    void wait_all();
+};
@@ -0,0 +1,285 @@
+#include "vfs.h"
+#include "executor.h"
+#include <iostream>
+#include <condition_variable>
+#include <algorithm>
+
+// completion keys, reads use their own OVERLAPPED so only the control messages need one
+constexpr ULONG_PTR IO_READ = 0;
+constexpr ULONG_PTR IO_SUBMIT = 1;
+constexpr ULONG_PTR IO_STOP = 2;
+// covers 512 and 4096 byte sectors for unbuffered reads
+constexpr uint64_t IO_SECTOR = 4096;
+
+static std::runtime_error io_error(const std::string& what, const std::string& path)
+{
+    DWORD error = GetLastError();
+    return std::runtime_error("FileSystem: " + what + " " + path + " (error " + std::to_string(error) + ")");
+}
+
+FileSystem::FileSystem(Executor& fallback, bool use_port) : fallback(fallback)
+{
+    if (use_port)
+        port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (port)
+        io_thread = std::thread(&FileSystem::io_loop, this);
+    else
+        std::cout << "FileSystem: no completion port, reading on the thread pool\n";
+}
+
+FileSystem::~FileSystem()
+{
+    if (port)
+    {
+        PostQueuedCompletionStatus(port, 0, IO_STOP, nullptr);
+        io_thread.join();
+        CloseHandle(port);
+    }
+}
+
+void FileSystem::mount(const std::string& dir)
+{
+    roots.push_back(dir);
+}
+
+std::string FileSystem::resolve(const std::string& name) const
+{
+    for (const auto& root : roots)
+    {
+        std::string path = root + "/" + name;
+        if (GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES)
+            return path;
+    }
+    return name;
+}
+
+void FileSystem::read(std::vector<FileRequest> batch)
+{
+    reads += batch.size();
+    if (!port)
+    {
+        for (auto& request : batch)
+        {
+            fallback.post([this, request = std::move(request)] {
+                FileData data;
+                try
+                {
+                    data = read_blocking(request);
+                }
+                catch (...)
+                {
+                    return request.done({}, std::current_exception());
+                }
+                request.done(std::move(data), nullptr);
+            });
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& request : batch)
+            submitted.push_back(std::move(request));
+    }
+    PostQueuedCompletionStatus(port, 0, IO_SUBMIT, nullptr);
+}
+
+std::vector<FileData> FileSystem::read_all(const std::vector<std::string>& names)
+{
+    std::vector<FileData> files(names.size());
+    std::vector<std::exception_ptr> errors(names.size());
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    size_t left = names.size();
+    std::vector<FileRequest> batch(names.size());
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        batch[i].name = names[i];
+        batch[i].done = [&, i](FileData&& data, std::exception_ptr error) {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            files[i] = std::move(data);
+            errors[i] = error;
+            if (--left == 0)
+                done_cv.notify_one();
+        };
+    }
+    read(std::move(batch));
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cv.wait(lock, [&] { return left == 0; });
+    for (auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+    return files;
+}
+
+FileData FileSystem::read_blocking(const FileRequest& request)
+{
+    std::string path = resolve(request.name);
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        throw io_error("cannot open", path);
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    uint64_t size = request.size ? request.size : file_size.QuadPart - request.offset;
+    FileData data;
+    data.storage.resize(size);
+    data.size = size;
+    LARGE_INTEGER offset;
+    offset.QuadPart = request.offset;
+    DWORD bytes = 0;
+    BOOL ok = size <= MAXDWORD && SetFilePointerEx(file, offset, NULL, FILE_BEGIN)
+        && ReadFile(file, data.storage.data(), static_cast<DWORD>(size), &bytes, NULL) && bytes == size;
+    CloseHandle(file);
+    if (!ok)
+        throw io_error("cannot read", path);
+    bytes_read += size;
+    return data;
+}
+
+void FileSystem::io_loop()
+{
+    bool stopping = false;
+    while (!stopping || !in_flight.empty())
+    {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(port, &bytes, &key, &overlapped, INFINITE);
+        if (key == IO_STOP)
+        {
+            // a read of a slow device could hold the shutdown for long, their completions come back aborted
+            for (Read* read : in_flight)
+                CancelIoEx(read->file, nullptr);
+            stopping = true;
+            continue;
+        }
+        if (key == IO_SUBMIT)
+        {
+            std::vector<FileRequest> batch;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                batch.swap(submitted);
+            }
+            for (auto& request : batch)
+            {
+                auto read = new Read();
+                read->request = std::move(request);
+                start(read);
+            }
+            continue;
+        }
+        if (!overlapped)
+            continue;
+        Read* read = reinterpret_cast<Read*>(overlapped);
+        if (stopping)
+        {
+            // shutting down, just collect the cancelled reads
+            retire(read);
+            CloseHandle(read->file);
+            delete read;
+            continue;
+        }
+        finish(read, ok, bytes);
+    }
+}
+
+void FileSystem::start(Read* read)
+{
+    const FileRequest& request = read->request;
+    std::string path = resolve(request.name);
+    try
+    {
+        DWORD flags = FILE_FLAG_OVERLAPPED | (request.direct ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN);
+        read->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+        if (read->file == INVALID_HANDLE_VALUE)
+            throw io_error("cannot open", path);
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(read->file, &file_size);
+        uint64_t size = request.size ? request.size : file_size.QuadPart - request.offset;
+
+        // unbuffered reads need sector aligned offset, length and buffer, the extra bytes are skipped
+        uint64_t begin = request.direct ? request.offset / IO_SECTOR * IO_SECTOR : request.offset;
+        uint64_t end = request.direct ? (request.offset + size + IO_SECTOR - 1) / IO_SECTOR * IO_SECTOR : request.offset + size;
+        if (end - begin > MAXDWORD)
+            throw std::runtime_error("FileSystem: read too large " + path);
+        size_t slack = request.direct ? IO_SECTOR : 0;
+        read->data.storage.resize(end - begin + slack);
+        uint8_t* buffer = read->data.storage.data();
+        if (request.direct)
+            buffer = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(buffer) + IO_SECTOR - 1) & ~(IO_SECTOR - 1));
+        read->data.offset = (buffer - read->data.storage.data()) + (request.offset - begin);
+        read->data.size = size;
+        read->expected = request.offset - begin + size;
+
+        if (!CreateIoCompletionPort(read->file, port, IO_READ, 0))
+            throw io_error("cannot attach", path);
+        read->overlapped.Offset = static_cast<DWORD>(begin);
+        read->overlapped.OffsetHigh = static_cast<DWORD>(begin >> 32);
+        // the completion is queued on the port even when ReadFile finishes right away
+        if (!ReadFile(read->file, buffer, static_cast<DWORD>(end - begin), NULL, &read->overlapped)
+            && GetLastError() != ERROR_IO_PENDING)
+            throw io_error("cannot read", path);
+        in_flight.push_back(read);
+        if (request.direct)
+            direct_reads++;
+    }
+    catch (...)
+    {
+        if (read->file != INVALID_HANDLE_VALUE)
+            CloseHandle(read->file);
+        read->request.done({}, std::current_exception());
+        delete read;
+    }
+}
+
+void FileSystem::retire(Read* read)
+{
+    auto it = std::find(in_flight.begin(), in_flight.end(), read);
+    *it = in_flight.back();
+    in_flight.pop_back();
+}
+
+void FileSystem::finish(Read* read, BOOL ok, DWORD bytes)
+{
+    retire(read);
+    CloseHandle(read->file);
+    // direct reads come back rounded to sectors but may stop short at the end of the file
+    if (!ok || bytes < read->expected)
+        read->request.done({}, std::make_exception_ptr(io_error("cannot read", read->request.name)));
+    else
+    {
+        bytes_read += read->data.size;
+        read->request.done(std::move(read->data), nullptr);
+    }
+    delete read;
+}
+
+void FileReadAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+    request.done = [this, h](FileData&& data, std::exception_ptr e) {
+        result = std::move(data);
+        error = e;
+        executor.post([h] { h.resume(); }, priority);
+    };
+    std::vector<FileRequest> batch;
+    batch.push_back(std::move(request));
+    fs.read(std::move(batch));
+}
+
+FileData FileReadAwaiter::await_resume()
+{
+    if (error)
+        std::rethrow_exception(error);
+    return std::move(result);
+}
+
+FileReadAwaiter read_async(FileSystem& fs, std::string name, Executor& executor, int priority,
+    uint64_t offset, uint64_t size, bool direct)
+{
+    FileRequest request;
+    request.name = std::move(name);
+    request.offset = offset;
+    request.size = size;
+    request.direct = direct;
+    return { fs, std::move(request), executor, priority };
+}
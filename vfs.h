@@ -0,0 +1,100 @@
+#pragma once
+#include <windows.h>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+struct Executor;
+
+// Bytes of a file (or of a range of it). Unbuffered reads land at a sector aligned address
+// inside storage, data() points at the first requested byte.
+struct FileData
+{
+    std::vector<uint8_t> storage;
+    size_t offset = 0;
+    size_t size = 0;
+
+    const uint8_t* data() const { return storage.data() + offset; }
+};
+
+struct FileRequest
+{
+    std::string name;
+    uint64_t offset = 0;
+    uint64_t size = 0; // 0 reads up to the end of the file
+    // bypass the system cache (FILE_FLAG_NO_BUFFERING), for big pack reads that are used once
+    bool direct = false;
+    std::function<void(FileData&&, std::exception_ptr)> done;
+};
+
+// Virtual file system: names are resolved against the mounted directories and read with overlapped
+// I/O on a completion port. The caller only queues a batch, opening, reading and completing the files
+// happens on the I/O thread. Without a completion port the reads run blocking on the fallback pool.
+struct FileSystem
+{
+    struct Read
+    {
+        OVERLAPPED overlapped = {}; // first, the completion hands back this pointer
+        HANDLE file = INVALID_HANDLE_VALUE;
+        FileRequest request;
+        FileData data;
+        size_t expected = 0;
+    };
+
+    Executor& fallback;
+    std::vector<std::string> roots;
+    HANDLE port = NULL;
+    std::thread io_thread;
+    std::mutex mutex;
+    std::vector<FileRequest> submitted;
+    std::vector<Read*> in_flight; // I/O thread only
+
+    std::atomic<uint64_t> reads = 0;
+    std::atomic<uint64_t> direct_reads = 0;
+    std::atomic<uint64_t> bytes_read = 0;
+
+    FileSystem(Executor& fallback, bool use_port = true);
+    // Cancels the reads in flight and waits for them without running their callbacks, queued ones are dropped.
+    ~FileSystem();
+
+    FileSystem(const FileSystem&) = delete;
+    FileSystem& operator=(const FileSystem&) = delete;
+
+    // Directories searched in mount order, the name is used as is when no root has it.
+    void mount(const std::string& dir);
+    std::string resolve(const std::string& name) const;
+    // Queues the batch with a single wake up of the I/O thread. done is called on the I/O thread
+    // (or a fallback thread) and must not block.
+    void read(std::vector<FileRequest> batch);
+    // Reads the whole batch and waits for it, for startup loads.
+    std::vector<FileData> read_all(const std::vector<std::string>& names);
+    FileData read_blocking(const FileRequest& request);
+
+    void io_loop();
+    void start(Read* read);
+    void finish(Read* read, BOOL ok, DWORD bytes);
+    void retire(Read* read);
+};
+
+// co_await read_async(fs, name, executor) suspends until the file is in memory and continues on executor.
+struct FileReadAwaiter
+{
+    FileSystem& fs;
+    FileRequest request;
+    Executor& executor;
+    int priority;
+    FileData result;
+    std::exception_ptr error;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    FileData await_resume();
+};
+
+FileReadAwaiter read_async(FileSystem& fs, std::string name, Executor& executor, int priority = 0,
+    uint64_t offset = 0, uint64_t size = 0, bool direct = false);